@@ -261,6 +261,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/walletmodeltransaction.h \
     src/rpcclient.h \
     src/rpcprotocol.h \
+    src/rpcwriter.h \
     src/rpcserver.h \
     src/rpcvelocity.h \
     src/qt/overviewpage.h \
@@ -292,6 +293,9 @@ HEADERS += src/qt/bitcoingui.h \
     src/activemasternode.h \
     src/masternodeconfig.h \
     src/masternodeman.h \
+    src/msgverify.h \
+    src/scheduler.h \
+    src/addrindex.h \
     src/masternode-payments.h \
     src/spork.h \
     src/crypto/common.h \
@@ -383,6 +387,8 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/qt/walletmodeltransaction.cpp \
     src/rpcclient.cpp \
     src/rpcprotocol.cpp \
+    src/rpcwriter.cpp \
+    src/rest.cpp \
     src/rpcserver.cpp \
     src/rpcdump.cpp \
     src/rpcmisc.cpp \
@@ -418,6 +424,9 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/instantx.cpp \
     src/activemasternode.cpp \
     src/masternodeman.cpp \
+    src/msgverify.cpp \
+    src/scheduler.cpp \
+    src/addrindex.cpp \
     src/masternode-payments.cpp \
     src/spork.cpp \
     src/masternodeconfig.cpp \
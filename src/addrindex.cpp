@@ -0,0 +1,282 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrindex.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+CAddrIndexBuilder addrIndexBuilder;
+
+CAddrIndexBuilder::CAddrIndexBuilder()
+{
+    nHeight = -1;
+    fSynced = false;
+    nFailures = 0;
+    nRetryTime = 0;
+    nThreads = 1;
+}
+
+void CAddrIndexBuilder::SetProgress(int nHeightIn, bool fSyncedIn)
+{
+    LOCK(cs);
+    nHeight = nHeightIn;
+    fSynced = fSyncedIn;
+    nFailures = 0;
+}
+
+void CAddrIndexBuilder::SetFailed(int64_t nRetryTimeIn)
+{
+    LOCK(cs);
+    nFailures++;
+    nRetryTime = nRetryTimeIn;
+}
+
+bool CAddrIndexBuilder::IsSynced() const
+{
+    LOCK(cs);
+    return fSynced;
+}
+
+int CAddrIndexBuilder::GetHeight() const
+{
+    LOCK(cs);
+    return nHeight;
+}
+
+std::string CAddrIndexBuilder::GetState() const
+{
+    LOCK(cs);
+    if (fSynced)
+        return "synced";
+    return nFailures > 0 ? "failed" : "building";
+}
+
+std::string CAddrIndexBuilder::GetStatus() const
+{
+    LOCK(cs);
+    if (fSynced)
+        return "Address index is up to date";
+    if (nFailures > 0)
+        return strprintf("Address index failed to build at block %d, %d attempts so far, next in %ds (see debug.log)",
+            nHeight, nFailures, std::max((int64_t)0, nRetryTime - GetTime()));
+    return strprintf("Address index is still being built, at block %d", nHeight);
+}
+
+void CAddrIndexBuilder::BuildRange(const std::vector<CBlockIndex*>& vBlocks, unsigned int nBegin, unsigned int nEnd, AddrIndexEntries* pvEntries,
+    std::vector<CAddrIndexKey>* pvSpent, char* pfOk)
+{
+    CTxDB txdb("r");
+    for (unsigned int i = nBegin; i < nEnd; i++)
+    {
+        boost::this_thread::interruption_point();
+
+        CBlock block;
+        if (!block.ReadFromDisk(vBlocks[i], true) || !block.GetAddressIndexEntries(txdb, vBlocks[i]->nHeight, *pvEntries, *pvSpent))
+        {
+            LogPrintf("CAddrIndexBuilder::BuildRange() : indexing block %d failed\n", vBlocks[i]->nHeight);
+            return;
+        }
+    }
+    *pfOk = true;
+}
+
+bool CAddrIndexBuilder::Prepare()
+{
+    bool fWipe = false;
+    {
+        LOCK(cs_main);
+        CTxDB txdb("rw");
+        uint256 hashBest;
+        if (!txdb.ReadAddrIndexBest(hashBest))
+            fWipe = true;
+        else
+        {
+            BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+            if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+            {
+                // the chain was reorganised while running without -addrindex, so entries of blocks no longer in it are left
+                LogPrintf("Address index is not on the best chain, rebuilding it\n");
+                if (!txdb.EraseAddrIndexBest())
+                    return error("CAddrIndexBuilder::Prepare() : EraseAddrIndexBest failed");
+                fWipe = true;
+            }
+            else
+                SetProgress(mi->second->nHeight, mi->second == pindexBest);
+        }
+    }
+
+    // without a best indexed block ConnectBlock leaves the index alone, so the wipe can run unlocked
+    if (fWipe)
+    {
+        LogPrintf("Clearing the address index\n");
+        CTxDB txdb("rw");
+        if (!txdb.EraseAllAddrIndex())
+            return error("CAddrIndexBuilder::Prepare() : EraseAllAddrIndex failed");
+    }
+
+    return true;
+}
+
+bool CAddrIndexBuilder::BuildBatch(bool& fMore)
+{
+    fMore = false;
+    int64_t nTimeStart = GetTimeMillis();
+
+    std::vector<CBlockIndex*> vBlocks;
+    int nBestHeightBatch;
+    {
+        LOCK(cs_main);
+        CTxDB txdb("r");
+        uint256 hashBest;
+        CBlockIndex* pindex = pindexGenesisBlock;
+        if (txdb.ReadAddrIndexBest(hashBest))
+        {
+            BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+            if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+                return error("CAddrIndexBuilder::BuildBatch() : best indexed block %s is not on the best chain", hashBest.ToString());
+            if (mi->second == pindexBest)
+            {
+                SetProgress(mi->second->nHeight, true);
+                LogPrintf("Address index is up to date at block %d\n", mi->second->nHeight);
+                return true;
+            }
+            pindex = mi->second->pnext;
+        }
+
+        for (; pindex && vBlocks.size() < (unsigned int)nThreads * ADDRINDEX_BUILD_RANGE; pindex = pindex->pnext)
+            vBlocks.push_back(pindex);
+        nBestHeightBatch = nBestHeight;
+    }
+    if (vBlocks.empty())
+        return true;
+
+    // index a contiguous range per worker, block data and the tx index are only read
+    unsigned int nPerThread = (vBlocks.size() + nThreads - 1) / nThreads;
+    std::vector<AddrIndexEntries> vResults(nThreads);
+    std::vector<std::vector<CAddrIndexKey> > vSpentResults(nThreads);
+    std::vector<char> vOk(nThreads, false);
+    boost::thread_group workers;
+    try
+    {
+        for (int i = 0; i < nThreads; i++)
+        {
+            unsigned int nBegin = i * nPerThread;
+            unsigned int nEnd = std::min((unsigned int)vBlocks.size(), nBegin + nPerThread);
+            if (nBegin >= nEnd)
+            {
+                vOk[i] = true;
+                continue;
+            }
+            workers.create_thread(boost::bind(&CAddrIndexBuilder::BuildRange, boost::cref(vBlocks), nBegin, nEnd, &vResults[i], &vSpentResults[i], &vOk[i]));
+        }
+        workers.join_all();
+    }
+    catch (boost::thread_interrupted&)
+    {
+        workers.interrupt_all();
+        workers.join_all();
+        throw;
+    }
+
+    AddrIndexEntries vEntries;
+    std::vector<CAddrIndexKey> vSpent;
+    bool fOk = true;
+    for (int i = 0; i < nThreads; i++)
+    {
+        fOk = fOk && vOk[i];
+        vEntries.insert(vEntries.end(), vResults[i].begin(), vResults[i].end());
+        AddrIndexEntries().swap(vResults[i]);
+        vSpent.insert(vSpent.end(), vSpentResults[i].begin(), vSpentResults[i].end());
+        std::vector<CAddrIndexKey>().swap(vSpentResults[i]);
+    }
+
+    CBlockIndex* pindexFirst = vBlocks.front();
+    CBlockIndex* pindexLast = vBlocks.back();
+    {
+        LOCK(cs_main);
+        CTxDB txdb("rw");
+        uint256 hashBest;
+        bool fHaveBest = txdb.ReadAddrIndexBest(hashBest);
+
+        // the chain was reorganised under the batch, take it again from where the index is now
+        bool fStale = pindexFirst->pprev ? (!fHaveBest || hashBest != pindexFirst->pprev->GetBlockHash()) : fHaveBest;
+        if (fStale || !pindexLast->IsInMainChain())
+        {
+            LogPrintf("Address index batch of blocks %d-%d is stale, building again\n", pindexFirst->nHeight, pindexLast->nHeight);
+            fMore = true;
+            return true;
+        }
+
+        if (!fOk)
+            return error("CAddrIndexBuilder::BuildBatch() : indexing blocks %d-%d failed", pindexFirst->nHeight, pindexLast->nHeight);
+
+        if (!txdb.WriteAddrIndexBatch(vEntries, vSpent, pindexLast->GetBlockHash()))
+            return error("CAddrIndexBuilder::BuildBatch() : writing blocks %d-%d failed", pindexFirst->nHeight, pindexLast->nHeight);
+
+        SetProgress(pindexLast->nHeight, pindexLast == pindexBest);
+    }
+
+    LogPrintf("Address index built to block %d of %d, %u entries in %dms\n",
+        pindexLast->nHeight, nBestHeightBatch, vEntries.size(), GetTimeMillis() - nTimeStart);
+
+    if (IsSynced())
+    {
+        // the batches are spread over many overlapping files, compact them so range scans touch few
+        int64_t nTimeCompact = GetTimeMillis();
+        CTxDB txdb("r");
+        txdb.CompactType("adx");
+        LogPrintf("Compacted the address index in %dms\n", GetTimeMillis() - nTimeCompact);
+        return true;
+    }
+
+    fMore = true;
+    return true;
+}
+
+void CAddrIndexBuilder::ThreadBuild()
+{
+    // a failure, say a block that can't be read or a full disk, may go away, so it is tried again with a growing delay
+    int64_t nDelay = ADDRINDEX_RETRY_SECONDS;
+    int nHeightFailed = -2;
+    while (true)
+    {
+        bool fOk = Prepare();
+        bool fMore = fOk;
+        while (fOk && fMore)
+        {
+            fOk = BuildBatch(fMore);
+            boost::this_thread::interruption_point();
+        }
+        if (fOk)
+            return;
+
+        // the delay starts over when the index got further since the last failure
+        if (GetHeight() != nHeightFailed)
+            nDelay = ADDRINDEX_RETRY_SECONDS;
+        nHeightFailed = GetHeight();
+
+        SetFailed(GetTime() + nDelay);
+        LogPrintf("Address index can't be built at block %d, trying again in %ds\n", GetHeight(), nDelay);
+        MilliSleep(nDelay * 1000);
+        nDelay = std::min(nDelay * 2, (int64_t)ADDRINDEX_RETRY_MAX_SECONDS);
+    }
+}
+
+void CAddrIndexBuilder::Start(boost::thread_group& threadGroup, int nThreadsIn)
+{
+    if (nThreadsIn <= 0)
+        nThreadsIn = boost::thread::hardware_concurrency();
+    if (nThreadsIn <= 0)
+        nThreadsIn = 1;
+    nThreads = nThreadsIn;
+
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "addrindex",
+        boost::function<void()>(boost::bind(&CAddrIndexBuilder::ThreadBuild, this))));
+
+    LogPrintf("Building the address index in the background using %d threads\n", nThreads);
+}
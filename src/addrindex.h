@@ -0,0 +1,71 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef ADDRINDEX_H
+#define ADDRINDEX_H
+
+#include "main.h"
+#include "sync.h"
+
+#include <vector>
+
+#include <boost/thread.hpp>
+
+// blocks a worker reads per batch
+#define ADDRINDEX_BUILD_RANGE                 500
+// seconds to wait before building again after a failure, doubled on each failure in a row up to the maximum
+#define ADDRINDEX_RETRY_SECONDS               10
+#define ADDRINDEX_RETRY_MAX_SECONDS           3600
+
+class CAddrIndexBuilder;
+
+extern CAddrIndexBuilder addrIndexBuilder;
+
+//
+// Builds the address index in the background while the node runs.
+//
+// The database records the last block of the best chain the index covers (see
+// CTxDB::ReadAddrIndexBest). The builder takes the blocks after it in batches, lets worker threads
+// read and index a range of the batch each, and writes the entries of the whole batch in key order
+// together with the new last block. A restart picks up from there. ConnectBlock and DisconnectBlock
+// only touch the index when it has reached their block, so once the builder is at the tip the index
+// follows the chain by itself. A reorganisation while a batch is built makes the batch stale; it is
+// thrown away and built again. A batch that fails is built again after a delay, and the failure is
+// reported by GetStatus until a batch goes through.
+//
+class CAddrIndexBuilder
+{
+private:
+    mutable CCriticalSection cs;
+    int nHeight;        // last indexed block, -1 before any
+    bool fSynced;       // caught up with the best chain
+    int nFailures;      // failed attempts in a row, 0 while building works
+    int64_t nRetryTime; // when the next attempt starts after a failure
+    int nThreads;
+
+    static void BuildRange(const std::vector<CBlockIndex*>& vBlocks, unsigned int nBegin, unsigned int nEnd, AddrIndexEntries* pvEntries,
+        std::vector<CAddrIndexKey>* pvSpent, char* pfOk);
+
+    void ThreadBuild();
+    // Read or reset the progress, false if the index can't be used
+    bool Prepare();
+    // Index the next batch, false if it failed. fMore tells whether batches are left
+    bool BuildBatch(bool& fMore);
+    void SetProgress(int nHeightIn, bool fSyncedIn);
+    void SetFailed(int64_t nRetryTimeIn);
+
+public:
+    CAddrIndexBuilder();
+
+    // Start building in the background, nThreadsIn <= 0 means one worker per core
+    void Start(boost::thread_group& threadGroup, int nThreadsIn);
+
+    bool IsSynced() const;
+    int GetHeight() const;
+    // "synced", "building" or "failed"
+    std::string GetState() const;
+    // Why the index can't be used yet, for RPC errors
+    std::string GetStatus() const;
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include "util.h"
 #include "masternodeman.h"
 #include "instantx.h"
+#include "msgverify.h"
 #include "ui_interface.h"
 
 #include <boost/algorithm/string/replace.hpp>
@@ -34,6 +35,8 @@ std::vector<CTxIn> vecMasternodesUsed;
 map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 // Keep track of the active Masternode
 CActiveMasternode activeMasternode;
+// Runs the Darksend and Masternode maintenance tasks
+CScheduler darkSendScheduler;
 
 // count peers we've requested the list from
 int RequestedMasterNodeList = 0;
@@ -151,6 +154,7 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
 
             LogPrint("darksend", "dsq - new Darksend queue object - %s\n", addr.ToString().c_str());
             vecDarksendQueue.push_back(dsq);
+            darkSendScheduler.Schedule("darksend-timeout", (dsq.time + DARKSEND_QUEUE_TIMEOUT + 1) * 1000);
             dsq.Relay();
             dsq.time = GetTime();
         }
@@ -451,6 +455,7 @@ bool CDarksendPool::IsBlockchainSynced()
 
     TRY_LOCK(cs_main, lockMain);
     if(!lockMain) return false;
+    CSchedulerLockTimer lockTimer;
 
     CBlockIndex* pindex = pindexBest;
     if(pindex == NULL) return false;
@@ -589,6 +594,7 @@ void CDarksendPool::CheckFinalTransaction()
     CWalletTx txNew = CWalletTx(pwalletMain, finalTransaction);
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
+    CSchedulerLockTimer lockTimer;
     {
         LogPrint("darksend", "Transaction 2: %s\n", txNew.ToString());
 
@@ -891,6 +897,32 @@ void CDarksendPool::CheckTimeout(){
     }
 }
 
+int64_t CDarksendPool::GetNextTimeout()
+{
+    int64_t addLagTime = 0;
+    if(!fMasterNode) addLagTime = 10000;
+
+    // the session (or the idle pool) times out, signing has a shorter timeout
+    int64_t nNext = lastTimeChanged + (DARKSEND_QUEUE_TIMEOUT*1000) + addLagTime;
+    if(state == POOL_STATUS_SIGNING)
+        nNext = std::min(nNext, lastTimeChanged + (DARKSEND_SIGNING_TIMEOUT*1000) + addLagTime);
+
+    // clients reset 10 seconds after an error or success
+    if(!fMasterNode && (state == POOL_STATUS_ERROR || state == POOL_STATUS_SUCCESS))
+        nNext = std::min(nNext, lastTimeChanged + 10000);
+
+    // IsExpired() is true one second after the timeout
+    BOOST_FOREACH(const CDarksendQueue& dsq, vecDarksendQueue)
+        nNext = std::min(nNext, (dsq.time + DARKSEND_QUEUE_TIMEOUT + 1) * 1000);
+
+    if(state == POOL_STATUS_ACCEPTING_ENTRIES || state == POOL_STATUS_QUEUE) {
+        BOOST_FOREACH(const CDarkSendEntry& entry, entries)
+            nNext = std::min(nNext, (entry.addedTime + DARKSEND_QUEUE_TIMEOUT + 1) * 1000);
+    }
+
+    return nNext;
+}
+
 //
 // Check for complete queue
 //
@@ -1398,6 +1430,7 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
         strAutoDenomResult = _("Lock is already in place.");
         return false;
     }
+    CSchedulerLockTimer lockTimer;
 
     if(!IsBlockchainSynced()) {
         strAutoDenomResult = _("Can't mix while sync in progress.");
@@ -1923,6 +1956,9 @@ bool CDarksendPool::IsCompatibleWithSession(int64_t nDenom, CTransaction txColla
     lastTimeChanged = GetTimeMillis();
     vecSessionCollateral.push_back(txCollateral);
 
+    // the queue might be full now
+    darkSendScheduler.Trigger("darksend-timeout");
+
     return true;
 }
 
@@ -1974,33 +2010,32 @@ int CDarksendPool::GetDenominations(const std::vector<CTxDSOut>& vout){
     return GetDenominations(vout2);
 }
 
+int GetDenominationIndex(int64_t nAmount)
+{
+    // darkSendDenominations is ordered from large to small
+    std::vector<int64_t>::const_iterator it = std::lower_bound(darkSendDenominations.begin(), darkSendDenominations.end(), nAmount, std::greater<int64_t>());
+    if (it == darkSendDenominations.end() || *it != nAmount)
+        return -1;
+    return it - darkSendDenominations.begin();
+}
+
 // return a bitshifted integer representing the denominations in this list
 int CDarksendPool::GetDenominations(const std::vector<CTxOut>& vout, bool fSingleRandomDenom){
-    std::vector<pair<int64_t, int> > denomUsed;
-
-    // make a list of denominations, with zero uses
-    BOOST_FOREACH(int64_t d, darkSendDenominations)
-        denomUsed.push_back(make_pair(d, 0));
-
-    // look for denominations and update uses to 1
-    BOOST_FOREACH(CTxOut out, vout){
-        bool found = false;
-        BOOST_FOREACH (PAIRTYPE(int64_t, int)& s, denomUsed){
-            if (out.nValue == s.first){
-                s.second = 1;
-                found = true;
-            }
-        }
-        if(!found) return 0;
+    int nUsed = 0;
+
+    // look for denominations and turn their bits on
+    BOOST_FOREACH(const CTxOut& out, vout){
+        int nIndex = GetDenominationIndex(out.nValue);
+        if(nIndex == -1) return 0;
+        nUsed |= 1 << nIndex;
     }
 
     int denom = 0;
-    int c = 0;
     // if the denomination is used, shift the bit on.
     // then move to the next
-    BOOST_FOREACH (PAIRTYPE(int64_t, int)& s, denomUsed){
-        int bit = (fSingleRandomDenom ? rand()%2 : 1) * s.second;
-        denom |= bit << c++;
+    for(unsigned int c = 0; c < darkSendDenominations.size(); c++){
+        int bit = (fSingleRandomDenom ? rand()%2 : 1) * ((nUsed >> c) & 1);
+        denom |= bit << c;
         if(fSingleRandomDenom && bit) break; // use just one random denomination
     }
 
@@ -2037,15 +2072,7 @@ int CDarksendPool::GetDenominationsByAmount(int64_t nAmount, int nDenomTarget){
 
     // Make outputs by looping through denominations, from small to large
     BOOST_REVERSE_FOREACH(int64_t v, darkSendDenominations){
-        if(nDenomTarget != 0){
-            bool fAccepted = false;
-            if((nDenomTarget & (1 << 0)) && v == ((1000*COIN) +1000000)) {fAccepted = true;}
-            else if((nDenomTarget & (1 << 1)) && v == ((100*COIN) +100000)) {fAccepted = true;}
-            else if((nDenomTarget & (1 << 2)) && v == ((10*COIN) +10000)) {fAccepted = true;}
-            else if((nDenomTarget & (1 << 3)) && v == ((1*COIN)  +1000)) {fAccepted = true;}
-            else if((nDenomTarget & (1 << 4)) && v == ((.1*COIN) +100)) {fAccepted = true;}
-            if(!fAccepted) continue;
-        }
+        if(nDenomTarget != 0 && !(nDenomTarget & (1 << GetDenominationIndex(v)))) continue;
 
         int nOutputs = 0;
 
@@ -2140,20 +2167,8 @@ bool CDarkSendSigner::SignMessage(std::string strMessage, std::string& errorMess
 
 bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
 {
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << strMessageMagic;
-    ss << strMessage;
-
-    CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
-        errorMessage = _("Error recovering public key.");
-        return false;
-    }
-
-    if (fDebug && (pubkey2.GetID() != pubkey.GetID()))
-        LogPrintf("CDarkSendSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
-
-    return (pubkey2.GetID() == pubkey.GetID());
+    // cached, a message relayed by every peer is only checked once
+    return messageVerifier.Verify(pubkey, vchSig, strMessage, errorMessage);
 }
 
 bool CDarksendQueue::Sign()
@@ -2258,48 +2273,101 @@ void CDarksendPool::RelayCompletedTransaction(const int sessionID, const bool er
 }
 
 //TODO: Rename/move to core
-void ThreadCheckDarkSendPool()
+//
+// Maintenance tasks, run by darkSendScheduler on the Darksend thread
+//
+
+static void TaskManageStatus()
 {
-    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
+    // start right after sync is considered to be done, then check every few minutes
+    if(!darkSendPool.IsBlockchainSynced()) {
+        darkSendScheduler.Schedule("masternode-status", GetTimeMillis() + 1000);
+        return;
+    }
 
-    // Make this thread recognisable as the wallet flushing thread
-    RenameThread("Arion-darksend");
+    activeMasternode.ManageStatus();
+}
 
-    unsigned int c = 0;
+static void TaskCheckMasternodes()
+{
+    if(!darkSendPool.IsBlockchainSynced()) return;
 
-    while (true)
+    mnodeman.CheckAndRemove();
+    mnodeman.ProcessMasternodeConnections();
+
+    // ask every peer once for the payment winners we don't have yet
+    vector<CNode*> vNodesCopy;
     {
-        MilliSleep(1000);
-        //LogPrintf("ThreadCheckDarkSendPool::check timeout\n");
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes){
+            if(pnode->nVersion < masternodePayments.GetMinMasternodePaymentsProto()) continue;
+            if(pnode->HasFulfilledRequest("mnsync")) continue;
+            pnode->FulfilledRequest("mnsync");
+            vNodesCopy.push_back(pnode->AddRef());
+        }
+    }
 
-        // try to sync from all available nodes, one step at a time
-        //masternodeSync.Process();
+    BOOST_FOREACH(CNode* pnode, vNodesCopy){
+        masternodePayments.RequestSync(pnode);
+        pnode->Release();
+    }
+}
 
+static void TaskDumpMasternodes()
+{
+    if(!darkSendPool.IsBlockchainSynced()) return;
 
-        if(darkSendPool.IsBlockchainSynced()) {
+    DumpMasternodes();
+}
 
-            c++;
+static void TaskCleanPaymentList()
+{
+    if(!darkSendPool.IsBlockchainSynced()) return;
 
-            // check if we should activate or ping every few minutes,
-            // start right after sync is considered to be done
-            if(c % MASTERNODE_PING_SECONDS == 1) activeMasternode.ManageStatus();
+    masternodePayments.CleanPaymentList();
+}
 
-            if(c % 60 == 0)
-            {
-                mnodeman.CheckAndRemove();
-                mnodeman.ProcessMasternodeConnections();
-                masternodePayments.CleanPaymentList();
-                CleanTransactionLocksList();
-            }
+static void TaskCleanTransactionLocks()
+{
+    int64_t nNextExpiration = CleanTransactionLocksList();
+    if(nNextExpiration > 0)
+        darkSendScheduler.Schedule("transaction-locks", (nNextExpiration + 1) * 1000);
+}
 
-            //if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
+static void TaskCheckTimeout()
+{
+    if(!darkSendPool.IsBlockchainSynced()) return;
 
-            darkSendPool.CheckTimeout();
-            darkSendPool.CheckForCompleteQueue();
+    darkSendPool.CheckTimeout();
+    darkSendPool.CheckForCompleteQueue();
 
-            if(darkSendPool.GetState() == POOL_STATUS_IDLE && c % 15 == 0){
-                darkSendPool.DoAutomaticDenominating();
-            }
-        }
-    }
+    darkSendScheduler.Schedule("darksend-timeout", darkSendPool.GetNextTimeout());
+}
+
+static void TaskAutomaticDenominating()
+{
+    if(!darkSendPool.IsBlockchainSynced()) return;
+
+    if(darkSendPool.GetState() == POOL_STATUS_IDLE)
+        darkSendPool.DoAutomaticDenominating();
+}
+
+void ThreadCheckDarkSendPool()
+{
+    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
+
+    // Make this thread recognisable as the wallet flushing thread
+    RenameThread("Arion-darksend");
+
+    // tasks with an interval fall back to running periodically, the others only run when
+    // a new block, a new lock or a state change gives them something to do
+    darkSendScheduler.AddTask("masternode-status", &TaskManageStatus, MASTERNODE_PING_SECONDS*1000);
+    darkSendScheduler.AddTask("masternode-list", &TaskCheckMasternodes, 60*1000, 60*1000);
+    darkSendScheduler.AddTask("masternode-dump", &TaskDumpMasternodes, MASTERNODES_DUMP_SECONDS*1000, MASTERNODES_DUMP_SECONDS*1000);
+    darkSendScheduler.AddTask("masternode-payments", &TaskCleanPaymentList, 0, 60*1000);
+    darkSendScheduler.AddTask("transaction-locks", &TaskCleanTransactionLocks, 60*1000, 60*1000);
+    darkSendScheduler.AddTask("darksend-timeout", &TaskCheckTimeout, 15*1000);
+    darkSendScheduler.AddTask("darksend-denominate", &TaskAutomaticDenominating, 15*1000, 15*1000);
+
+    darkSendScheduler.ServiceQueue();
 }
@@ -12,6 +12,7 @@
 #include "masternodeman.h"
 #include "masternode-payments.h"
 #include "darksend-relay.h"
+#include "scheduler.h"
 
 class CTxIn;
 class CDarksendPool;
@@ -52,6 +53,7 @@ extern std::vector<CDarksendQueue> vecDarksendQueue;
 extern std::string strMasterNodePrivKey;
 extern map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 extern CActiveMasternode activeMasternode;
+extern CScheduler darkSendScheduler;
 
 /** Holds an Darksend input
  */
@@ -412,6 +414,7 @@ public:
             if(fMasterNode) {
                 RelayStatus(darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_RESET);
             }
+            darkSendScheduler.Trigger("darksend-timeout");
         }
         state = newState;
     }
@@ -449,6 +452,8 @@ public:
     void ChargeRandomFees();
     void CheckTimeout();
     void CheckForCompleteQueue();
+    /// Time in UTC milliseconds when CheckTimeout() next has something to expire or reset
+    int64_t GetNextTimeout();
     /// Check to make sure a signature matches an input in the pool
     bool SignatureValid(const CScript& newSig, const CTxIn& newVin);
     /// If the collateral is valid given by a client
@@ -506,4 +511,7 @@ public:
 
 void ThreadCheckDarkSendPool();
 
+// Index of nAmount in darkSendDenominations, which is also its bit in a denomination mask; -1 if it isn't a denomination
+int GetDenominationIndex(int64_t nAmount);
+
 #endif
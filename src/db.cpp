@@ -342,6 +342,117 @@ bool CDBEnv::RemoveDb(const string& strFile)
     return (rc == 0);
 }
 
+CDBBatch* CDBEnv::GetBatch(const string& strFile)
+{
+    LOCK(cs_db);
+    map<string, CDBBatch*>::iterator mi = mapBatch.find(strFile);
+    if (mi == mapBatch.end() || (*mi).second->threadOwner != boost::this_thread::get_id())
+        return NULL;
+    return (*mi).second;
+}
+
+DbTxn* CDBEnv::GetBatchTxn(const string& strFile)
+{
+    LOCK(cs_db);
+    CDBBatch* pbatch = GetBatch(strFile);
+    return pbatch ? pbatch->GetTxn() : NULL;
+}
+
+void CDBEnv::BatchWritten(const string& strFile)
+{
+    LOCK(cs_db);
+    CDBBatch* pbatch = GetBatch(strFile);
+    if (pbatch)
+        pbatch->Written();
+}
+
+
+//
+// CDBBatch
+//
+
+CDBBatch::CDBBatch(const string& strFileIn, const string& strNameIn, unsigned int nCommitIntervalIn) :
+    strFile(strFileIn), strName(strNameIn), ptxn(NULL), fActive(false),
+    nCommitInterval(std::max(nCommitIntervalIn, 1u)), nPending(0), nWrites(0), nCommits(0), nCommitTime(0), nTxnStart(0)
+{
+    nStartTime = GetTimeMillis();
+    if (strFile.empty())
+        return;
+
+    LOCK(bitdb.cs_db);
+    if (bitdb.mapBatch.count(strFile))
+        return; // nested: writes go to the outer batch
+
+    threadOwner = boost::this_thread::get_id();
+    bitdb.mapBatch[strFile] = this;
+    // Keep the flush thread and Rewrite() away from the file while the transaction is open
+    ++bitdb.mapFileUseCount[strFile];
+    fActive = true;
+}
+
+CDBBatch::~CDBBatch()
+{
+    if (!fActive)
+        return;
+
+    LOCK(bitdb.cs_db);
+    Commit();
+    bitdb.mapBatch.erase(strFile);
+    --bitdb.mapFileUseCount[strFile];
+    fActive = false;
+
+    if (nWrites > 0)
+    {
+        nWalletDBUpdated++;
+        LogPrint("db", "CDBBatch(%s) %s: %u writes in %u commits, %dms (%dms committing)\n",
+                 strFile, strName, nWrites, nCommits, GetTimeMillis() - nStartTime, nCommitTime);
+    }
+}
+
+DbTxn* CDBBatch::GetTxn()
+{
+    if (!ptxn)
+    {
+        ptxn = bitdb.TxnBegin();
+        nTxnStart = GetTimeMillis();
+    }
+    return ptxn;
+}
+
+void CDBBatch::Written()
+{
+    nWrites++;
+    if (++nPending >= nCommitInterval || GetTimeMillis() - nTxnStart >= DB_BATCH_MAX_TXN_MILLIS)
+        Commit();
+}
+
+bool CDBBatch::Commit()
+{
+    LOCK(bitdb.cs_db);
+    if (!ptxn)
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    int ret = ptxn->commit(0);
+    ptxn = NULL;
+    nPending = 0;
+    nCommits++;
+    nCommitTime += GetTimeMillis() - nStart;
+    if (ret != 0)
+        return error("CDBBatch::Commit() : %s commit of %s failed (%d)", strName, strFile, ret);
+    return true;
+}
+
+bool CDBBatch::CommitIfStale()
+{
+    {
+        LOCK(bitdb.cs_db);
+        if (!ptxn || GetTimeMillis() - nTxnStart < DB_BATCH_MAX_TXN_MILLIS)
+            return true;
+    }
+    return Commit();
+}
+
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
     while (true)
@@ -15,10 +15,12 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/thread.hpp>
 #include <db_cxx.h>
 
 class CAddrMan;
 class CBlockLocator;
+class CDBBatch;
 class CDiskBlockIndex;
 class CDiskTxPos;
 class COutPoint;
@@ -44,6 +46,7 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, CDBBatch*> mapBatch;
 
     CDBEnv();
     ~CDBEnv();
@@ -76,6 +79,11 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    /* Write batch owned by the calling thread for strFile, or NULL */
+    CDBBatch* GetBatch(const std::string& strFile);
+    DbTxn* GetBatchTxn(const std::string& strFile);
+    void BatchWritten(const std::string& strFile);
+
     DbTxn *TxnBegin(int flags=DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -89,6 +97,58 @@ public:
 extern CDBEnv bitdb;
 
 
+// Longest a CDBBatch keeps its transaction open before committing, in milliseconds
+static const int64_t DB_BATCH_MAX_TXN_MILLIS = 250;
+
+/** RAII scope that groups the writes made by the current thread to one
+ *  database file into a single transaction (group commit).
+ *  Every CDB handle on strFile opened by this thread while the scope is
+ *  alive joins the transaction, so callers keep using their own CWalletDB
+ *  objects. The transaction is committed every nCommitInterval writes or
+ *  DB_BATCH_MAX_TXN_MILLIS, whichever comes first, to bound how long other
+ *  threads' writes to the file wait on its page locks, and once more when
+ *  the scope ends. A scope opened while another is active on the same file
+ *  does nothing.
+ *  While the scope is alive the owning thread must not open a cursor or a
+ *  transaction of its own on strFile: neither runs inside the batch
+ *  transaction, so both would wait on its locks forever. CDB asserts this.
+ */
+class CDBBatch
+{
+private:
+    std::string strFile;
+    std::string strName;
+    boost::thread::id threadOwner;
+    DbTxn* ptxn;
+    bool fActive;
+    unsigned int nCommitInterval;
+    unsigned int nPending;
+    unsigned int nWrites;
+    unsigned int nCommits;
+    int64_t nStartTime;
+    int64_t nCommitTime;
+    int64_t nTxnStart;
+
+    CDBBatch(const CDBBatch&);
+    void operator=(const CDBBatch&);
+
+    friend class CDBEnv;
+    DbTxn* GetTxn();
+    void Written();
+
+public:
+    CDBBatch(const std::string& strFileIn, const std::string& strNameIn, unsigned int nCommitIntervalIn = 1000);
+    ~CDBBatch();
+
+    bool IsActive() const { return fActive; }
+    unsigned int GetWriteCount() const { return nWrites; }
+    // Commit the writes made so far; later writes start a new transaction
+    bool Commit();
+    // Commit if the transaction has been open for DB_BATCH_MAX_TXN_MILLIS, for long loops that write rarely
+    bool CommitIfStale();
+};
+
+
 /** RAII class that provides access to a Berkeley database */
 class CDB
 {
@@ -109,6 +169,14 @@ private:
     void operator=(const CDB&);
 
 protected:
+    // Our own transaction if one is open, else the thread's CDBBatch transaction
+    DbTxn* GetTxn()
+    {
+        if (activeTxn)
+            return activeTxn;
+        return bitdb.GetBatchTxn(strFile);
+    }
+
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
@@ -124,7 +192,7 @@ protected:
         // Read
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+        int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
         memset(datKey.get_data(), 0, datKey.get_size());
         if (datValue.get_data() == NULL)
             return false;
@@ -165,7 +233,10 @@ protected:
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        DbTxn* ptxn = GetTxn();
+        int ret = pdb->put(ptxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        if (ret == 0 && ptxn && ptxn != activeTxn)
+            bitdb.BatchWritten(strFile);
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -188,7 +259,10 @@ protected:
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
+        DbTxn* ptxn = GetTxn();
+        int ret = pdb->del(ptxn, &datKey, 0);
+        if (ret == 0 && ptxn && ptxn != activeTxn)
+            bitdb.BatchWritten(strFile);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -208,7 +282,7 @@ protected:
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
-        int ret = pdb->exists(activeTxn, &datKey, 0);
+        int ret = pdb->exists(GetTxn(), &datKey, 0);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -219,6 +293,8 @@ protected:
     {
         if (!pdb)
             return NULL;
+        // a cursor outside the batch transaction would wait on the batch's own locks
+        assert(!bitdb.GetBatch(strFile));
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
@@ -270,6 +346,8 @@ public:
     {
         if (!pdb || activeTxn)
             return false;
+        // writes have to go to the thread's batch while one is open, see CDBBatch
+        assert(!bitdb.GetBatch(strFile));
         DbTxn* ptxn = bitdb.TxnBegin();
         if (!ptxn)
             return false;
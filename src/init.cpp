@@ -22,6 +22,8 @@
 #include "masternode.h"
 #include "masternodeman.h"
 #include "masternodeconfig.h"
+#include "addrindex.h"
+#include "msgverify.h"
 #include "spork.h"
 #include "smessage.h"
 
@@ -129,7 +131,11 @@ void Shutdown()
         LOCK(cs_main);
 #ifdef ENABLE_WALLET
         if (pwalletMain)
+        {
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+            if (pwalletMain->fFileBacked)
+                CWalletDB(pwalletMain->strWalletFile).WriteCleanShutdown(true);
+        }
 #endif
     }
 #ifdef ENABLE_WALLET
@@ -193,7 +199,12 @@ std::string HelpMessage()
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: ariond.pid)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
-    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 100)") + "\n";
+    strUsage += "  -dbprofile=<profile>   " + _("Database sizes for the machine: small, default, large or auto to choose by RAM (default: auto)") + "\n";
+    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: from -dbprofile, 100 for default)") + "\n";
+    strUsage += "  -dbwritebuffer=<n>     " + _("Set database write buffer size in megabytes (default: from -dbprofile, 4 for default)") + "\n";
+    strUsage += "  -dbmaxopenfiles=<n>    " + _("Keep at most <n> database files open (default: from -dbprofile and the open file limit)") + "\n";
+    strUsage += "  -dbblocksize=<n>       " + _("Set database block size in kilobytes (default: from -dbprofile, 4 for default)") + "\n";
+    strUsage += "  -dbcompression         " + _("Compress database blocks, ignored when LevelDB is built without snappy (default: 1)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
@@ -235,7 +246,7 @@ std::string HelpMessage()
     strUsage += "  -debug=<category>      " + _("Output debugging information (default: 0, supplying <category> is optional)") + "\n";
     strUsage +=                               _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage +=                               _("<category> can be:");
-    strUsage +=                                 " addrman, alert, db, lock, rand, rpc, selectcoins, mempool, net,"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, db, leveldb, lock, rand, rpc, selectcoins, mempool, net,"; // Don't translate these and qt below
     strUsage +=                                 " coinage, coinstake, creation, stakemodifier";
     if (fHaveGUI){
         strUsage += ", qt.\n";
@@ -256,6 +267,10 @@ std::string HelpMessage()
         strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     }
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + _("Set the number of RPC calls that can wait for a thread, more are refused (default: 16)") + "\n";
+    strUsage += "  -rest                  " + _("Accept public REST requests for raw blocks, transactions and headers on the RPC port (default: 0)") + "\n";
+    strUsage += "  -restauth              " + _("Require the RPC user and password for REST requests (default: 0)") + "\n";
+    strUsage += "  -rpcservertimeout=<n>  " + _("Seconds a JSON-RPC client gets to send a request or read a reply, and idle keep-alive connections are kept (default: 30)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
@@ -268,6 +283,9 @@ std::string HelpMessage()
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
+    strUsage += "  -addrindex             " + _("Maintain an index of transactions by address, used by searchrawtransactions (default: 0)") + "\n";
+    strUsage += "  -reindexaddr           " + _("Rebuild the address index from the blocks on disk, in the background") + "\n";
+    strUsage += "  -addrindexthreads=<n>  " + _("Threads building the address index (default: one per core)") + "\n";
     strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
     strUsage += "\n" + _("Block creation options:") + "\n";
@@ -289,6 +307,7 @@ strUsage += "\n" + _("Masternode options:") + "\n";
     strUsage += "  -masternodeprivkey=<n>     " + _("Set the masternode private key") + "\n";
     strUsage += "  -masternodeaddr=<n>        " + _("Set external address:port to get to this masternode (example: address:port)") + "\n";
     strUsage += "  -masternodeminprotocol=<n> " + _("Ignore masternodes less than version (example: 61401; default : 0)") + "\n";
+    strUsage += "  -msgverifythreads=<n>      " + _("Threads verifying masternode, spork and InstantX message signatures (default: one per core)") + "\n";
 
     strUsage += "\n" + _("Darksend options:") + "\n";
     strUsage += "  -enabledarksend=<n>          " + _("Enable use of automated darksend for funds stored in this wallet (0-1, default: 0)") + "\n";
@@ -376,6 +395,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     nNodeLifespan = GetArg("-addrlifespan", 7);
     fUseFastIndex = GetBoolArg("-fastindex", true);
+    fAddrIndex = GetBoolArg("-addrindex", GetBoolArg("-reindexaddr", false));
     nMinerSleep = GetArg("-minersleep", 500);
 
     nDerivationMethodIndex = 0;
@@ -839,7 +859,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -990,21 +1010,17 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (!strErrors.str().empty())
         return InitError(strErrors.str());
 
+    uiInterface.InitMessage(_("Loading sporks..."));
+
+    LoadSporks();
+
     uiInterface.InitMessage(_("Loading masternode cache..."));
 
-    CMasternodeDB mndb;
-    CMasternodeDB::ReadResult readResult = mndb.Read(mnodeman);
-    if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok)
-    {
-        LogPrintf("Error reading mncache.dat: ");
-        if(readResult == CMasternodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+    // keep masternode collateral state in step with the mempool and chain
+    RegisterWallet(&collateralWatcher);
 
+    // read and verified off the startup path, the network fills the list meanwhile
+    LoadMasternodes(threadGroup);
 
     fMasterNode = GetBoolArg("-masternode", false);
     if(fMasterNode) {
@@ -1105,29 +1121,31 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     threadGroup.create_thread(boost::bind(&ThreadCheckDarkSendPool));
 
+    if(!fLiteMode)
+        messageVerifier.Start(threadGroup, GetArg("-msgverifythreads", 0));
+
 
 
     RandAddSeedPerfmon();
 
-    // reindex addresses found in blockchain
-    if(GetBoolArg("-reindexaddr", false))
+    // the address index is built in the background, from scratch when asked to or when it is from an older layout
+    if(fAddrIndex)
     {
-        uiInterface.InitMessage(_("Rebuilding address index..."));
-        CBlockIndex *pblockAddrIndex = pindexBest;
-	CTxDB txdbAddr("rw");
-	while(pblockAddrIndex)
-	{
-	    uiInterface.InitMessage(strprintf("Rebuilding address index, block %i", pblockAddrIndex->nHeight));
-	    bool ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions=true);
-	    CBlock pblockAddr;
-	    if(pblockAddr.ReadFromDisk(pblockAddrIndex, true))
-	        pblockAddr.RebuildAddressIndex(txdbAddr);
-	    pblockAddrIndex = pblockAddrIndex->pprev;
-	}
+        CTxDB txdbAddr("rw");
+        int nAddrIndexVersion;
+        bool fHaveVersion = txdbAddr.ReadAddrIndexVersion(nAddrIndexVersion);
+        if(GetBoolArg("-reindexaddr", false) || !fHaveVersion || nAddrIndexVersion != ADDRINDEX_VERSION)
+        {
+            // without a best indexed block the builder clears the index before starting
+            if(!txdbAddr.EraseAddrIndexBest() || !txdbAddr.WriteAddrIndexVersion(ADDRINDEX_VERSION))
+                return InitError(_("Error clearing the address index"));
+        }
+        addrIndexBuilder.Start(threadGroup, GetArg("-addrindexthreads", 0));
     }
 
     //// debug print
     LogPrintf("mapBlockIndex.size() = %u\n",   mapBlockIndex.size());
+    LogPrintf("block index arena = %u KiB\n",   GetBlockIndexArenaSize() * sizeof(CBlockIndex) / 1024);
     LogPrintf("nBestHeight = %d\n",                   nBestHeight);
 #ifdef ENABLE_WALLET
     LogPrintf("setKeyPool.size() = %u\n",      pwalletMain ? pwalletMain->setKeyPool.size() : 0);
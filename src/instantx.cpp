@@ -17,12 +17,7 @@
 using namespace std;
 using namespace boost;
 
-std::map<uint256, CTransaction> mapTxLockReq;
-std::map<uint256, CTransaction> mapTxLockReqRejected;
-std::map<uint256, CConsensusVote> mapTxLockVote;
-std::map<uint256, CTransactionLock> mapTxLocks;
-std::map<COutPoint, uint256> mapLockedInputs;
-std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
+CTxLockStore txLockStore;
 int nCompleteTXLocks;
 
 //txlock - Locks transaction
@@ -47,7 +42,7 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
+        if(txLockStore.HasRequest(tx.GetHash()) || txLockStore.HasRejectedRequest(tx.GetHash())){
             return;
         }
 
@@ -81,7 +76,7 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
 
             DoConsensusVote(tx, nBlockHeight);
 
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            txLockStore.AddRequest(tx);
 
             LogPrintf("ProcessMessageInstantX::txlreq - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -91,7 +86,7 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
             return;
 
         } else {
-            mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
+            txLockStore.AddRejectedRequest(tx);
 
             // can we get the conflicting transaction as proof?
 
@@ -100,24 +95,17 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
                 tx.GetHash().ToString().c_str()
             );
 
-            BOOST_FOREACH(const CTxIn& in, tx.vin){
-                if(!mapLockedInputs.count(in.prevout)){
-                    mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
-                }
-            }
+            txLockStore.LockInputs(tx);
 
             // resolve conflicts
-            std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(tx.GetHash());
-            if (i != mapTxLocks.end()){
-                //we only care if we have a complete tx lock
-                if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-                    if(!CheckForConflictingLocks(tx)){
-                        LogPrintf("ProcessMessageInstantX::txlreq - Found Existing Complete IX Lock\n");
-
-                        //reprocess the last 15 blocks
-                        block.DisconnectBlock(txdb, pindex);
-                        tx.DisconnectInputs(txdb);
-                    }
+            //we only care if we have a complete tx lock
+            if(txLockStore.CountLockSignatures(tx.GetHash()) >= INSTANTX_SIGNATURES_REQUIRED){
+                if(!CheckForConflictingLocks(tx)){
+                    LogPrintf("ProcessMessageInstantX::txlreq - Found Existing Complete IX Lock\n");
+
+                    //reprocess the last 15 blocks
+                    block.DisconnectBlock(txdb, pindex);
+                    tx.DisconnectInputs(txdb);
                 }
             }
 
@@ -132,11 +120,11 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockVote.count(ctx.GetHash())){
+        if(txLockStore.HasVote(ctx.GetHash())){
             return;
         }
 
-        mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+        txLockStore.AddVote(ctx);
 
         if(ProcessConsensusVote(pfrom, ctx)){
             //Spam/Dos protection
@@ -145,20 +133,13 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
                 This tracks those messages and allows it at the same rate of the rest of the network, if
                 a peer violates it, it will simply be ignored
             */
-            if(!mapTxLockReq.count(ctx.txHash) && !mapTxLockReqRejected.count(ctx.txHash)){
-                if(!mapUnknownVotes.count(ctx.vinMasternode.prevout.hash)){
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
-                }
-
-                if(mapUnknownVotes[ctx.vinMasternode.prevout.hash] > GetTime() &&
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] - GetAverageVoteTime() > 60*10){
+            if(!txLockStore.HasRequest(ctx.txHash) && !txLockStore.HasRejectedRequest(ctx.txHash)){
+                if(!txLockStore.CheckUnknownVote(ctx.vinMasternode.prevout.hash)){
                         LogPrintf("ProcessMessageInstantX::txlreq - masternode is spamming transaction votes: %s %s\n",
                             ctx.vinMasternode.ToString().c_str(),
                             ctx.txHash.ToString().c_str()
                         );
                         return;
-                } else {
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
                 }
             }
 
@@ -235,17 +216,9 @@ int64_t CreateNewLock(CTransaction tx)
     */
     int nBlockHeight = (pindexBest->nHeight - nTxAge)+4;
 
-    if (!mapTxLocks.count(tx.GetHash())){
+    if (txLockStore.NewLock(tx.GetHash(), nBlockHeight)){
         LogPrintf("CreateNewLock - New Transaction Lock %s !\n", tx.GetHash().ToString().c_str());
-
-        CTransactionLock newLock;
-        newLock.nBlockHeight = nBlockHeight;
-        newLock.nExpiration = GetTime()+(20*60); //locks expire after 20 minutes (20 confirmations)
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = tx.GetHash();
-        mapTxLocks.insert(make_pair(tx.GetHash(), newLock));
     } else {
-        mapTxLocks[tx.GetHash()].nBlockHeight = nBlockHeight;
         LogPrint("instantx", "CreateNewLock - Transaction Lock Exists %s !\n", tx.GetHash().ToString().c_str());
     }
 
@@ -289,7 +262,7 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
         return;
     }
 
-    mapTxLockVote[ctx.GetHash()] = ctx;
+    txLockStore.AddVote(ctx);
 
     CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
 
@@ -329,15 +302,8 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)){
+    if (txLockStore.NewLock(ctx.txHash, 0)){
         LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
-
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime()+(20*60);
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
     } else {
         LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
     }
@@ -346,9 +312,8 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
     CBlock block;
     CTxDB txdb("r");
     //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
-    if (i != mapTxLocks.end()){
-        (*i).second.AddSignature(ctx);
+    int nSignatures;
+    if (txLockStore.AddLockVote(ctx, nSignatures)){
 
 #ifdef ENABLE_WALLET
         if(pwalletMain){
@@ -358,34 +323,31 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         }
 #endif
 
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
+        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", nSignatures, ctx.GetHash().ToString().c_str());
 
-        if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
+        if(nSignatures >= INSTANTX_SIGNATURES_REQUIRED){
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", ctx.txHash.ToString().c_str());
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
+            CTransaction tx;
+            bool fHaveRequest = txLockStore.GetRequest(ctx.txHash, tx);
             if(!CheckForConflictingLocks(tx)){
 
 #ifdef ENABLE_WALLET
                 if(pwalletMain){
-                    if(pwalletMain->UpdatedTransaction((*i).second.txHash)){
+                    if(pwalletMain->UpdatedTransaction(ctx.txHash)){
                         nCompleteTXLocks++;
                     }
                 }
 #endif
 
-                if(mapTxLockReq.count(ctx.txHash)){
-                    BOOST_FOREACH(const CTxIn& in, tx.vin){
-                        if(!mapLockedInputs.count(in.prevout)){
-                            mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
-                        }
-                    }
+                if(fHaveRequest){
+                    txLockStore.LockInputs(tx);
                 }
 
                 // resolve conflicts
 
                 //if this tx lock was rejected, we need to remove the conflicting blocks
-                if(mapTxLockReqRejected.count((*i).second.txHash)){
+                if(txLockStore.HasRejectedRequest(ctx.txHash)){
                     //reprocess the last 15 blocks
                     block.DisconnectBlock(txdb, pindex);
                     tx.DisconnectInputs(txdb);
@@ -409,11 +371,12 @@ bool CheckForConflictingLocks(CTransaction& tx)
         rescan the blocks and find they're acceptable and then take the chain with the most work.
     */
     BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                LogPrintf("InstantX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), mapLockedInputs[in.prevout].ToString().c_str());
-                if(mapTxLocks.count(tx.GetHash())) mapTxLocks[tx.GetHash()].nExpiration = GetTime();
-                if(mapTxLocks.count(mapLockedInputs[in.prevout])) mapTxLocks[mapLockedInputs[in.prevout]].nExpiration = GetTime();
+        uint256 txHashLocked;
+        if(txLockStore.GetLockedInput(in.prevout, txHashLocked)){
+            if(txHashLocked != tx.GetHash()){
+                LogPrintf("InstantX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), txHashLocked.ToString().c_str());
+                txLockStore.ExpireLock(tx.GetHash());
+                txLockStore.ExpireLock(txHashLocked);
                 return true;
             }
         }
@@ -422,50 +385,11 @@ bool CheckForConflictingLocks(CTransaction& tx)
     return false;
 }
 
-int64_t GetAverageVoteTime()
+int64_t CleanTransactionLocksList()
 {
-    std::map<uint256, int64_t>::iterator it = mapUnknownVotes.begin();
-    int64_t total = 0;
-    int64_t count = 0;
-
-    while(it != mapUnknownVotes.end()) {
-        total+= it->second;
-        count++;
-        it++;
-    }
-
-    return total / count;
-}
-
-void CleanTransactionLocksList()
-{
-    if(pindexBest == NULL) return;
-
-    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
-
-    while(it != mapTxLocks.end()) {
-        if(GetTime() > it->second.nExpiration){ //keep them for an hour
-            LogPrintf("Removing old transaction lock %s\n", it->second.txHash.ToString().c_str());
-
-            if(mapTxLockReq.count(it->second.txHash)){
-                CTransaction& tx = mapTxLockReq[it->second.txHash];
-
-                BOOST_FOREACH(const CTxIn& in, tx.vin)
-                    mapLockedInputs.erase(in.prevout);
-
-                mapTxLockReq.erase(it->second.txHash);
-                mapTxLockReqRejected.erase(it->second.txHash);
-
-                BOOST_FOREACH(CConsensusVote& v, it->second.vecConsensusVotes)
-                    mapTxLockVote.erase(v.GetHash());
-            }
-
-            mapTxLocks.erase(it++);
-        } else {
-            it++;
-        }
-    }
+    if(pindexBest == NULL) return 0;
 
+    return txLockStore.Clean();
 }
 
 uint256 CConsensusVote::GetHash() const
@@ -554,12 +478,12 @@ bool CTransactionLock::SignaturesValid()
     return true;
 }
 
-void CTransactionLock::AddSignature(CConsensusVote& cv)
+void CTransactionLock::AddSignature(const CConsensusVote& cv)
 {
     vecConsensusVotes.push_back(cv);
 }
 
-int CTransactionLock::CountSignatures()
+int CTransactionLock::CountSignatures() const
 {
     /*
         Only count signatures where the BlockHeight matches the transaction's blockheight.
@@ -569,10 +493,388 @@ int CTransactionLock::CountSignatures()
     if(nBlockHeight == 0) return -1;
 
     int n = 0;
-    BOOST_FOREACH(CConsensusVote v, vecConsensusVotes){
+    BOOST_FOREACH(const CConsensusVote& v, vecConsensusVotes){
         if(v.nBlockHeight == nBlockHeight){
             n++;
         }
     }
     return n;
 }
+
+CTxLockStore::CTxLockStore()
+{
+    nUnknownVotesTimeTotal = 0;
+    nLocksComplete = 0;
+    nLocksCompleted = 0;
+    nLocksExpired = 0;
+    nVotesAdded = 0;
+    nVoteLatencyTotal = 0;
+    nVoteLatencyMax = 0;
+    nLockLatencyTotal = 0;
+    nLockLatencyMax = 0;
+}
+
+bool CTxLockStore::HasRequest(const uint256& txHash) const
+{
+    LOCK(cs);
+    return mapLockRequests.count(txHash);
+}
+
+bool CTxLockStore::HasRejectedRequest(const uint256& txHash) const
+{
+    LOCK(cs);
+    return mapLockRequestsRejected.count(txHash);
+}
+
+bool CTxLockStore::GetRequest(const uint256& txHash, CTransaction& tx) const
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransaction>::const_iterator it = mapLockRequests.find(txHash);
+    if (it == mapLockRequests.end())
+        return false;
+
+    tx = it->second;
+    return true;
+}
+
+void CTxLockStore::AddRequest(const CTransaction& tx)
+{
+    LOCK(cs);
+    mapLockRequests.insert(make_pair(tx.GetHash(), tx));
+}
+
+void CTxLockStore::AddRejectedRequest(const CTransaction& tx)
+{
+    LOCK(cs);
+    mapLockRequestsRejected.insert(make_pair(tx.GetHash(), tx));
+}
+
+bool CTxLockStore::HasVote(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapVotes.count(hash);
+}
+
+bool CTxLockStore::GetVote(const uint256& hash, CConsensusVote& vote) const
+{
+    LOCK(cs);
+
+    std::map<uint256, CConsensusVote>::const_iterator it = mapVotes.find(hash);
+    if (it == mapVotes.end())
+        return false;
+
+    vote = it->second;
+    return true;
+}
+
+void CTxLockStore::AddVote(const CConsensusVote& vote)
+{
+    LOCK(cs);
+    mapVotes[vote.GetHash()] = vote;
+}
+
+void CTxLockStore::SetExpiration(CTransactionLock& lock, int64_t nExpiration)
+{
+    if (lock.nExpiration != 0)
+        setExpiration.erase(make_pair((int64_t)lock.nExpiration, lock.txHash));
+
+    lock.nExpiration = nExpiration;
+    setExpiration.insert(make_pair(nExpiration, lock.txHash));
+
+    // IsExpired is checked as GetTime() > nExpiration
+    darkSendScheduler.Schedule("transaction-locks", (nExpiration + 1) * 1000);
+}
+
+bool CTxLockStore::NewLock(const uint256& txHash, int nBlockHeight)
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransactionLock>::iterator it = mapLocks.find(txHash);
+    if (it != mapLocks.end()) {
+        if (nBlockHeight != 0)
+            it->second.nBlockHeight = nBlockHeight;
+        return false;
+    }
+
+    CTransactionLock& lock = mapLocks[txHash];
+    lock.nBlockHeight = nBlockHeight;
+    lock.nTimeout = GetTime()+(60*5);
+    lock.nTimeCreated = GetTimeMillis();
+    lock.txHash = txHash;
+    SetExpiration(lock, GetTime()+(20*60)); //locks expire after 20 minutes (20 confirmations)
+
+    return true;
+}
+
+bool CTxLockStore::AddLockVote(const CConsensusVote& vote, int& nSignatures)
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransactionLock>::iterator it = mapLocks.find(vote.txHash);
+    if (it == mapLocks.end())
+        return false;
+
+    CTransactionLock& lock = it->second;
+    lock.AddSignature(vote);
+    nSignatures = lock.CountSignatures();
+
+    int64_t nLatency = GetTimeMillis() - lock.nTimeCreated;
+    nVotesAdded++;
+    nVoteLatencyTotal += nLatency;
+    nVoteLatencyMax = std::max(nVoteLatencyMax, nLatency);
+
+    if (!lock.fComplete && nSignatures >= INSTANTX_SIGNATURES_REQUIRED) {
+        lock.fComplete = true;
+        nLocksComplete++;
+        nLocksCompleted++;
+        nLockLatencyTotal += nLatency;
+        nLockLatencyMax = std::max(nLockLatencyMax, nLatency);
+    }
+
+    return true;
+}
+
+int CTxLockStore::CountLockSignatures(const uint256& txHash) const
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransactionLock>::const_iterator it = mapLocks.find(txHash);
+    if (it == mapLocks.end())
+        return -1;
+
+    return it->second.CountSignatures();
+}
+
+bool CTxLockStore::IsLockTimedOut(const uint256& txHash) const
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransactionLock>::const_iterator it = mapLocks.find(txHash);
+    if (it == mapLocks.end())
+        return false;
+
+    return GetTime() > it->second.nTimeout;
+}
+
+void CTxLockStore::ExpireLock(const uint256& txHash)
+{
+    LOCK(cs);
+
+    std::map<uint256, CTransactionLock>::iterator it = mapLocks.find(txHash);
+    if (it != mapLocks.end())
+        SetExpiration(it->second, GetTime());
+}
+
+void CTxLockStore::LockInputs(const CTransaction& tx)
+{
+    LOCK(cs);
+
+    BOOST_FOREACH(const CTxIn& in, tx.vin)
+        mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
+}
+
+void CTxLockStore::UnlockInputs(const CTransaction& tx)
+{
+    BOOST_FOREACH(const CTxIn& in, tx.vin) {
+        std::map<COutPoint, uint256>::iterator it = mapLockedInputs.find(in.prevout);
+        if (it != mapLockedInputs.end() && it->second == tx.GetHash())
+            mapLockedInputs.erase(it);
+    }
+}
+
+bool CTxLockStore::GetLockedInput(const COutPoint& outpoint, uint256& txHash) const
+{
+    LOCK(cs);
+
+    std::map<COutPoint, uint256>::const_iterator it = mapLockedInputs.find(outpoint);
+    if (it == mapLockedInputs.end())
+        return false;
+
+    txHash = it->second;
+    return true;
+}
+
+bool CTxLockStore::ConflictsWithLock(const CTransaction& tx) const
+{
+    LOCK(cs);
+
+    if (mapLockedInputs.empty())
+        return false;
+
+    uint256 hash = tx.GetHash();
+    BOOST_FOREACH(const CTxIn& in, tx.vin) {
+        std::map<COutPoint, uint256>::const_iterator it = mapLockedInputs.find(in.prevout);
+        if (it != mapLockedInputs.end() && it->second != hash)
+            return true;
+    }
+
+    return false;
+}
+
+int64_t CTxLockStore::GetAverageVoteTime() const
+{
+    if (mapUnknownVotes.empty())
+        return 0;
+
+    return nUnknownVotesTimeTotal / (int64_t)mapUnknownVotes.size();
+}
+
+bool CTxLockStore::CheckUnknownVote(const uint256& hashMasternode)
+{
+    LOCK(cs);
+
+    /*
+        Masternodes will sometimes propagate votes before the transaction is known to the client.
+        This tracks those messages and allows it at the same rate of the rest of the network.
+    */
+    int64_t nNow = GetTime();
+    std::map<uint256, int64_t>::iterator it = mapUnknownVotes.find(hashMasternode);
+    if (it == mapUnknownVotes.end()) {
+        it = mapUnknownVotes.insert(make_pair(hashMasternode, nNow+(60*10))).first;
+        nUnknownVotesTimeTotal += it->second;
+    }
+
+    if (it->second > nNow && it->second - GetAverageVoteTime() > 60*10)
+        return false;
+
+    nUnknownVotesTimeTotal += nNow+(60*10) - it->second;
+    it->second = nNow+(60*10);
+    return true;
+}
+
+void CTxLockStore::RemoveLock(std::map<uint256, CTransactionLock>::iterator it)
+{
+    const CTransactionLock& lock = it->second;
+
+    std::map<uint256, CTransaction>::iterator itRequest = mapLockRequests.find(lock.txHash);
+    if (itRequest != mapLockRequests.end()) {
+        UnlockInputs(itRequest->second);
+        mapLockRequests.erase(itRequest);
+    }
+
+    itRequest = mapLockRequestsRejected.find(lock.txHash);
+    if (itRequest != mapLockRequestsRejected.end()) {
+        UnlockInputs(itRequest->second);
+        mapLockRequestsRejected.erase(itRequest);
+    }
+
+    BOOST_FOREACH(const CConsensusVote& v, lock.vecConsensusVotes)
+        mapVotes.erase(v.GetHash());
+
+    if (lock.fComplete)
+        nLocksComplete--;
+
+    mapLocks.erase(it);
+}
+
+int64_t CTxLockStore::Clean()
+{
+    LOCK(cs);
+
+    int64_t nNow = GetTime();
+    while (!setExpiration.empty() && setExpiration.begin()->first < nNow) {
+        uint256 txHash = setExpiration.begin()->second;
+        setExpiration.erase(setExpiration.begin());
+
+        std::map<uint256, CTransactionLock>::iterator it = mapLocks.find(txHash);
+        if (it == mapLocks.end())
+            continue;
+
+        LogPrintf("Removing old transaction lock %s\n", txHash.ToString().c_str());
+        RemoveLock(it);
+        nLocksExpired++;
+    }
+
+    if (setExpiration.empty())
+        return 0;
+
+    return setExpiration.begin()->first;
+}
+
+int CTxLockStore::CountRequests() const
+{
+    LOCK(cs);
+    return mapLockRequests.size() + mapLockRequestsRejected.size();
+}
+
+int CTxLockStore::CountVotes() const
+{
+    LOCK(cs);
+    return mapVotes.size();
+}
+
+int CTxLockStore::CountLocks() const
+{
+    LOCK(cs);
+    return mapLocks.size();
+}
+
+int CTxLockStore::CountLockedInputs() const
+{
+    LOCK(cs);
+    return mapLockedInputs.size();
+}
+
+int CTxLockStore::CountCompleteLocks() const
+{
+    LOCK(cs);
+    return nLocksComplete;
+}
+
+uint64_t CTxLockStore::GetLocksCompleted() const
+{
+    LOCK(cs);
+    return nLocksCompleted;
+}
+
+uint64_t CTxLockStore::GetLocksExpired() const
+{
+    LOCK(cs);
+    return nLocksExpired;
+}
+
+uint64_t CTxLockStore::GetVotesAdded() const
+{
+    LOCK(cs);
+    return nVotesAdded;
+}
+
+int64_t CTxLockStore::GetAverageVoteLatency() const
+{
+    LOCK(cs);
+    return nVotesAdded == 0 ? 0 : nVoteLatencyTotal / (int64_t)nVotesAdded;
+}
+
+int64_t CTxLockStore::GetMaxVoteLatency() const
+{
+    LOCK(cs);
+    return nVoteLatencyMax;
+}
+
+int64_t CTxLockStore::GetAverageLockLatency() const
+{
+    LOCK(cs);
+    return nLocksCompleted == 0 ? 0 : nLockLatencyTotal / (int64_t)nLocksCompleted;
+}
+
+int64_t CTxLockStore::GetMaxLockLatency() const
+{
+    LOCK(cs);
+    return nLockLatencyMax;
+}
+
+std::string CTxLockStore::ToString() const
+{
+    LOCK(cs);
+
+    std::ostringstream info;
+
+    info << "Lock requests: " << (int)(mapLockRequests.size() + mapLockRequestsRejected.size()) <<
+            ", votes: " << (int)mapVotes.size() <<
+            ", locks: " << (int)mapLocks.size() <<
+            ", complete: " << nLocksComplete <<
+            ", locked inputs: " << (int)mapLockedInputs.size();
+
+    return info.str();
+}
@@ -21,12 +21,9 @@ using namespace boost;
 class CConsensusVote;
 class CTransaction;
 class CTransactionLock;
+class CTxLockStore;
 
-extern map<uint256, CTransaction> mapTxLockReq;
-extern map<uint256, CTransaction> mapTxLockReqRejected;
-extern map<uint256, CConsensusVote> mapTxLockVote;
-extern map<uint256, CTransactionLock> mapTxLocks;
-extern std::map<COutPoint, uint256> mapLockedInputs;
+extern CTxLockStore txLockStore;
 extern int nCompleteTXLocks;
 
 
@@ -45,10 +42,8 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight);
 //process consensus vote message
 bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx);
 
-// keep transaction locks in memory for an hour
-void CleanTransactionLocksList();
-
-int64_t GetAverageVoteTime();
+// keep transaction locks in memory for an hour, returns the earliest expiration left (0 if none)
+int64_t CleanTransactionLocksList();
 
 class CConsensusVote
 {
@@ -80,10 +75,21 @@ public:
     std::vector<CConsensusVote> vecConsensusVotes;
     int nExpiration;
     int nTimeout;
+    int64_t nTimeCreated; // in UTC milliseconds
+    bool fComplete;
+
+    CTransactionLock()
+    {
+        nBlockHeight = 0;
+        nExpiration = 0;
+        nTimeout = 0;
+        nTimeCreated = 0;
+        fComplete = false;
+    }
 
     bool SignaturesValid();
-    int CountSignatures();
-    void AddSignature(CConsensusVote& cv);
+    int CountSignatures() const;
+    void AddSignature(const CConsensusVote& cv);
 
     uint256 GetHash()
     {
@@ -91,5 +97,100 @@ public:
     }
 };
 
+//
+// Owns all InstantX state: lock requests, votes, locks and the inputs they lock.
+//
+// Locks are queued by expiration time, so Clean() only touches the locks that expired and takes
+// their requests, votes and locked inputs with them. Vote timing statistics are kept as running
+// totals instead of being recomputed from the maps.
+//
+class CTxLockStore
+{
+private:
+    mutable CCriticalSection cs;
+
+    // accepted and rejected lock requests
+    std::map<uint256, CTransaction> mapLockRequests;
+    std::map<uint256, CTransaction> mapLockRequestsRejected;
+    // vote hash -> vote
+    std::map<uint256, CConsensusVote> mapVotes;
+    // tx hash -> lock
+    std::map<uint256, CTransactionLock> mapLocks;
+    // locked input -> tx hash of the lock
+    std::map<COutPoint, uint256> mapLockedInputs;
+    // (expiration, tx hash) of every lock, earliest first
+    std::set<std::pair<int64_t, uint256> > setExpiration;
+
+    // masternode -> time its votes for unknown transactions are limited until (DoS protection)
+    std::map<uint256, int64_t> mapUnknownVotes;
+    int64_t nUnknownVotesTimeTotal;
+
+    // statistics, latencies in milliseconds after the lock was created
+    int nLocksComplete;
+    uint64_t nLocksCompleted;
+    uint64_t nLocksExpired;
+    uint64_t nVotesAdded;
+    int64_t nVoteLatencyTotal;
+    int64_t nVoteLatencyMax;
+    int64_t nLockLatencyTotal;
+    int64_t nLockLatencyMax;
+
+    void SetExpiration(CTransactionLock& lock, int64_t nExpiration);
+    void UnlockInputs(const CTransaction& tx);
+    void RemoveLock(std::map<uint256, CTransactionLock>::iterator it);
+    int64_t GetAverageVoteTime() const;
+
+public:
+    CTxLockStore();
+
+    bool HasRequest(const uint256& txHash) const;
+    bool HasRejectedRequest(const uint256& txHash) const;
+    bool GetRequest(const uint256& txHash, CTransaction& tx) const;
+    void AddRequest(const CTransaction& tx);
+    void AddRejectedRequest(const CTransaction& tx);
+
+    bool HasVote(const uint256& hash) const;
+    bool GetVote(const uint256& hash, CConsensusVote& vote) const;
+    void AddVote(const CConsensusVote& vote);
+
+    // Create the lock for a transaction, returns false and only updates the height (if given) when it exists
+    bool NewLock(const uint256& txHash, int nBlockHeight);
+    // Add a vote to the lock of its transaction and return its signature count, returns false without a lock
+    bool AddLockVote(const CConsensusVote& vote, int& nSignatures);
+    // Signature count of the lock, -1 without a lock
+    int CountLockSignatures(const uint256& txHash) const;
+    bool IsLockTimedOut(const uint256& txHash) const;
+    // Let the lock expire on the next clean up
+    void ExpireLock(const uint256& txHash);
+
+    // Lock the inputs of tx that are not locked yet
+    void LockInputs(const CTransaction& tx);
+    // Find the lock of an input, returns false if it isn't locked
+    bool GetLockedInput(const COutPoint& outpoint, uint256& txHash) const;
+    // Does tx spend an input locked by another transaction
+    bool ConflictsWithLock(const CTransaction& tx) const;
+
+    // Rate limit votes for transactions we don't know, returns false if the masternode is spamming
+    bool CheckUnknownVote(const uint256& hashMasternode);
+
+    // Remove expired locks, returns the earliest expiration left (0 if none)
+    int64_t Clean();
+
+    int CountRequests() const;
+    int CountVotes() const;
+    int CountLocks() const;
+    int CountLockedInputs() const;
+    int CountCompleteLocks() const;
+    uint64_t GetLocksCompleted() const;
+    uint64_t GetLocksExpired() const;
+    uint64_t GetVotesAdded() const;
+    int64_t GetAverageVoteLatency() const;
+    int64_t GetMaxVoteLatency() const;
+    int64_t GetAverageLockLatency() const;
+    int64_t GetMaxLockLatency() const;
+
+    std::string ToString() const;
+};
+
 
 #endif
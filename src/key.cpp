@@ -135,8 +135,9 @@ bool CKey::Check(const unsigned char *vch) {
     return secp256k1_ec_seckey_verify(secp256k1_context_sign, vch);
 }
 
-void CKey::MakeNewKey(bool fCompressedIn) {
-    RandAddSeedPerfmon();
+void CKey::MakeNewKey(bool fCompressedIn, bool fReseed) {
+    if (fReseed)
+        RandAddSeedPerfmon();
     do {
         GetRandBytes(vch, sizeof(vch));
     } while (!Check(vch));
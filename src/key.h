@@ -98,7 +98,8 @@ public:
     bool SetPrivKey(const CPrivKey &vchPrivKey, bool fCompressed);
 
     // Generate a new private key using a cryptographic PRNG.
-    void MakeNewKey(bool fCompressed);
+    // Callers generating many keys at once can seed the PRNG themselves and pass fReseed=false.
+    void MakeNewKey(bool fCompressed, bool fReseed = true);
 
     // Convert the private key to a CPrivKey (serialized OpenSSL private key data).
     // This is expensive.
@@ -22,6 +22,7 @@
 #include "darksend.h"
 #include "masternodeman.h"
 #include "masternode-payments.h"
+#include "msgverify.h"
 #include "spork.h"
 #include "smessage.h"
 #include "util.h"
@@ -47,7 +48,12 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
+// Block index entries are never freed. They are carved out of large chunks
+// so they sit close together in memory and cost no per-entry heap overhead.
+static const unsigned int BLOCK_INDEX_ARENA_CHUNK = 4096;
+static std::vector<CBlockIndex*> vBlockIndexArena;
+static unsigned int nBlockIndexArenaUsed = BLOCK_INDEX_ARENA_CHUNK;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
 CBlockIndex* pindexGenesisBlock = NULL;
@@ -550,12 +556,16 @@ bool IsStandardTx(const CTransaction& tx, string& reason)
 
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight, int64_t nBlockTime)
 {
-    AssertLockHeld(cs_main);
+    if (nBlockHeight == 0 && !CChainDepthSnapshot::GetCurrent())
+        AssertLockHeld(cs_main);
     // Time based nLockTime implemented in 0.1.6
     if (tx.nLockTime == 0)
         return true;
     if (nBlockHeight == 0)
-        nBlockHeight = nBestHeight;
+    {
+        const CChainDepthSnapshot* psnapshot = CChainDepthSnapshot::GetCurrent();
+        nBlockHeight = psnapshot ? psnapshot->GetHeight() : nBestHeight;
+    }
     if (nBlockTime == 0)
         nBlockTime = GetAdjustedTime();
     if ((int64_t)tx.nLockTime < ((int64_t)tx.nLockTime < LOCKTIME_THRESHOLD ? (int64_t)nBlockHeight : nBlockTime))
@@ -704,7 +714,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -850,12 +860,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
 
     // ----------- instantX transaction scanning -----------
 
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return tx.DoS(0, error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason));
-            }
-        }
+    if(txLockStore.ConflictsWithLock(tx)){
+        return tx.DoS(0, error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason));
     }
 
     // Check for conflicts with in-memory transactions
@@ -1023,12 +1029,8 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
 
     // ----------- instantX transaction scanning -----------
 
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return tx.DoS(0, error("AcceptableInputs : conflicts with existing transaction lock: %s", reason));
-            }
-        }
+    if(txLockStore.ConflictsWithLock(tx)){
+        return tx.DoS(0, error("AcceptableInputs : conflicts with existing transaction lock: %s", reason));
     }
 
     // Check for conflicts with in-memory transactions
@@ -1139,17 +1141,81 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
 }
 
 
+static void NoCleanup(CChainDepthSnapshot*)
+{
+}
+
+// snapshots are owned by the scope that created them
+static boost::thread_specific_ptr<CChainDepthSnapshot> pCurrentSnapshot(NoCleanup);
+
+CChainDepthSnapshot::CChainDepthSnapshot(const std::set<uint256>& setBlocks)
+{
+    {
+        LOCK(cs_main);
+        nHeight = nBestHeight;
+        BOOST_FOREACH(const uint256& hash, setBlocks)
+        {
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndex* pindex = (mi != mapBlockIndex.end() && (*mi).second->IsInMainChain()) ? (*mi).second : NULL;
+            mapBlocks.insert(make_pair(hash, pindex));
+        }
+    }
+    pprev = pCurrentSnapshot.get();
+    pCurrentSnapshot.reset(this);
+}
+
+CChainDepthSnapshot::~CChainDepthSnapshot()
+{
+    pCurrentSnapshot.reset(pprev);
+}
+
+bool CChainDepthSnapshot::Lookup(const uint256& hash, CBlockIndex*& pindex) const
+{
+    std::map<uint256, CBlockIndex*>::const_iterator mi = mapBlocks.find(hash);
+    if (mi == mapBlocks.end())
+        return false;
+    pindex = (*mi).second;
+    return true;
+}
+
+const CChainDepthSnapshot* CChainDepthSnapshot::GetCurrent()
+{
+    return pCurrentSnapshot.get();
+}
+
 int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
 {
     if (hashBlock == 0 || nIndex == -1)
         return 0;
+
+    const CChainDepthSnapshot* psnapshot = CChainDepthSnapshot::GetCurrent();
+    if (psnapshot)
+    {
+        // shared readers leave the caches alone
+        CBlockIndex* pindex = NULL;
+        if (!psnapshot->Lookup(hashBlock, pindex) || !pindex)
+            return 0;
+        if (!(fMerkleVerified && hashBlockCached == hashBlock) &&
+            CBlock::CheckMerkleBranch(GetHash(), vMerkleBranch, nIndex) != pindex->hashMerkleRoot)
+            return 0;
+        pindexRet = pindex;
+        return psnapshot->GetHeight() - pindex->nHeight + 1;
+    }
+
     AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi == mapBlockIndex.end())
-        return 0;
-    CBlockIndex* pindex = (*mi).second;
+    if (hashBlock != hashBlockCached || !pindexCached)
+    {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end())
+            return 0;
+        if (hashBlock != hashBlockCached)
+            fMerkleVerified = false;
+        pindexCached = (*mi).second;
+        hashBlockCached = hashBlock;
+    }
+    CBlockIndex* pindex = pindexCached;
     if (!pindex || !pindex->IsInMainChain())
         return 0;
 
@@ -1162,7 +1228,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
     }
 
     pindexRet = pindex;
-    return pindexBest->nHeight - pindex->nHeight + 1;
+    return nBestHeight - pindex->nHeight + 1;
 }
 
 int CMerkleTx::GetTransactionLockSignatures() const
@@ -1171,12 +1237,7 @@ int CMerkleTx::GetTransactionLockSignatures() const
     if(!fEnableInstantX) return -1;
 
     //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
-    if (i != mapTxLocks.end()){
-        return (*i).second.CountSignatures();
-    }
-
-    return -1;
+    return txLockStore.CountLockSignatures(GetHash());
 }
 
 bool CMerkleTx::IsTransactionLockTimedOut() const
@@ -1184,19 +1245,18 @@ bool CMerkleTx::IsTransactionLockTimedOut() const
     if(!fEnableInstantX) return -1;
 
     //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
-    if (i != mapTxLocks.end()){
-        return GetTime() > (*i).second.nTimeout;
-    }
-
-    return false;
+    return txLockStore.IsLockTimedOut(GetHash());
 }
 
 int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet, bool enableIX) const
 {
-    AssertLockHeld(cs_main);
+    const CChainDepthSnapshot* psnapshot = CChainDepthSnapshot::GetCurrent();
+    if (!psnapshot)
+        AssertLockHeld(cs_main);
     int nResult = GetDepthInMainChainINTERNAL(pindexRet);
-    if (nResult == 0 && !mempool.exists(GetHash()))
+    CBlockIndex* pindexSnapshot;
+    if (nResult == 0 && !mempool.exists(GetHash()) &&
+        !(psnapshot && hashBlock != 0 && !psnapshot->Lookup(hashBlock, pindexSnapshot)))
         return -1; // Not in chain, not in mempool
 
     if(enableIX){
@@ -1278,10 +1338,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
     if(nResult < 0) nResult = 0;
 
     if (nResult < 6){
-        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-        if (i != mapTxLocks.end()){
-            sigs = (*i).second.CountSignatures();
-        }
+        sigs = txLockStore.CountLockSignatures(nTXHash);
         if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
             return nInstantXDepth+nResult;
         }
@@ -1292,12 +1349,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
 
 int GetIXConfirmations(uint256 nTXHash)
 {
-    int sigs = 0;
-
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-    if (i != mapTxLocks.end()){
-        sigs = (*i).second.CountSignatures();
-    }
+    int sigs = txLockStore.CountLockSignatures(nTXHash);
     if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
         return nInstantXDepth;
     }
@@ -1312,7 +1364,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1324,23 +1376,22 @@ int CTxIndex::GetDepthInMainChain() const
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 {
+    // the mempool has its own lock, and the tx index and block files are only read, so no cs_main
+    if (mempool.lookup(hash, tx))
+        return true;
+
+    CTxDB txdb("r");
+    CTxIndex txindex;
+    if (tx.ReadFromDisk(txdb, hash, txindex))
+    {
+        CBlock block;
+        if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            hashBlock = block.GetHash();
+        return true;
+    }
+
     {
         LOCK(cs_main);
-        {
-            if (mempool.lookup(hash, tx))
-            {
-                return true;
-            }
-        }
-        CTxDB txdb("r");
-        CTxIndex txindex;
-        if (tx.ReadFromDisk(txdb, hash, txindex))
-        {
-            CBlock block;
-            if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-                hashBlock = block.GetHash();
-            return true;
-        }
         // look for transaction in disconnected blocks to find orphaned CoinBase and CoinStake transactions
         BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
         {
@@ -1369,6 +1420,52 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 //
 
 static CBlockIndex* pblockindexFBBHLast;
+size_t BlockHasher::operator()(const uint256& hash) const
+{
+    static const uint64_t nSalt = GetRand(std::numeric_limits<uint64_t>::max());
+    // murmur3 finalizer over the salted low word of the hash
+    uint64_t n = hash.Get64(0) ^ nSalt;
+    n ^= n >> 33;
+    n *= 0xff51afd7ed558ccdULL;
+    n ^= n >> 33;
+    return (size_t)n;
+}
+
+CBlockIndex* AllocBlockIndex()
+{
+    if (nBlockIndexArenaUsed == BLOCK_INDEX_ARENA_CHUNK)
+    {
+        vBlockIndexArena.push_back(new CBlockIndex[BLOCK_INDEX_ARENA_CHUNK]);
+        nBlockIndexArenaUsed = 0;
+    }
+    return &vBlockIndexArena.back()[nBlockIndexArenaUsed++];
+}
+
+unsigned int GetBlockIndexArenaSize()
+{
+    if (vBlockIndexArena.empty())
+        return 0;
+    return (vBlockIndexArena.size() - 1) * BLOCK_INDEX_ARENA_CHUNK + nBlockIndexArenaUsed;
+}
+
+static CCriticalSection cs_chainTip;
+static CChainTip chainTip;
+
+CChainTip GetChainTip()
+{
+    LOCK(cs_chainTip);
+    return chainTip;
+}
+
+void UpdateChainTip()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_chainTip);
+    chainTip.pindex = pindexBest;
+    chainTip.nHeight = nBestHeight;
+    chainTip.hash = hashBestChain;
+}
+
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
     CBlockIndex *pblockindex;
@@ -2002,6 +2099,14 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
 
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    // only when the address index has got this far, and before the tx index entries of the spent outputs are erased
+    uint256 hashAddrIndexBest;
+    if (fAddrIndex && txdb.ReadAddrIndexBest(hashAddrIndexBest) && hashAddrIndexBest == pindex->GetBlockHash())
+    {
+        if (!UpdateAddressIndex(txdb, pindex->nHeight, false) || !txdb.WriteAddrIndexBest(pindex->pprev ? pindex->pprev->GetBlockHash() : 0))
+            return error("DisconnectBlock() : UpdateAddressIndex failed");
+    }
+
     // Disconnect in reverse order
     for (int i = vtx.size()-1; i >= 0; i--)
         if (!vtx[i].DisconnectInputs(txdb))
@@ -2058,8 +2163,9 @@ bool static BuildAddrIndex(const CScript &script, std::vector<uint160>& addrIds)
     }
 }
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash) {
-    uint160 addrid = 0;
+static bool GetAddrIndexId(const CTxDestination &dest, uint160& addrid)
+{
+    addrid = 0;
     const CKeyID *pkeyid = boost::get<CKeyID>(&dest);
     if (pkeyid)
         addrid = static_cast<uint160>(*pkeyid);
@@ -2068,15 +2174,19 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
         if (pscriptid)
             addrid = static_cast<uint160>(*pscriptid);
     }
-    if (!addrid)
+    return addrid != 0;
+}
+
+bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash, int nSkip, int nCount, int nHeightStart, int nHeightEnd) {
+    uint160 addrid;
+    if (!GetAddrIndexId(dest, addrid))
     {
         LogPrintf("FindTransactionsByDestination(): Couldn't parse dest into addrid\n");
         return false;
     }
 
-    LOCK(cs_main);
     CTxDB txdb("r");
-    if(!txdb.ReadAddrIndex(addrid, vtxhash))
+    if(!txdb.ReadAddrIndex(addrid, vtxhash, nSkip, nCount, nHeightStart, nHeightEnd))
     {
         LogPrintf("FindTransactionsByDestination(): txdb.ReadAddrIndex failed\n");
         return false;
@@ -2084,50 +2194,120 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
     return true;
 }
 
-void CBlock::RebuildAddressIndex(CTxDB& txdb)
+bool GetAddressBalance(const CTxDestination &dest, int64_t& nBalance, int64_t& nReceived)
+{
+    uint160 addrid;
+    if (!GetAddrIndexId(dest, addrid))
+        return false;
+
+    CTxDB txdb("r");
+    return txdb.ReadAddrBalance(addrid, nBalance, nReceived);
+}
+
+// Append the address index entries for the addresses in script, and with pvSpent the key keySpent of the
+// entries of the output being spent, for each of the same addresses
+static void GetAddrIndexEntries(const CScript& script, CAddrIndexKey key, int64_t nValue, AddrIndexEntries& vEntries,
+    std::vector<CAddrIndexKey>* pvSpent = NULL, CAddrIndexKey keySpent = CAddrIndexKey())
+{
+    if (script.empty())
+        return;
+
+    std::vector<uint160> addrIds;
+    if (!BuildAddrIndex(script, addrIds))
+        return;
+
+    BOOST_FOREACH(const uint160& addrId, addrIds)
+    {
+        key.addrid = addrId;
+        vEntries.push_back(make_pair(key, nValue));
+        if (pvSpent)
+        {
+            keySpent.addrid = addrId;
+            pvSpent->push_back(keySpent);
+        }
+    }
+}
+
+// Height of the block holding the transaction at pos, -1 if unknown. Heights are looked up once per block
+static int GetTxPosHeight(const CDiskTxPos& pos, std::map<std::pair<unsigned int, unsigned int>, int>& mapHeights)
+{
+    std::pair<unsigned int, unsigned int> blockPos(pos.nFile, pos.nBlockPos);
+    std::map<std::pair<unsigned int, unsigned int>, int>::iterator it = mapHeights.find(blockPos);
+    if (it != mapHeights.end())
+        return it->second;
+
+    int nHeight = -1;
+    CBlock block;
+    if (block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+        if (mi != mapBlockIndex.end())
+            nHeight = mi->second->nHeight;
+    }
+    mapHeights[blockPos] = nHeight;
+    return nHeight;
+}
+
+bool CBlock::GetAddressIndexEntries(CTxDB& txdb, int nHeight, AddrIndexEntries& vEntries, std::vector<CAddrIndexKey>& vSpent)
 {
+    std::map<std::pair<unsigned int, unsigned int>, int> mapHeights;
     BOOST_FOREACH(CTransaction& tx, vtx)
     {
         uint256 hashTx = tx.GetHash();
-        // inputs
+        // inputs debit the addresses of the outputs they spend, and flag the entries of those outputs
         if(!tx.IsCoinBase())
         {
             MapPrevTx mapInputs;
             map<uint256, CTxIndex> mapQueuedChangesT;
             bool fInvalid;
             if (!tx.FetchInputs(txdb, mapQueuedChangesT, true, false, mapInputs, fInvalid))
-                return;
+                return false;
 
-            MapPrevTx::const_iterator mi;
-            for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
             {
-                BOOST_FOREACH(const CTxOut &atxout, (*mi).second.second.vout)
-                {
-                    std::vector<uint160> addrIds;
-                    if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-                    {
-                        BOOST_FOREACH(uint160 addrId, addrIds)
-                        {
-                            if(!txdb.WriteAddrIndex(addrId, hashTx))
-                                LogPrintf("RebuildAddressIndex(): txins WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                        }
-                    }
-                }
-            }
-        }
-        // outputs
-        BOOST_FOREACH(const CTxOut &atxout, tx.vout) {
-            std::vector<uint160> addrIds;
-            if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-            {
-                BOOST_FOREACH(uint160 addrId, addrIds)
-                {
-                    if(!txdb.WriteAddrIndex(addrId, hashTx))
-                        LogPrintf("RebuildAddressIndex(): txouts WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                }
+                const COutPoint& prevout = tx.vin[i].prevout;
+                const CTxOut& txoutPrev = tx.GetOutputFor(tx.vin[i], mapInputs);
+                int nHeightPrev = GetTxPosHeight(mapInputs.find(prevout.hash)->second.first.pos, mapHeights);
+                if (nHeightPrev < 0)
+                    LogPrintf("GetAddressIndexEntries() : no block for spent output %s\n", prevout.ToString());
+                GetAddrIndexEntries(txoutPrev.scriptPubKey, CAddrIndexKey(0, nHeight, hashTx, true, i), -txoutPrev.nValue, vEntries,
+                    nHeightPrev < 0 ? NULL : &vSpent, CAddrIndexKey(0, nHeightPrev, prevout.hash, false, prevout.n));
             }
         }
+        // outputs credit theirs
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            GetAddrIndexEntries(tx.vout[i].scriptPubKey, CAddrIndexKey(0, nHeight, hashTx, false, i), tx.vout[i].nValue, vEntries);
     }
+
+    return true;
+}
+
+bool CBlock::UpdateAddressIndex(CTxDB& txdb, int nHeight, bool fConnect)
+{
+    AddrIndexEntries vEntries;
+    std::vector<CAddrIndexKey> vSpent;
+    if (!GetAddressIndexEntries(txdb, nHeight, vEntries, vSpent))
+        return false;
+
+    // an output spent in the same block is written before it is flagged, and cleared before it is erased
+    if (!fConnect && !txdb.UpdateAddrIndexSpent(vSpent, false))
+        return error("UpdateAddressIndex() : UpdateAddrIndexSpent failed");
+
+    for (AddrIndexEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+    {
+        if (!(fConnect ? txdb.WriteAddrIndex(it->first, CAddrIndexValue(it->second)) : txdb.EraseAddrIndex(it->first)))
+            return error("UpdateAddressIndex() : %s failed addrId: %s txhash: %s", fConnect ? "WriteAddrIndex" : "EraseAddrIndex",
+                it->first.addrid.ToString(), it->first.txid.ToString());
+    }
+
+    if (fConnect && !txdb.UpdateAddrIndexSpent(vSpent, true))
+        return error("UpdateAddressIndex() : UpdateAddrIndexSpent failed");
+
+    if (!txdb.UpdateAddrBalances(vEntries, fConnect))
+        return error("UpdateAddressIndex() : UpdateAddrBalances failed");
+
+    return true;
 }
 
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
@@ -2136,6 +2316,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     if (!CheckBlock(!fJustCheck, !fJustCheck, false))
         return false;
 
+    int64_t nTimeStart = GetTimeMicros();
     unsigned int flags = SCRIPT_VERIFY_NOCACHE;
 
     //// issue here: it doesn't know the version
@@ -2205,6 +2386,10 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
 
+    int64_t nTimeConnect = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "    - Connect %u transactions (%d inputs): %.2fms (%.3fms/tx, %.3fms/txin)\n",
+        (unsigned)vtx.size(), nInputs, 0.001 * nTimeConnect, 0.001 * nTimeConnect / vtx.size(), nInputs == 0 ? 0 : 0.001 * nTimeConnect / nInputs);
+
     if (IsProofOfWork())
     {
         int64_t nReward = GetProofOfWorkReward(pindex->nHeight, nFees);
@@ -2243,53 +2428,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
-    if(GetBoolArg("-addrindex", false))
+    // the address index follows the chain once the background builder has caught up with it
+    uint256 hashAddrIndexBest;
+    if (fAddrIndex && pindex->pprev && txdb.ReadAddrIndexBest(hashAddrIndexBest) && hashAddrIndexBest == pindex->pprev->GetBlockHash())
     {
-        // Write Address Index
-        BOOST_FOREACH(CTransaction& tx, vtx)
-        {
-            uint256 hashTx = tx.GetHash();
-            // inputs
-            if(!tx.IsCoinBase())
-            {
-                MapPrevTx mapInputs;
-                map<uint256, CTxIndex> mapQueuedChangesT;
-                bool fInvalid;
-                if (!tx.FetchInputs(txdb, mapQueuedChangesT, true, false, mapInputs, fInvalid))
-                    return false;
-
-                MapPrevTx::const_iterator mi;
-                for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
-                {
-                    BOOST_FOREACH(const CTxOut &atxout, (*mi).second.second.vout)
-                    {
-                        std::vector<uint160> addrIds;
-                        if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-                        {
-                            BOOST_FOREACH(uint160 addrId, addrIds)
-                            {
-                                if(!txdb.WriteAddrIndex(addrId, hashTx))
-                                    LogPrintf("ConnectBlock(): txins WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                            }
-                        }
-                    }
-                }
-            }
-
-            // outputs
-            BOOST_FOREACH(const CTxOut &atxout, tx.vout)
-            {
-                std::vector<uint160> addrIds;
-                if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-                {
-                    BOOST_FOREACH(uint160 addrId, addrIds)
-                    {
-                        if(!txdb.WriteAddrIndex(addrId, hashTx))
-                            LogPrintf("ConnectBlock(): txouts WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                    }
-                }
-            }
-        }
+        if (!UpdateAddressIndex(txdb, pindex->nHeight) || !txdb.WriteAddrIndexBest(pindex->GetBlockHash()))
+            return error("ConnectBlock() : UpdateAddressIndex failed");
     }
 
     // Update block index on disk without changing it in memory.
@@ -2302,13 +2446,14 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : WriteBlockIndex failed");
     }
 
+    int64_t nTimeIndex = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "    - Connect block %d: %.2fms, %u pending txdb writes\n",
+        pindex->nHeight, 0.001 * nTimeIndex, txdb.GetPendingWriteCount());
+
     // Watch for transactions paying to me
     BOOST_FOREACH(CTransaction& tx, vtx)
         SyncWithWallets(tx, this);
 
-
-
-
     return true;
 }
 
@@ -2517,6 +2662,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexNew->nChainTrust;
+    UpdateChainTip();
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
@@ -2626,7 +2772,8 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
         return error("AddToBlockIndex() : %s already exists", hash.ToString());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
+    CBlockIndex* pindexNew = AllocBlockIndex();
+    *pindexNew = CBlockIndex(nFile, nBlockPos, *this);
      {
           LOCK(cs_nBlockSequenceId);
           pindexNew->nSequenceId = nBlockSequenceId++;
@@ -2634,7 +2781,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
     pindexNew->phashBlock = &hash;
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -2660,7 +2807,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     pindexNew->bnStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, IsProofOfWork() ? hash : vtx[1].vin[0].prevout.hash);
 
     // Add to mapBlockIndex
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     if (pindexNew->IsProofOfStake())
         setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     pindexNew->phashBlock = &((*mi).first);
@@ -2744,9 +2891,10 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
             if (!tx.IsCoinBase()){
                 //only reject blocks when it's based on complete consensus
                 BOOST_FOREACH(const CTxIn& in, tx.vin){
-                    if(mapLockedInputs.count(in.prevout)){
-                        if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                            if(fDebug) { LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", mapLockedInputs[in.prevout].ToString().c_str(), tx.GetHash().ToString().c_str()); }
+                    uint256 txHashLocked;
+                    if(txLockStore.GetLockedInput(in.prevout, txHashLocked)){
+                        if(txHashLocked != tx.GetHash()){
+                            if(fDebug) { LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", txHashLocked.ToString().c_str(), tx.GetHash().ToString().c_str()); }
                             return DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"));
                         }
                     }
@@ -2886,7 +3034,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return DoS(10, error("AcceptBlock() : prev block not found"));
     CBlockIndex* pindexPrev = (*mi).second;
@@ -3172,6 +3320,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
             darkSendPool.CheckTimeout();
             darkSendPool.NewBlock();
             masternodePayments.ProcessBlock(GetHeight()+10);
+            darkSendScheduler.Trigger("masternode-payments");
 
         } else if (fLiteMode && !fImporting && !fReindex && pindexBest->nHeight > Checkpoints::GetTotalBlocksEstimate())
         {
@@ -3376,7 +3525,7 @@ void PrintBlockTree()
     AssertLockHeld(cs_main);
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3449,6 +3598,7 @@ bool LoadExternalBlockFile(FILE* fileIn)
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
+    int64_t nBytes = 0;
     {
         try {
             CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
@@ -3492,6 +3642,7 @@ bool LoadExternalBlockFile(FILE* fileIn)
                     if (ProcessBlock(NULL,&block))
                     {
                         nLoaded++;
+                        nBytes += nSize;
                         nPos += 4 + nSize;
                     }
                 }
@@ -3502,7 +3653,9 @@ bool LoadExternalBlockFile(FILE* fileIn)
                    __PRETTY_FUNCTION__);
         }
     }
-    LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    int64_t nTime = std::max(GetTimeMillis() - nStart, (int64_t)1);
+    LogPrintf("Loaded %i blocks from external file in %dms, %.1f blocks/s, %.2f MB/s\n",
+        nLoaded, nTime, 1000.0 * nLoaded / nTime, 1000.0 * nBytes / 1048576 / nTime);
     return nLoaded > 0;
 }
 
@@ -3519,12 +3672,22 @@ struct CImportingNow
     }
 };
 
-void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
+// Commit the block files from nFileStart on, after writing them without
+static bool CommitBlockFiles(unsigned int nFileStart)
 {
-    RenameThread("Arion-loadblk");
-
-    CImportingNow imp;
+    for (unsigned int nFile = std::max(nFileStart, 1u); nFile <= nCurrentBlockFile; nFile++)
+    {
+        FILE* file = OpenBlockFile(nFile, 0, "ab");
+        if (!file)
+            return error("CommitBlockFiles() : open of blk%04u.dat failed", nFile);
+        FileCommit(file);
+        fclose(file);
+    }
+    return true;
+}
 
+static void ImportBlockFiles(std::vector<boost::filesystem::path> vImportFiles)
+{
     // -loadblock=
     BOOST_FOREACH(boost::filesystem::path &path, vImportFiles) {
         FILE *file = fopen(path.string().c_str(), "rb");
@@ -3544,6 +3707,63 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 }
 
+// Make the import durable, then compact what it wrote unless shutting down
+static void FinishImport(unsigned int nFileStart, int nHeightStart, bool fCompact)
+{
+    {
+        LOCK(cs_main);
+        CTxDB txdb;
+        if (!CommitBlockFiles(nFileStart) || !txdb.EndBulkLoad())
+        {
+            LogPrintf("ThreadImport() : ending the bulk load failed, the next start verifies the imported blocks\n");
+            return;
+        }
+        if (!fCompact || nBestHeight == nHeightStart)
+            return;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    CTxDB txdb("r");
+    txdb.CompactType("blockindex");
+    txdb.CompactType("tx");
+    if (fAddrIndex)
+        txdb.CompactType("adx");
+    LogPrintf("Compacted the imported blocks in %dms\n", GetTimeMillis() - nStart);
+}
+
+void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
+{
+    RenameThread("Arion-loadblk");
+
+    if (vImportFiles.empty() && !filesystem::exists(GetDataDir() / "bootstrap.dat"))
+        return;
+
+    CImportingNow imp;
+
+    unsigned int nFileStart;
+    int nHeightStart;
+    {
+        LOCK(cs_main);
+        nFileStart = nCurrentBlockFile;
+        nHeightStart = nBestHeight;
+        CTxDB txdb;
+        if (!txdb.BeginBulkLoad(nHeightStart, nFileStart))
+            LogPrintf("ThreadImport() : BeginBulkLoad failed\n");
+    }
+
+    int64_t nStart = GetTimeMillis();
+    try {
+        ImportBlockFiles(vImportFiles);
+    }
+    catch (boost::thread_interrupted&) {
+        FinishImport(nFileStart, nHeightStart, false);
+        throw;
+    }
+    FinishImport(nFileStart, nHeightStart, true);
+
+    LogPrintf("Import done, %d blocks in %ds\n", nBestHeight - nHeightStart, (GetTimeMillis() - nStart) / 1000);
+}
+
 
 
 
@@ -3636,12 +3856,12 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
         return mapBlockIndex.count(inv.hash) ||
                mapOrphanBlocks.count(inv.hash);
     case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
+        return txLockStore.HasRequest(inv.hash) ||
+               txLockStore.HasRejectedRequest(inv.hash);
     case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
+        return txLockStore.HasVote(inv.hash);
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+        return HaveSpork(inv.hash);
     case MSG_MASTERNODE_WINNER:
         return mapSeenMasternodeVotes.count(inv.hash);
     }
@@ -3671,7 +3891,7 @@ void static ProcessGetData(CNode* pfrom)
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -3717,28 +3937,31 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    if(mapTxLockVote.count(inv.hash)){
+                    CConsensusVote vote;
+                    if(txLockStore.GetVote(inv.hash, vote)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockVote[inv.hash];
+                        ss << vote;
                         pfrom->PushMessage("txlvote", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    if(mapTxLockReq.count(inv.hash)){
+                    CTransaction tx;
+                    if(txLockStore.GetRequest(inv.hash, tx)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
+                        ss << tx;
                         pfrom->PushMessage("txlreq", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
-                    if(mapSporks.count(inv.hash)){
+                    CSporkMessage spork;
+                    if(GetSpork(inv.hash, spork)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
+                        ss << spork;
                         pfrom->PushMessage("spork", ss);
                         pushed = true;
                     }
@@ -4105,7 +4328,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -4514,6 +4737,9 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    // finish messages whose signatures were checked off-thread
+    messageVerifier.ProcessCompleted();
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
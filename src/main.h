@@ -16,6 +16,8 @@
 
 #include <list>
 
+#include <boost/unordered_map.hpp>
+
 #define START_MASTERNODE_PAYMENTS_TESTNET 1495238400 // Sat, 20 May 2017 00:00:00 GMT
 #define START_MASTERNODE_PAYMENTS 1495238400         // Sat, 20 May 2017 00:00:00 GMT
 
@@ -123,7 +125,16 @@ static const unsigned int nModifierInterval = 2 * 60; // 120 seconds
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+
+/** Salted hash of a block hash for mapBlockIndex buckets. Proof-of-stake
+ *  block hashes are cheap to grind, so bucket placement must not be
+ *  predictable from the hash alone. */
+struct BlockHasher
+{
+    size_t operator()(const uint256& hash) const;
+};
+typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+extern BlockMap mapBlockIndex;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 extern CBlockIndex* pindexGenesisBlock;
 extern unsigned int nNodeLifespan;
@@ -145,6 +156,7 @@ extern bool fHaveGUI;
 
 // Settings
 extern bool fUseFastIndex;
+extern bool fAddrIndex;
 extern unsigned int nDerivationMethodIndex;
 
 extern bool fLargeWorkForkFound;
@@ -182,8 +194,26 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
 bool LoadBlockIndex(bool fAllowNew=true);
+/** Allocate a block index entry from the block index arena (never freed) */
+CBlockIndex* AllocBlockIndex();
+/** Number of block index entries allocated from the arena */
+unsigned int GetBlockIndexArenaSize();
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** The best chain tip as of the last SetBestChain, readable without cs_main. Block index entries are never
+ * freed and their pprev links never change, so the chain below the tip can be walked without cs_main too */
+class CChainTip
+{
+public:
+    CBlockIndex* pindex;
+    int nHeight;
+    uint256 hash;
+
+    CChainTip() : pindex(NULL), nHeight(-1), hash(0) {}
+};
+CChainTip GetChainTip();
+/** Publish pindexBest as the chain tip, with cs_main held */
+void UpdateChainTip();
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
@@ -209,7 +239,10 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
                         bool* pfMissingInputs, bool fRejectInsaneFee=false, bool isDSTX=false);
 
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash);
+/** Distinct transactions touching dest in chain order, see CTxDB::ReadAddrIndex for the paging arguments */
+bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash, int nSkip = 0, int nCount = -1, int nHeightStart = 0, int nHeightEnd = -1);
+/** Balance and total received of dest, from the address index */
+bool GetAddressBalance(const CTxDestination &dest, int64_t& nBalance, int64_t& nReceived);
 
 int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
@@ -539,6 +572,30 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason);
 
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight = 0, int64_t nBlockTime = 0);
 
+/** Main chain position of a set of blocks, read under one short cs_main lock. While one is
+ *  alive, depth lookups and IsFinalTx on its thread use it instead of cs_main, so wallet
+ *  listings can hold cs_wallet shared without waiting for cs_main, whose holders may be
+ *  waiting for cs_wallet. Blocks outside the set read as not yet confirmed. */
+class CChainDepthSnapshot
+{
+private:
+    int nHeight;
+    std::map<uint256, CBlockIndex*> mapBlocks; // NULL if not in the main chain
+    CChainDepthSnapshot* pprev;                // snapshot it hides on this thread
+
+    CChainDepthSnapshot(const CChainDepthSnapshot&);
+    CChainDepthSnapshot& operator=(const CChainDepthSnapshot&);
+
+public:
+    CChainDepthSnapshot(const std::set<uint256>& setBlocks);
+    ~CChainDepthSnapshot();
+
+    int GetHeight() const { return nHeight; }
+    // false if hash is not in the snapshot's set
+    bool Lookup(const uint256& hash, CBlockIndex*& pindex) const;
+
+    static const CChainDepthSnapshot* GetCurrent();
+};
 
 
 /** A transaction with a merkle branch linking it to the block chain. */
@@ -553,6 +610,11 @@ public:
 
     // memory only
     mutable bool fMerkleVerified;
+    // block index entry of hashBlock, saves the mapBlockIndex lookup in
+    // GetDepthInMainChain. Index entries are never freed, and main chain
+    // membership is re-checked on every call, so reorgs need no invalidation.
+    mutable CBlockIndex* pindexCached;
+    mutable uint256 hashBlockCached;
 
 
     CMerkleTx()
@@ -570,6 +632,8 @@ public:
         hashBlock = 0;
         nIndex = -1;
         fMerkleVerified = false;
+        pindexCached = NULL;
+        hashBlockCached = 0;
     }
 
 
@@ -604,6 +668,126 @@ public:
  * locations of transactions that spend its outputs.  vSpent is really only
  * used as a flag, but having the location is very helpful for debugging.
  */
+/** Layout of the address index, a different stored version makes startup rebuild it */
+static const int ADDRINDEX_VERSION = 2;
+
+/** Key of one address index entry: an output paying to an address, or an input spending such an output.
+ *
+ * Entries are stored one per key, under ("adx", key), with a CAddrIndexValue holding the value credited
+ * by the output or debited (negative) by the input. The height is serialized big endian so that the
+ * entries of an address sort by height and a range of heights is one LevelDB scan.
+ */
+class CAddrIndexKey
+{
+public:
+    uint160 addrid;
+    int nHeight;
+    uint256 txid;
+    bool fSpending;
+    unsigned int nIndex;    // vin index when fSpending, otherwise vout index
+
+    CAddrIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddrIndexKey(uint160 addridIn, int nHeightIn, uint256 txidIn, bool fSpendingIn, unsigned int nIndexIn)
+    {
+        addrid = addridIn;
+        nHeight = nHeightIn;
+        txid = txidIn;
+        fSpending = fSpendingIn;
+        nIndex = nIndexIn;
+    }
+
+    void SetNull()
+    {
+        addrid = 0;
+        nHeight = 0;
+        txid = 0;
+        fSpending = false;
+        nIndex = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(addrid);
+        unsigned char pchHeight[4];
+        if (!fRead)
+        {
+            pchHeight[0] = (nHeight >> 24) & 0xff;
+            pchHeight[1] = (nHeight >> 16) & 0xff;
+            pchHeight[2] = (nHeight >> 8) & 0xff;
+            pchHeight[3] = nHeight & 0xff;
+        }
+        READWRITE(FLATDATA(pchHeight));
+        if (fRead)
+            const_cast<CAddrIndexKey*>(this)->nHeight = (pchHeight[0] << 24) | (pchHeight[1] << 16) | (pchHeight[2] << 8) | pchHeight[3];
+        READWRITE(txid);
+        READWRITE(fSpending);
+        READWRITE(nIndex);
+    )
+};
+
+/** Address index entries with their values, as written for a block */
+typedef std::vector<std::pair<CAddrIndexKey, int64_t> > AddrIndexEntries;
+
+/** Stored value of an address index entry; an output's entry is flagged once the best chain spends it */
+class CAddrIndexValue
+{
+public:
+    int64_t nValue;
+    bool fSpent;
+
+    CAddrIndexValue()
+    {
+        nValue = 0;
+        fSpent = false;
+    }
+
+    CAddrIndexValue(int64_t nValueIn, bool fSpentIn = false)
+    {
+        nValue = nValueIn;
+        fSpent = fSpentIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(fSpent);
+    )
+};
+
+/** Totals of the address index entries of one address, stored under ("adb", addrid) and kept up to date with them */
+class CAddrBalance
+{
+public:
+    int64_t nBalance;
+    int64_t nReceived;
+
+    CAddrBalance()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nBalance = 0;
+        nReceived = 0;
+    }
+
+    bool IsNull() const
+    {
+        return nBalance == 0 && nReceived == 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nBalance);
+        READWRITE(nReceived);
+    )
+};
+
 class CTxIndex
 {
 public:
@@ -863,9 +1047,9 @@ public:
         nBlockPosRet = fileOutPos;
         fileout << *this;
 
-        // Flush stdio buffers and commit to disk before returning
+        // Flush stdio buffers and commit to disk before returning, imports commit all files when they end
         fflush(fileout);
-        if (!IsInitialBlockDownload() || (nBestHeight+1) % 500 == 0)
+        if (!fImporting && (!IsInitialBlockDownload() || (nBestHeight+1) % 500 == 0))
             FileCommit(fileout);
 
         return true;
@@ -931,7 +1115,12 @@ public:
     bool AcceptBlock();
     bool SignBlock(CWallet& keystore, int64_t nFees);
     bool CheckBlockSignature() const;
-    void RebuildAddressIndex(CTxDB& txdb);
+    // Append the address index entries of this block at nHeight to vEntries, and the keys of the entries of the
+    // outputs its inputs spend to vSpent. Needs the tx index of the spent outputs
+    bool GetAddressIndexEntries(CTxDB& txdb, int nHeight, AddrIndexEntries& vEntries, std::vector<CAddrIndexKey>& vSpent);
+    // Add (or with fConnect false, remove) the address index entries of this block at nHeight, with the spent flags
+    // and address balances they change
+    bool UpdateAddressIndex(CTxDB& txdb, int nHeight, bool fConnect = true);
 
 private:
     bool SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew);
@@ -1320,7 +1509,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1371,7 +1560,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1390,7 +1579,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1406,7 +1595,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
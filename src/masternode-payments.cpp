@@ -9,6 +9,8 @@
 #include "sync.h"
 #include "spork.h"
 #include "addrman.h"
+#include "msgverify.h"
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 
 CCriticalSection cs_masternodepayments;
@@ -18,6 +20,64 @@ CMasternodePayments masternodePayments;
 // keep track of Masternode votes I've seen
 map<uint256, CMasternodePaymentWinner> mapSeenMasternodeVotes;
 
+CMasternodePaymentWinnerStore::CMasternodePaymentWinnerStore(unsigned int nCapacity) : vSlots(nCapacity)
+{
+    nFloor = 0;
+    nTip = 0;
+    nCount = 0;
+}
+
+CMasternodePaymentWinner* CMasternodePaymentWinnerStore::Get(int nBlockHeight)
+{
+    if(nBlockHeight <= 0 || nBlockHeight < nFloor) return NULL;
+
+    CMasternodePaymentWinner& slot = vSlots[nBlockHeight % vSlots.size()];
+    return slot.nBlockHeight == nBlockHeight ? &slot : NULL;
+}
+
+bool CMasternodePaymentWinnerStore::Set(const CMasternodePaymentWinner& winner)
+{
+    if(winner.nBlockHeight <= 0 || winner.nBlockHeight < nFloor) return false;
+
+    CMasternodePaymentWinner& slot = vSlots[winner.nBlockHeight % vSlots.size()];
+    if(slot.nBlockHeight > winner.nBlockHeight) return false;
+
+    if(slot.nBlockHeight == 0) nCount++;
+    slot = winner;
+    nTip = std::max(nTip, winner.nBlockHeight);
+
+    return true;
+}
+
+void CMasternodePaymentWinnerStore::EraseBelow(int nBlockHeight)
+{
+    if(nBlockHeight <= nFloor) return;
+
+    // only the slots of the heights between the old and the new floor can hold anything below it
+    int nStart = std::max(nFloor, nBlockHeight - (int)vSlots.size());
+    for(int nHeight = nStart; nHeight < nBlockHeight; nHeight++){
+        CMasternodePaymentWinner& slot = vSlots[nHeight % vSlots.size()];
+        if(slot.nBlockHeight != 0 && slot.nBlockHeight < nBlockHeight){
+            if(fDebug) LogPrintf("CMasternodePaymentWinnerStore::EraseBelow - Removing old Masternode payment - block %d\n", slot.nBlockHeight);
+            slot = CMasternodePaymentWinner();
+            nCount--;
+        }
+    }
+
+    nFloor = nBlockHeight;
+}
+
+void CMasternodePaymentWinnerStore::Resize(unsigned int nCapacity)
+{
+    std::vector<CMasternodePaymentWinner> vOld(nCapacity);
+    vSlots.swap(vOld);
+    nCount = 0;
+
+    BOOST_FOREACH(const CMasternodePaymentWinner& winner, vOld)
+        if(winner.nBlockHeight != 0 && winner.nBlockHeight > nTip - (int)nCapacity)
+            Set(winner);
+}
+
 int CMasternodePayments::GetMinMasternodePaymentsProto() {
     return IsSporkActive(SPORK_10_MASTERNODE_PAY_UPDATED_NODES)
             ? MIN_MASTERNODE_PAYMENT_PROTO_VERSION_2
@@ -36,9 +96,18 @@ void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDa
             return;
         }
 
+        // the winners the peer already has, older peers don't send any
+        std::vector<std::pair<int, uint256> > vHave;
+        if(!vRecv.empty()) vRecv >> vHave;
+        if(vHave.size() > MNPAYMENTS_SYNC_DEPTH + MNPAYMENTS_SYNC_AHEAD + 1) {
+            LogPrintf("mnget - peer sent too many winners (%d)\n", vHave.size());
+            Misbehaving(pfrom->GetId(), 20);
+            return;
+        }
+
         pfrom->FulfilledRequest("mnget");
-        masternodePayments.Sync(pfrom);
-        LogPrintf("mnget - Sent Masternode winners to %s\n", pfrom->addr.ToString().c_str());
+        int nSent = masternodePayments.Sync(pfrom, vHave);
+        LogPrintf("mnget - Sent %d Masternode winners to %s, peer had %d\n", nSent, pfrom->addr.ToString().c_str(), vHave.size());
     }
     else if (strCommand == "mnw") { //Masternode Payments Declare Winner
 
@@ -60,7 +129,7 @@ void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDa
             return;
         }
 
-        if(winner.nBlockHeight < pindexBest->nHeight - 10 || winner.nBlockHeight > pindexBest->nHeight+20){
+        if(winner.nBlockHeight < pindexBest->nHeight - MNPAYMENTS_SYNC_DEPTH || winner.nBlockHeight > pindexBest->nHeight + MNPAYMENTS_SYNC_AHEAD){
             LogPrintf("mnw - winner out of range %s Addr %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), address2.ToString().c_str(), winner.nBlockHeight, pindexBest->nHeight);
             return;
         }
@@ -73,17 +142,38 @@ void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDa
 
         LogPrintf("mnw - winning vote - Vin %s Addr %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), address2.ToString().c_str(), winner.nBlockHeight, pindexBest->nHeight);
 
-        if(!masternodePayments.CheckSignature(winner)){
-            LogPrintf("mnw - invalid signature\n");
-            Misbehaving(pfrom->GetId(), 100);
-            return;
-        }
+        // added and relayed from ProcessSignedWinner once the signature is checked
+        masternodePayments.CheckSignatureAsync(winner, pfrom->GetId());
+    }
+}
 
-        mapSeenMasternodeVotes.insert(make_pair(hash, winner));
+void CMasternodePayments::CheckSignatureAsync(const CMasternodePaymentWinner& winner, NodeId nodeFrom)
+{
+    std::string strMessage = winner.vin.ToString().c_str() + boost::lexical_cast<std::string>(winner.nBlockHeight) + winner.payee.ToString();
+    CPubKey pubkey(ParseHex(strMainPubKey));
 
-        if(masternodePayments.AddWinningMasternode(winner)){
-            masternodePayments.Relay(winner);
-        }
+    messageVerifier.VerifyAsync(pubkey, winner.vchSig, strMessage,
+        boost::bind(&CMasternodePayments::ProcessSignedWinner, this, winner, nodeFrom, _1), nodeFrom);
+}
+
+void CMasternodePayments::ProcessSignedWinner(CMasternodePaymentWinner winner, NodeId nodeFrom, bool fSigValid)
+{
+    LOCK(cs_masternodepayments);
+
+    if(!fSigValid){
+        LogPrintf("mnw - invalid signature\n");
+        Misbehaving(nodeFrom, 100);
+        return;
+    }
+
+    // the same vote may have been queued by several peers
+    uint256 hash = winner.GetHash();
+    if(mapSeenMasternodeVotes.count(hash)) return;
+
+    mapSeenMasternodeVotes.insert(make_pair(hash, winner));
+
+    if(AddWinningMasternode(winner)){
+        Relay(winner);
     }
 }
 
@@ -146,27 +236,25 @@ uint64_t CMasternodePayments::CalculateScore(uint256 blockHash, CTxIn& vin)
 
 bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payee, CTxIn& vin)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            payee = winner.payee;
-            vin = winner.vin;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    CMasternodePaymentWinner* pwinner = winners.Get(nBlockHeight);
+    if(pwinner == NULL) return false;
+
+    payee = pwinner->payee;
+    vin = pwinner->vin;
+    return true;
 }
 
 bool CMasternodePayments::GetWinningMasternode(int nBlockHeight, CTxIn& vinOut)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            vinOut = winner.vin;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    CMasternodePaymentWinner* pwinner = winners.Get(nBlockHeight);
+    if(pwinner == NULL) return false;
+
+    vinOut = pwinner->vin;
+    return true;
 }
 
 bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerIn)
@@ -178,32 +266,15 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
 
     winnerIn.score = CalculateScore(blockHash, winnerIn.vin);
 
-    bool foundBlock = false;
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == winnerIn.nBlockHeight) {
-            foundBlock = true;
-            if(winner.score < winnerIn.score){
-                winner.score = winnerIn.score;
-                winner.vin = winnerIn.vin;
-                winner.payee = winnerIn.payee;
-                winner.vchSig = winnerIn.vchSig;
+    // only replace the winner we have for this block by a better one
+    CMasternodePaymentWinner* pwinner = winners.Get(winnerIn.nBlockHeight);
+    if(pwinner != NULL && pwinner->score >= winnerIn.score) return false;
 
-                mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+    if(!winners.Set(winnerIn)) return false;
 
-                return true;
-            }
-        }
-    }
-
-    // if it's not in the vector
-    if(!foundBlock){
-        vWinning.push_back(winnerIn);
-        mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
-
-        return true;
-    }
+    mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
 
-    return false;
+    return true;
 }
 
 void CMasternodePayments::CleanPaymentList()
@@ -214,14 +285,13 @@ void CMasternodePayments::CleanPaymentList()
 
     int nLimit = std::max(((int)mnodeman.size())*((int)1.25), 1000);
 
-    vector<CMasternodePaymentWinner>::iterator it;
-    for(it=vWinning.begin();it<vWinning.end();it++){
-        if(pindexBest->nHeight - (*it).nBlockHeight > nLimit){
-            if(fDebug) LogPrintf("CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", (*it).nBlockHeight);
-            vWinning.erase(it);
-            break;
-        }
+    // the store has to hold the whole limit plus the winners voted ahead of the chain
+    if((int)winners.GetCapacity() <= nLimit + MNPAYMENTS_SYNC_AHEAD) {
+        LogPrintf("CMasternodePayments::CleanPaymentList - Growing winner store to %d blocks\n", 2 * nLimit);
+        winners.Resize(2 * nLimit);
     }
+
+    winners.EraseBelow(pindexBest->nHeight - nLimit);
 }
 
 bool CMasternodePayments::ProcessBlock(int nBlockHeight)
@@ -242,11 +312,13 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
     LogPrintf(" ProcessBlock Start nHeight %d - vin %s. \n", nBlockHeight, activeMasternode.vin.ToString().c_str());
 
     std::vector<CTxIn> vecLastPayments;
-    BOOST_REVERSE_FOREACH(CMasternodePaymentWinner& winner, vWinning)
+    int nTip = winners.GetTip();
+    for(int nHeight = nTip; nHeight > 0 && nHeight > nTip - (int)winners.GetCapacity(); nHeight--)
     {
         //if we already have the same vin - we have one full payment cycle, break
         if(vecLastPayments.size() > (unsigned int)nMinimumAge) break;
-        vecLastPayments.push_back(winner.vin);
+        CMasternodePaymentWinner* pwinner = winners.Get(nHeight);
+        if(pwinner != NULL) vecLastPayments.push_back(pwinner->vin);
     }
 
     // pay to the oldest MN that still had no payment but its input is old enough and it was active long enough
@@ -342,13 +414,44 @@ void CMasternodePayments::Relay(CMasternodePaymentWinner& winner)
     }
 }
 
-void CMasternodePayments::Sync(CNode* node)
+int CMasternodePayments::Sync(CNode* node, const std::vector<std::pair<int, uint256> >& vHave)
 {
     LOCK(cs_masternodepayments);
 
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning)
-        if(winner.nBlockHeight >= pindexBest->nHeight-10 && winner.nBlockHeight <= pindexBest->nHeight + 20)
-            node->PushMessage("mnw", winner);
+    if(pindexBest == NULL) return 0;
+
+    std::map<int, uint256> mapHave(vHave.begin(), vHave.end());
+
+    int nSent = 0;
+    for(int nHeight = pindexBest->nHeight - MNPAYMENTS_SYNC_DEPTH; nHeight <= pindexBest->nHeight + MNPAYMENTS_SYNC_AHEAD; nHeight++){
+        CMasternodePaymentWinner* pwinner = winners.Get(nHeight);
+        if(pwinner == NULL) continue;
+
+        std::map<int, uint256>::const_iterator it = mapHave.find(nHeight);
+        if(it != mapHave.end() && it->second == pwinner->GetHash()) continue;
+
+        node->PushMessage("mnw", *pwinner);
+        nSent++;
+    }
+
+    return nSent;
+}
+
+void CMasternodePayments::RequestSync(CNode* node)
+{
+    std::vector<std::pair<int, uint256> > vHave;
+    {
+        LOCK(cs_masternodepayments);
+
+        if(pindexBest == NULL) return;
+
+        for(int nHeight = pindexBest->nHeight - MNPAYMENTS_SYNC_DEPTH; nHeight <= pindexBest->nHeight + MNPAYMENTS_SYNC_AHEAD; nHeight++){
+            CMasternodePaymentWinner* pwinner = winners.Get(nHeight);
+            if(pwinner != NULL) vHave.push_back(make_pair(nHeight, pwinner->GetHash()));
+        }
+    }
+
+    node->PushMessage("mnget", vHave);
 }
 
 
@@ -16,6 +16,12 @@
 
 using namespace std;
 
+// heights kept at least, the store grows when the cleaning limit needs more
+#define MNPAYMENTS_STORE_MIN_SIZE              2048
+// winners are only accepted and synced this far below and above the best height
+#define MNPAYMENTS_SYNC_DEPTH                  10
+#define MNPAYMENTS_SYNC_AHEAD                  20
+
 class CMasternodePayments;
 class CMasternodePaymentWinner;
 
@@ -58,6 +64,37 @@ public:
     )
 };
 
+//
+// Winners by block height, in a ring buffer.
+//
+// The winner of a height lives in slot height % capacity, so lookups don't depend on how many
+// winners are kept, and a new height takes over the slot of the height capacity blocks below it.
+// Heights below the floor set by EraseBelow are gone even if their slot wasn't reused yet.
+//
+class CMasternodePaymentWinnerStore
+{
+private:
+    std::vector<CMasternodePaymentWinner> vSlots;
+    int nFloor;
+    int nTip;
+    int nCount;
+
+public:
+    CMasternodePaymentWinnerStore(unsigned int nCapacity);
+
+    // The winner for nBlockHeight, NULL if there is none
+    CMasternodePaymentWinner* Get(int nBlockHeight);
+    // Store the winner for its height. Fails if its slot holds a later height or it is below the floor
+    bool Set(const CMasternodePaymentWinner& winner);
+    void EraseBelow(int nBlockHeight);
+    // Rehash into nCapacity slots, keeping the most recent heights
+    void Resize(unsigned int nCapacity);
+
+    int GetTip() const { return nTip; }
+    unsigned int GetCapacity() const { return vSlots.size(); }
+    int size() const { return nCount; }
+};
+
 //
 // Masternode Payments Class
 // Keeps track of who should get paid for which blocks
@@ -66,7 +103,7 @@ public:
 class CMasternodePayments
 {
 private:
-    std::vector<CMasternodePaymentWinner> vWinning;
+    CMasternodePaymentWinnerStore winners;
     int nSyncedFromPeer;
     std::string strMasterPrivKey;
     std::string strMainPubKey;
@@ -75,13 +112,16 @@ private:
 
 public:
 
-    CMasternodePayments() {
+    CMasternodePayments() : winners(MNPAYMENTS_STORE_MIN_SIZE) {
         strMainPubKey = "";
         enabled = false;
     }
 
     bool SetPrivKey(std::string strPrivKey);
     bool CheckSignature(CMasternodePaymentWinner& winner);
+    // Check the signature on a worker thread, the winner is added and relayed once it holds
+    void CheckSignatureAsync(const CMasternodePaymentWinner& winner, NodeId nodeFrom);
+    void ProcessSignedWinner(CMasternodePaymentWinner winner, NodeId nodeFrom, bool fSigValid);
     bool Sign(CMasternodePaymentWinner& winner);
 
     // Deterministically calculate a given "score" for a masternode depending on how close it's hash is
@@ -94,7 +134,10 @@ public:
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
     bool ProcessBlock(int nBlockHeight);
     void Relay(CMasternodePaymentWinner& winner);
-    void Sync(CNode* node);
+    // Send the winners in the sync window, except those in vHave (height, winner hash) the peer already has
+    int Sync(CNode* node, const std::vector<std::pair<int, uint256> >& vHave);
+    // Ask a peer for the winners in the sync window we don't have
+    void RequestSync(CNode* node);
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
     int GetMinMasternodePaymentsProto();
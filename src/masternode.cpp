@@ -14,6 +14,8 @@ CCriticalSection cs_masternodes;
 map<uint256, int> mapSeenMasternodeScanningErrors;
 // cache block hashes as we calculate them
 std::map<int64_t, uint256> mapCacheBlockHashes;
+// spent state of masternode collateral
+CCollateralWatcher collateralWatcher;
 
 
 struct CompareValueOnly
@@ -63,6 +65,59 @@ bool GetBlockHash(uint256& hash, int nBlockHeight)
     return false;
 }
 
+void CCollateralWatcher::SyncTransaction(const CTransaction &tx, const CBlock *pblock, bool fConnect)
+{
+    LOCK(cs);
+
+    if(mapWatched.empty()) return;
+
+    // a mempool accept, block connect or block disconnect of a spend flips the outpoint's state
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        std::map<COutPoint, bool>::iterator it = mapWatched.find(txin.prevout);
+        if(it != mapWatched.end() && !it->second) {
+            LogPrint("masternode", "CCollateralWatcher::SyncTransaction - collateral %s touched by %s\n",
+                txin.prevout.ToString(), tx.GetHash().ToString());
+            it->second = true;
+            nVersion++;
+        }
+    }
+}
+
+bool CCollateralWatcher::NeedsCheck(const COutPoint& outpoint, int64_t nCollateralIn)
+{
+    LOCK(cs);
+
+    if(nCollateralIn != nCollateral) {
+        MarkAllDirty();
+        nCollateral = nCollateralIn;
+    }
+
+    std::map<COutPoint, bool>::iterator it = mapWatched.find(outpoint);
+    return it == mapWatched.end() || it->second;
+}
+
+void CCollateralWatcher::SetChecked(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    mapWatched[outpoint] = false;
+    nValidations++;
+}
+
+void CCollateralWatcher::Unwatch(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    mapWatched.erase(outpoint);
+}
+
+void CCollateralWatcher::MarkAllDirty()
+{
+    LOCK(cs);
+    for(std::map<COutPoint, bool>::iterator it = mapWatched.begin(); it != mapWatched.end(); ++it)
+        it->second = true;
+    nVersion++;
+}
+
 CMasternode::CMasternode()
 {
     LOCK(cs);
@@ -143,6 +198,8 @@ CMasternode::CMasternode(CService newAddr, CTxIn newVin, CPubKey newPubkey, std:
     lastVote = 0;
     nScanningErrorCount = 0;
     nLastScanningErrorBlockHeight = 0;
+    //mark last paid as current for new entries
+    nLastPaid = GetAdjustedTime();
 }
 
 //
@@ -171,10 +228,6 @@ void CMasternode::Check()
 {
     if(ShutdownRequested()) return;
 
-    //TODO: Random segfault with this line removed
-    TRY_LOCK(cs_main, lockRecv);
-    if(!lockRecv) return;
-
     //once spent, stop doing the checks
     if(activeState == MASTERNODE_VIN_SPENT) return;
 
@@ -189,18 +242,26 @@ void CMasternode::Check()
         return;
     }
 
-    if(!unitTest){
+    // the collateral is only validated again once the watcher saw something spend or unspend it
+    if(!unitTest && pindexBest != NULL && collateralWatcher.NeedsCheck(vin.prevout, MasternodeCollateral(pindexBest->nHeight))){
+        //TODO: Random segfault with this line removed
+        TRY_LOCK(cs_main, lockRecv);
+        if(!lockRecv) return;
+        CSchedulerLockTimer lockTimer;
+
         CValidationState state;
         CTransaction tx = CTransaction();
         CTxOut vout = CTxOut((MasternodeCollateral(pindexBest->nHeight) - 1)*COIN, darkSendPool.collateralPubKey);
         tx.vin.push_back(vin);
         tx.vout.push_back(vout);
 
-	if(!AcceptableInputs(mempool, tx, false, NULL)){
+        bool fAcceptable = AcceptableInputs(mempool, tx, false, NULL);
+        collateralWatcher.SetChecked(vin.prevout);
+        if(!fAcceptable){
             activeState = MASTERNODE_VIN_SPENT;
             return;
         }
     }
 
     activeState = MASTERNODE_ENABLED; // OK
-}
\ No newline at end of file
+}
@@ -37,12 +37,57 @@ class uint256;
 using namespace std;
 
 class CMasternode;
+class CCollateralWatcher;
 
 extern CCriticalSection cs_masternodes;
+extern CCollateralWatcher collateralWatcher;
 extern map<int64_t, uint256> mapCacheBlockHashes;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
+//
+// Tracks the spent state of masternode collateral outpoints. Registered with core like a wallet so it is
+// told about every transaction entering the mempool and every block connected or disconnected; a collateral
+// only needs the full AcceptableInputs check again after one of those touched it.
+//
+class CCollateralWatcher : public CWalletInterface
+{
+private:
+    mutable CCriticalSection cs;
+    // watched outpoint -> true when its state may have changed since it was last validated
+    std::map<COutPoint, bool> mapWatched;
+    // collateral amount the watched outpoints were validated against
+    int64_t nCollateral;
+    // number of full validations run, for debugging
+    uint64_t nValidations;
+    // bumped whenever a watched outpoint is marked dirty, so cached results depending on collateral can be dropped
+    unsigned int nVersion;
+
+protected:
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock, bool fConnect);
+    void EraseFromWallet(const uint256 &hash) {}
+    void SetBestChain(const CBlockLocator &locator) {}
+    bool UpdatedTransaction(const uint256 &hash) { return false; }
+    void Inventory(const uint256 &hash) {}
+    void ResendWalletTransactions(bool fForce) {}
+
+public:
+    CCollateralWatcher() : nCollateral(0), nValidations(0), nVersion(0) {}
+
+    // true if the outpoint is new to the watcher or was touched since it was last validated
+    bool NeedsCheck(const COutPoint& outpoint, int64_t nCollateralIn);
+    // record that the outpoint has just been validated
+    void SetChecked(const COutPoint& outpoint);
+    // stop watching an outpoint, called when its masternode is removed
+    void Unwatch(const COutPoint& outpoint);
+    // force the next Check() of every masternode to validate its collateral
+    void MarkAllDirty();
+
+    uint64_t GetValidationCount() const { LOCK(cs); return nValidations; }
+    unsigned int GetVersion() const { LOCK(cs); return nVersion; }
+    int size() const { LOCK(cs); return mapWatched.size(); }
+};
+
 //
 // The Masternode Class. For managing the darksend process. It contains the input of the 5,000 ARION, signature to prove
 // it's the one who own that ip address and code for calculating the payment election.
@@ -5,6 +5,8 @@
 #include "core.h"
 #include "util.h"
 #include "addrman.h"
+#include "msgverify.h"
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 
@@ -21,14 +23,6 @@ struct CompareValueOnly
         return t1.first < t2.first;
     }
 };
-struct CompareValueOnlyMN
-{
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-                    const pair<int64_t, CMasternode>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
 
 
 //
@@ -38,13 +32,68 @@ struct CompareValueOnlyMN
 CMasternodeDB::CMasternodeDB()
 {
     pathMN = GetDataDir() / "mncache.dat";
+    pathJournal = GetDataDir() / "mncache.log";
     strMagicMessage = "MasternodeCache";
+    strJournalMagicMessage = "MasternodeJournal";
+}
+
+void CMasternodeDB::GetEntryHashes(const CMasternodeMan& mnodeman, std::map<COutPoint, uint256>& mapHashesRet,
+                                   std::map<COutPoint, std::pair<int64_t, int64_t> >& mapSeenRet)
+{
+    LOCK(mnodeman.cs);
+
+    mapHashesRet.clear();
+    mapSeenRet.clear();
+    for(std::map<COutPoint, CMasternodePtr>::const_iterator it = mnodeman.mapMasternodes.begin(); it != mnodeman.mapMasternodes.end(); ++it)
+    {
+        CMasternode mn(*it->second);
+        mn.nLastPaid = it->second->nLastPaid;
+        mapSeenRet[it->first] = make_pair(mn.lastTimeSeen, mn.lastDseep);
+        mn.lastTimeSeen = 0;
+        mn.lastDseep = 0;
+        mapHashesRet[it->first] = SerializeHash(mn, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+CMasternodeDB::ReadResult CMasternodeDB::ReadSnapshot(std::vector<unsigned char>& vchData, uint256& hashIn)
+{
+    // open input file, and associate with CAutoFile
+    FILE *file = fopen(pathMN.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein)
+    {
+        error("%s : Failed to open file %s", __func__, pathMN.string());
+        return FileError;
+    }
+
+    // use file size to size memory buffer
+    int fileSize = boost::filesystem::file_size(pathMN);
+    int dataSize = fileSize - sizeof(uint256);
+    // Don't try to resize to a negative number if file is small
+    if (dataSize < 0)
+        dataSize = 0;
+    vchData.resize(dataSize);
+
+    // read data and checksum from file
+    try {
+        filein.read((char *)&vchData[0], dataSize);
+        filein >> hashIn;
+    }
+    catch (std::exception &e) {
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return HashReadError;
+    }
+    filein.fclose();
+
+    return Ok;
 }
 
-bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
+bool CMasternodeDB::Write(CMasternodeMan& mnodemanToSave)
 {
     int64_t nStart = GetTimeMillis();
 
+    LOCK(mnodemanToSave.cs);
+
     // serialize addresses, checksum data up to that point, then append csum
     CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
     ssMasternodes << strMagicMessage; // masternode cache file specific magic message
@@ -69,50 +118,257 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
     FileCommit(fileout);
     fileout.fclose();
 
+    // the old journal belongs to the old snapshot, changes are tracked from here on
+    boost::filesystem::remove(pathJournal);
+    mnodemanToSave.hashPersistedSnapshot = hash;
+    GetEntryHashes(mnodemanToSave, mnodemanToSave.mapPersistedHashes, mnodemanToSave.mapPersistedSeen);
+    mnodemanToSave.nJournalRecords = 0;
+
     LogPrintf("Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToSave.ToString());
 
     return true;
 }
 
-CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
+bool CMasternodeDB::WriteJournal(CMasternodeMan& mnodemanToSave)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE *file = fopen(pathMN.string().c_str(), "rb");
+
+    LOCK(mnodemanToSave.cs);
+
+    // nothing to append to yet, or the journal is long enough to fold into a new snapshot
+    if (mnodemanToSave.hashPersistedSnapshot == 0 || mnodemanToSave.nJournalRecords >= MASTERNODES_JOURNAL_MAX_RECORDS)
+        return false;
+    if (!boost::filesystem::exists(pathMN))
+        return false;
+
+    std::map<COutPoint, uint256> mapHashes;
+    std::map<COutPoint, std::pair<int64_t, int64_t> > mapSeen;
+    GetEntryHashes(mnodemanToSave, mapHashes, mapSeen);
+
+    // entries that were only pinged go in as a compact last-seen record instead of in full
+    int64_t nTime = GetAdjustedTime();
+    std::vector<CMasternode> vChanged;
+    std::vector<COutPoint> vRemoved;
+    std::vector<CMasternodeSeen> vSeen;
+    // in list order, so new entries are replayed in the order they were added; reserved up front, as
+    // growing the vector would copy the entries and restart their payment age
+    vChanged.reserve(mnodemanToSave.vMasternodes.size());
+    BOOST_FOREACH(const CMasternodePtr& pmn, mnodemanToSave.vMasternodes)
+    {
+        const COutPoint& outpoint = pmn->vin.prevout;
+        std::map<COutPoint, uint256>::iterator mi = mnodemanToSave.mapPersistedHashes.find(outpoint);
+        if (mi == mnodemanToSave.mapPersistedHashes.end() || mi->second != mapHashes[outpoint])
+        {
+            vChanged.push_back(*pmn);
+            vChanged.back().nLastPaid = pmn->nLastPaid;
+            continue;
+        }
+
+        const std::pair<int64_t, int64_t>& seen = mapSeen[outpoint];
+        std::map<COutPoint, std::pair<int64_t, int64_t> >::iterator si = mnodemanToSave.mapPersistedSeen.find(outpoint);
+        if (si != mnodemanToSave.mapPersistedSeen.end() && si->second == seen)
+            continue;
+
+        CMasternodeSeen mns;
+        mns.outpoint = outpoint;
+        mns.nSeenAge = nTime > seen.first ? nTime - seen.first : 0;
+        mns.nDseepAge = nTime > seen.second ? nTime - seen.second : 0;
+        vSeen.push_back(mns);
+    }
+    for(std::map<COutPoint, uint256>::iterator it = mnodemanToSave.mapPersistedHashes.begin(); it != mnodemanToSave.mapPersistedHashes.end(); ++it)
+        if (!mapHashes.count(it->first))
+            vRemoved.push_back(it->first);
+
+    if (vChanged.empty() && vRemoved.empty() && vSeen.empty())
+    {
+        LogPrint("masternode", "CMasternodeDB::WriteJournal - no changes since last dump\n");
+        return true;
+    }
+
+    // record: size, payload, checksum of payload
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    ssRecord << nTime << mnodemanToSave.nDsqCount << vChanged << vRemoved << vSeen;
+    uint256 hash = Hash(ssRecord.begin(), ssRecord.end());
+    unsigned int nSize = ssRecord.size();
+
+    // a journal that outgrows the snapshot is cheaper to fold into a new one
+    uintmax_t nJournalSize = boost::filesystem::exists(pathJournal) ? boost::filesystem::file_size(pathJournal) : 0;
+    if (nJournalSize + nSize > boost::filesystem::file_size(pathMN))
+        return false;
+
+    bool fNewJournal = (nJournalSize == 0);
+    FILE *file = fopen(pathJournal.string().c_str(), "ab");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+    {
+        error("%s : Failed to open file %s", __func__, pathJournal.string());
+        return false;
+    }
+
+    try {
+        if (fNewJournal)
+        {
+            fileout << strJournalMagicMessage; // journal file specific magic message
+            fileout << FLATDATA(Params().MessageStart()); // network specific magic number
+            fileout << mnodemanToSave.hashPersistedSnapshot; // snapshot the journal applies to
+        }
+        fileout << nSize;
+        fileout << ssRecord;
+        fileout << hash;
+    }
+    catch (std::exception &e) {
+        error("%s : Serialize or I/O error - %s", __func__, e.what());
+        return false;
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+
+    mnodemanToSave.mapPersistedHashes.swap(mapHashes);
+    mnodemanToSave.mapPersistedSeen.swap(mapSeen);
+    mnodemanToSave.nJournalRecords++;
+
+    LogPrintf("Written %d changed, %d removed, %d seen masternodes to mncache.log  %dms\n", vChanged.size(), vRemoved.size(), vSeen.size(), GetTimeMillis() - nStart);
+
+    return true;
+}
+
+int CMasternodeDB::ReadJournal(CMasternodeMan& mnodemanToLoad, const uint256& hashSnapshot)
+{
+    if (!boost::filesystem::exists(pathJournal))
+        return 0;
+
+    int64_t nStart = GetTimeMillis();
+
+    FILE *file = fopen(pathJournal.string().c_str(), "rb");
     CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
     if (!filein)
     {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
-        return FileError;
+        error("%s : Failed to open file %s", __func__, pathJournal.string());
+        return -1;
     }
 
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
+    int fileSize = boost::filesystem::file_size(pathJournal);
     vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
+    vchData.resize(fileSize);
     try {
-        filein.read((char *)&vchData[0], dataSize);
-        filein >> hashIn;
+        if (fileSize > 0)
+            filein.read((char *)&vchData[0], fileSize);
     }
     catch (std::exception &e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
+        error("%s : I/O error - %s", __func__, e.what());
+        return -1;
     }
     filein.fclose();
 
+    CDataStream ssJournal(vchData, SER_DISK, CLIENT_VERSION);
+
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    uint256 hashSnapshotTmp;
+    try {
+        ssJournal >> strMagicMessageTmp >> FLATDATA(pchMsgTmp) >> hashSnapshotTmp;
+    }
+    catch (std::exception &e) {
+        strMagicMessageTmp = "";
+    }
+    if (strJournalMagicMessage != strMagicMessageTmp || memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) ||
+        hashSnapshotTmp != hashSnapshot)
+    {
+        // left over from an older snapshot, its changes are already in mncache.dat or lost with it
+        LogPrintf("Ignoring mncache.log, it does not belong to mncache.dat\n");
+        boost::filesystem::remove(pathJournal);
+        return 0;
+    }
+
+    int nRecords = 0;
+    bool fTorn = false;
+    LOCK(mnodemanToLoad.cs);
+    while (!ssJournal.empty())
+    {
+        std::vector<CMasternode> vChanged;
+        std::vector<COutPoint> vRemoved;
+        std::vector<CMasternodeSeen> vSeen;
+        int64_t nTime;
+        try {
+            unsigned int nSize;
+            ssJournal >> nSize;
+            if (nSize > ssJournal.size()) {
+                fTorn = true;
+                break;
+            }
+            CDataStream ssRecord(ssJournal.begin(), ssJournal.begin() + nSize, SER_DISK, CLIENT_VERSION);
+            ssJournal.ignore(nSize);
+            uint256 hashIn;
+            ssJournal >> hashIn;
+            if (hashIn != Hash(ssRecord.begin(), ssRecord.end())) {
+                fTorn = true;
+                break;
+            }
+            ssRecord >> nTime >> mnodemanToLoad.nDsqCount >> vChanged >> vRemoved >> vSeen;
+        }
+        catch (std::exception &e) {
+            fTorn = true;
+            break;
+        }
+
+        BOOST_FOREACH(const COutPoint& outpoint, vRemoved)
+            mnodemanToLoad.EraseMasternode(outpoint, false);
+        BOOST_FOREACH(const CMasternode& mn, vChanged)
+        {
+            // a changed entry keeps its place in the list, a new one goes at the end
+            std::map<COutPoint, CMasternodePtr>::iterator it = mnodemanToLoad.mapMasternodes.find(mn.vin.prevout);
+            if (it == mnodemanToLoad.mapMasternodes.end())
+            {
+                mnodemanToLoad.InsertMasternode(mn, false);
+                continue;
+            }
+            mnodemanToLoad.UnindexMasternode(*it->second);
+            *it->second = mn;
+            it->second->nLastPaid = mn.nLastPaid;
+            mnodemanToLoad.IndexMasternode(mn);
+        }
+        BOOST_FOREACH(const CMasternodeSeen& mns, vSeen)
+        {
+            std::map<COutPoint, CMasternodePtr>::iterator it = mnodemanToLoad.mapMasternodes.find(mns.outpoint);
+            if (it == mnodemanToLoad.mapMasternodes.end()) continue;
+            it->second->lastTimeSeen = nTime - (int64_t)mns.nSeenAge;
+            it->second->lastDseep = nTime - (int64_t)mns.nDseepAge;
+        }
+        nRecords++;
+    }
+    // sized as if the whole list had been read from one snapshot
+    std::vector<CMasternodePtr>(mnodemanToLoad.vMasternodes).swap(mnodemanToLoad.vMasternodes);
+    mnodemanToLoad.MarkListChanged();
+
+    // a torn tail from a crash mid-append; appending after it would be unreadable, so fold it all into a new snapshot
+    if (fTorn)
+    {
+        LogPrintf("mncache.log has a damaged record after %d good ones, the next dump will rewrite mncache.dat\n", nRecords);
+        mnodemanToLoad.nJournalRecords = MASTERNODES_JOURNAL_MAX_RECORDS;
+    }
+    else
+        mnodemanToLoad.nJournalRecords = nRecords;
+
+    LogPrintf("Replayed %d records from mncache.log  %dms\n", nRecords, GetTimeMillis() - nStart);
+
+    return nRecords;
+}
+
+CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fReplayJournal)
+{
+    int64_t nStart = GetTimeMillis();
+
+    vector<unsigned char> vchData;
+    uint256 hashIn;
+    ReadResult readResult = ReadSnapshot(vchData, hashIn);
+    if (readResult != Ok)
+        return readResult;
+
     CDataStream ssMasternodes(vchData, SER_DISK, CLIENT_VERSION);
 
     // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    if (hashIn != hashTmp)
+    if (hashIn != Hash(ssMasternodes.begin(), ssMasternodes.end()))
     {
         error("%s : Checksum mismatch, data corrupted", __func__);
         return IncorrectHash;
@@ -151,6 +407,16 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
         return IncorrectFormat;
     }
 
+    if (fReplayJournal)
+    {
+        // remember what is on disk so later dumps only journal what changed
+        if (ReadJournal(mnodemanToLoad, hashIn) >= 0)
+        {
+            mnodemanToLoad.hashPersistedSnapshot = hashIn;
+            GetEntryHashes(mnodemanToLoad, mnodemanToLoad.mapPersistedHashes, mnodemanToLoad.mapPersistedSeen);
+        }
+    }
+
     mnodemanToLoad.CheckAndRemove(); // clean out expired
     LogPrintf("Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToLoad.ToString());
@@ -158,37 +424,95 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
     return Ok;
 }
 
+bool CMasternodeDB::HasSnapshot(const CMasternodeMan& mnodeman)
+{
+    LOCK(mnodeman.cs);
+    return mnodeman.hashPersistedSnapshot != 0 && boost::filesystem::exists(pathMN);
+}
+
 void DumpMasternodes()
 {
     int64_t nStart = GetTimeMillis();
 
+    // writing now would replace the file still being read, and with only what the network sent so far
+    if (mnodeman.IsLoading())
+    {
+        LogPrintf("mncache.dat is still being loaded, skipping the masternode dump\n");
+        return;
+    }
+
     CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
 
-    LogPrintf("Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman);
-    // there was an error and it was not an error on file openning => do not proceed
+    // usually only the changes since the last dump need to go to disk
+    if (mndb.WriteJournal(mnodeman))
+    {
+        LogPrintf("Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
+        return;
+    }
+
+    // a snapshot we read or wrote ourselves can be replaced without checking its format again
+    if (!mndb.HasSnapshot(mnodeman))
+    {
+        CMasternodeMan tempMnodeman;
+
+        LogPrintf("Verifying mncache.dat format...\n");
+        CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman, false);
+        // there was an error and it was not an error on file openning => do not proceed
+        if (readResult == CMasternodeDB::FileError)
+            LogPrintf("Missing masternode list file - mncache.dat, will try to recreate\n");
+        else if (readResult != CMasternodeDB::Ok)
+        {
+            LogPrintf("Error reading mncache.dat: ");
+            if(readResult == CMasternodeDB::IncorrectFormat)
+                LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+            else
+            {
+                LogPrintf("file format is unknown or invalid, please fix it manually\n");
+                return;
+            }
+        }
+    }
+    LogPrintf("Writting info to mncache.dat...\n");
+    mndb.Write(mnodeman);
+
+    LogPrintf("Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
+}
+
+static void ThreadLoadMasternodes()
+{
+    RenameThread("Arion-mnload");
+
+    CMasternodeMan mnodemanLoaded;
+    CMasternodeDB mndb;
+    CMasternodeDB::ReadResult readResult = mndb.Read(mnodemanLoaded);
     if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode list file - mncache.dat, will try to recreate\n");
+        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
     else if (readResult != CMasternodeDB::Ok)
     {
         LogPrintf("Error reading mncache.dat: ");
         if(readResult == CMasternodeDB::IncorrectFormat)
             LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
         else
-        {
             LogPrintf("file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
     }
-    LogPrintf("Writting info to mncache.dat...\n");
-    mndb.Write(mnodeman);
 
-    LogPrintf("Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
+    mnodeman.AddLoaded(mnodemanLoaded);
+}
+
+void LoadMasternodes(boost::thread_group& threadGroup)
+{
+    mnodeman.SetLoading();
+    threadGroup.create_thread(&ThreadLoadMasternodes);
 }
 
 CMasternodeMan::CMasternodeMan() {
     nDsqCount = 0;
+    nListVersion = 0;
+    nCollateralVersion = 0;
+    nRankCacheClock = 0;
+    hashPersistedSnapshot = 0;
+    nJournalRecords = 0;
+    fLoading = false;
 }
 
 bool CMasternodeMan::Add(CMasternode &mn)
@@ -203,7 +527,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
     if (pmn == NULL)
     {
         LogPrint("masternode", "CMasternodeMan: Adding new masternode %s - %i now\n", mn.addr.ToString().c_str(), size() + 1);
-        vMasternodes.push_back(mn);
+        InsertMasternode(mn);
+        MarkListChanged();
         return true;
     }
 
@@ -231,24 +556,36 @@ void CMasternodeMan::Check()
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
+    bool fChanged = false;
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes)
+    {
+        CMasternode& mn = *pmn;
+        int nPrevState = mn.activeState;
         mn.Check();
+        if(mn.activeState != nPrevState) fChanged = true;
+    }
+
+    if(fChanged) MarkListChanged();
 }
 
 void CMasternodeMan::CheckAndRemove()
 {
     LOCK(cs);
+    CSchedulerLockTimer lockTimer;
 
     Check();
 
     //remove inactive
-    vector<CMasternode>::iterator it = vMasternodes.begin();
-    while(it != vMasternodes.end()){
-        if((*it).activeState == CMasternode::MASTERNODE_REMOVE || (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT || (*it).protocolVersion < nMasternodeMinProtocol){
-            LogPrint("masternode", "CMasternodeMan: Removing inactive masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
-            it = vMasternodes.erase(it);
+    unsigned int i = 0;
+    while(i < vMasternodes.size()){
+        CMasternode& mn = *vMasternodes[i];
+        if(mn.activeState == CMasternode::MASTERNODE_REMOVE || mn.activeState == CMasternode::MASTERNODE_VIN_SPENT || mn.protocolVersion < nMasternodeMinProtocol){
+            LogPrint("masternode", "CMasternodeMan: Removing inactive masternode %s - %i now\n", mn.addr.ToString().c_str(), size() - 1);
+            collateralWatcher.Unwatch(mn.vin.prevout);
+            EraseMasternode(COutPoint(mn.vin.prevout));
+            MarkListChanged();
         } else {
-            ++it;
+            ++i;
         }
     }
 
@@ -287,19 +624,170 @@ void CMasternodeMan::CheckAndRemove()
 void CMasternodeMan::Clear()
 {
     LOCK(cs);
+    mapMasternodes.clear();
     vMasternodes.clear();
+    mapMasternodesByPubKey.clear();
+    mapMasternodesByAddr.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
     nDsqCount = 0;
+    MarkListChanged();
+}
+
+void CMasternodeMan::SetLoading()
+{
+    LOCK(cs);
+    fLoading = true;
+}
+
+bool CMasternodeMan::IsLoading() const
+{
+    LOCK(cs);
+    return fLoading;
+}
+
+void CMasternodeMan::AddLoaded(CMasternodeMan& mnodemanLoaded)
+{
+    LOCK2(cs, mnodemanLoaded.cs);
+
+    // the loaded entries keep their stored order, one also heard from the network meanwhile is kept as heard
+    std::vector<CMasternodePtr> vHeard;
+    vHeard.swap(vMasternodes);
+    vMasternodes.reserve(mnodemanLoaded.vMasternodes.size() + vHeard.size());
+    BOOST_FOREACH(CMasternodePtr& pmn, mnodemanLoaded.vMasternodes)
+    {
+        std::map<COutPoint, CMasternodePtr>::iterator it = mapMasternodes.find(pmn->vin.prevout);
+        if(it != mapMasternodes.end())
+        {
+            vMasternodes.push_back(it->second);
+            continue;
+        }
+        vMasternodes.push_back(pmn);
+        mapMasternodes[pmn->vin.prevout] = pmn;
+        IndexMasternode(*pmn);
+    }
+    BOOST_FOREACH(CMasternodePtr& pmn, vHeard)
+        if(!mnodemanLoaded.mapMasternodes.count(pmn->vin.prevout))
+            vMasternodes.push_back(pmn);
+
+    mAskedUsForMasternodeList.insert(mnodemanLoaded.mAskedUsForMasternodeList.begin(), mnodemanLoaded.mAskedUsForMasternodeList.end());
+    mWeAskedForMasternodeList.insert(mnodemanLoaded.mWeAskedForMasternodeList.begin(), mnodemanLoaded.mWeAskedForMasternodeList.end());
+    mWeAskedForMasternodeListEntry.insert(mnodemanLoaded.mWeAskedForMasternodeListEntry.begin(), mnodemanLoaded.mWeAskedForMasternodeListEntry.end());
+    nDsqCount = std::max(nDsqCount, mnodemanLoaded.nDsqCount);
+
+    // what is on disk is what was loaded, the entries heard since show up as changes in the next journal record
+    hashPersistedSnapshot = mnodemanLoaded.hashPersistedSnapshot;
+    mapPersistedHashes.swap(mnodemanLoaded.mapPersistedHashes);
+    mapPersistedSeen.swap(mnodemanLoaded.mapPersistedSeen);
+    nJournalRecords = mnodemanLoaded.nJournalRecords;
+    fLoading = false;
+
+    LogPrintf("Added the masternode list from mncache.dat: %d loaded, %d heard while loading\n",
+        mnodemanLoaded.vMasternodes.size(), vHeard.size());
+
+    MarkListChanged();
+}
+
+void CMasternodeMan::MarkListChanged()
+{
+    LOCK(cs);
+    nListVersion++;
+    mapRankCache.clear();
+}
+
+const CMasternodeRankTable* CMasternodeMan::GetRankTable(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    if(pindexBest == NULL) return NULL;
+    if(nBlockHeight == 0) nBlockHeight = pindexBest->nHeight;
+
+    //make sure we know about this block
+    uint256 hash = 0;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    boost::tuple<int64_t, int, bool> key(nBlockHeight, minProtocol, fOnlyActive);
+    std::map<boost::tuple<int64_t, int, bool>, CMasternodeRankTable>::iterator it = mapRankCache.find(key);
+    // a spend or unspend of a collateral may flip a ranked masternode to spent
+    unsigned int nWatcherVersion = collateralWatcher.GetVersion();
+    if(nWatcherVersion != nCollateralVersion) {
+        nCollateralVersion = nWatcherVersion;
+        MarkListChanged();
+        it = mapRankCache.end();
+    }
+    int64_t nNow = GetAdjustedTime();
+    if(it != mapRankCache.end() && it->second.hashBlock == hash && it->second.nListVersion == nListVersion &&
+        (!fOnlyActive || nNow < it->second.nExpireTime))
+    {
+        it->second.nLastUsed = ++nRankCacheClock;
+        return &it->second;
+    }
+
+    // building the table runs Check() on every entry, which may itself change the list
+    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
+    bool fChanged = false;
+    int64_t nExpireTime = std::numeric_limits<int64_t>::max();
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes) {
+        CMasternode& mn = *pmn;
+
+        if(mn.protocolVersion < minProtocol) continue;
+        if(fOnlyActive) {
+            int nPrevState = mn.activeState;
+            mn.Check();
+            if(mn.activeState != nPrevState) fChanged = true;
+            if(!mn.IsEnabled()) continue;
+            nExpireTime = std::min(nExpireTime, mn.lastTimeSeen + MASTERNODE_EXPIRATION_SECONDS);
+        }
+
+        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        unsigned int n2 = 0;
+        memcpy(&n2, &n, sizeof(n2));
+
+        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
+    }
+    if(fChanged) MarkListChanged();
+
+    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly());
+
+    // evict the least recently used table
+    if(mapRankCache.size() >= MASTERNODES_RANK_CACHE_SIZE && !mapRankCache.count(key))
+    {
+        std::map<boost::tuple<int64_t, int, bool>, CMasternodeRankTable>::iterator itOldest = mapRankCache.begin();
+        for(it = mapRankCache.begin(); it != mapRankCache.end(); ++it)
+            if(it->second.nLastUsed < itOldest->second.nLastUsed) itOldest = it;
+        mapRankCache.erase(itOldest);
+    }
+
+    CMasternodeRankTable& table = mapRankCache[key];
+    table.hashBlock = hash;
+    table.nListVersion = nListVersion;
+    table.nExpireTime = nExpireTime;
+    table.nLastUsed = ++nRankCacheClock;
+    table.vecScores.swap(vecMasternodeScores);
+    table.mapRanks.clear();
+
+    int rank = 0;
+    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, table.vecScores){
+        rank++;
+        table.mapRanks[s.second.prevout] = rank;
+    }
+
+    LogPrint("masternode", "CMasternodeMan::GetRankTable - height %d proto %d active %d: %d entries\n",
+        nBlockHeight, minProtocol, fOnlyActive, table.vecScores.size());
+
+    return &table;
 }
 
 int CMasternodeMan::CountEnabled(int protocolVersion)
 {
+    LOCK(cs);
+
     int i = 0;
     protocolVersion = protocolVersion == -1 ? masternodePayments.GetMinMasternodePaymentsProto() : protocolVersion;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes) {
+        CMasternode& mn = *pmn;
         mn.Check();
         if(mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
         i++;
@@ -310,9 +798,12 @@ int CMasternodeMan::CountEnabled(int protocolVersion)
 
 int CMasternodeMan::CountMasternodesAboveProtocol(int protocolVersion)
 {
+    LOCK(cs);
+
     int i = 0;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes) {
+        CMasternode& mn = *pmn;
         mn.Check();
         if(mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
         i++;
@@ -342,12 +833,10 @@ CMasternode *CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    std::map<COutPoint, CMasternodePtr>::iterator it = mapMasternodes.find(vin.prevout);
+    if(it == mapMasternodes.end())
+        return NULL;
+    return it->second.get();
 }
 
 CMasternode* CMasternodeMan::FindOldestNotInVec(const std::vector<CTxIn> &vVins, int nMinimumAge)
@@ -356,8 +845,9 @@ CMasternode* CMasternodeMan::FindOldestNotInVec(const std::vector<CTxIn> &vVins,
 
     CMasternode *pOldestMasternode = NULL;
 
-    BOOST_FOREACH(CMasternode &mn, vMasternodes)
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes)
     {
+        CMasternode& mn = *pmn;
         mn.Check();
         if(!mn.IsEnabled()) continue;
 
@@ -387,19 +877,138 @@ CMasternode *CMasternodeMan::FindRandom()
 
     if(size() == 0) return NULL;
 
-    return &vMasternodes[GetRandInt(vMasternodes.size())];
+    return vMasternodes[GetRandInt(vMasternodes.size())].get();
 }
 
 CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
+    std::multimap<CPubKey, COutPoint>::iterator it = mapMasternodesByPubKey.find(pubKeyMasternode);
+    if(it == mapMasternodesByPubKey.end())
+        return NULL;
+
+    std::map<COutPoint, CMasternodePtr>::iterator mi = mapMasternodes.find(it->second);
+    if(mi == mapMasternodes.end())
+        return NULL;
+    return mi->second.get();
+}
+
+CMasternode *CMasternodeMan::Find(const CService &addr)
+{
+    LOCK(cs);
+
+    std::multimap<CService, COutPoint>::iterator it = mapMasternodesByAddr.find(addr);
+    if(it == mapMasternodesByAddr.end())
+        return NULL;
+
+    std::map<COutPoint, CMasternodePtr>::iterator mi = mapMasternodes.find(it->second);
+    if(mi == mapMasternodes.end())
+        return NULL;
+    return mi->second.get();
+}
+
+void CMasternodeMan::IndexMasternode(const CMasternode& mn)
+{
+    LOCK(cs);
+    mapMasternodesByPubKey.insert(make_pair(mn.pubkey2, mn.vin.prevout));
+    mapMasternodesByAddr.insert(make_pair(mn.addr, mn.vin.prevout));
+}
+
+void CMasternodeMan::InsertMasternode(const CMasternode& mn, bool fCopied)
+{
+    LOCK(cs);
+
+    if(fCopied && vMasternodes.size() == vMasternodes.capacity()) {
+        BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes)
+            pmn->nLastPaid = GetAdjustedTime();
+    }
+
+    CMasternodePtr pmn(new CMasternode(mn));
+    if(!fCopied) pmn->nLastPaid = mn.nLastPaid;
+    vMasternodes.push_back(pmn);
+    mapMasternodes[mn.vin.prevout] = pmn;
+    IndexMasternode(mn);
+}
+
+void CMasternodeMan::EraseMasternode(const COutPoint& outpoint, bool fCopied)
+{
+    LOCK(cs);
+
+    std::map<COutPoint, CMasternodePtr>::iterator mi = mapMasternodes.find(outpoint);
+    if(mi == mapMasternodes.end()) return;
+
+    std::vector<CMasternodePtr>::iterator it = std::find(vMasternodes.begin(), vMasternodes.end(), mi->second);
+    if(it != vMasternodes.end()) {
+        if(fCopied)
+            for(std::vector<CMasternodePtr>::iterator itNext = it + 1; itNext != vMasternodes.end(); ++itNext)
+                (*itNext)->nLastPaid = GetAdjustedTime();
+        vMasternodes.erase(it);
+    }
+    UnindexMasternode(*mi->second);
+    mapMasternodes.erase(mi);
+}
+
+void CMasternodeMan::UnindexMasternode(const CMasternode& mn)
+{
+    LOCK(cs);
+
+    std::pair<std::multimap<CPubKey, COutPoint>::iterator, std::multimap<CPubKey, COutPoint>::iterator> rangePubKey =
+        mapMasternodesByPubKey.equal_range(mn.pubkey2);
+    for(std::multimap<CPubKey, COutPoint>::iterator it = rangePubKey.first; it != rangePubKey.second; ++it)
+        if(it->second == mn.vin.prevout) {
+            mapMasternodesByPubKey.erase(it);
+            break;
+        }
+
+    std::pair<std::multimap<CService, COutPoint>::iterator, std::multimap<CService, COutPoint>::iterator> rangeAddr =
+        mapMasternodesByAddr.equal_range(mn.addr);
+    for(std::multimap<CService, COutPoint>::iterator it = rangeAddr.first; it != rangeAddr.second; ++it)
+        if(it->second == mn.vin.prevout) {
+            mapMasternodesByAddr.erase(it);
+            break;
+        }
+}
+
+std::vector<CMasternode> CMasternodeMan::GetFullMasternodeVector()
+{
+    LOCK(cs);
+
+    Check();
+
+    return GetMasternodeVector();
+}
+
+std::vector<CMasternode> CMasternodeMan::GetMasternodeVector() const
+{
+    LOCK(cs);
+
+    // these stand in for the stored entries, so they keep their payment age
+    std::vector<CMasternode> vMasternodesRet;
+    vMasternodesRet.reserve(vMasternodes.size());
+    BOOST_FOREACH(const CMasternodePtr& pmn, vMasternodes)
     {
-        if(mn.pubkey2 == pubKeyMasternode)
-            return &mn;
+        vMasternodesRet.push_back(*pmn);
+        vMasternodesRet.back().nLastPaid = pmn->nLastPaid;
     }
-    return NULL;
+    return vMasternodesRet;
+}
+
+void CMasternodeMan::SetMasternodeVector(const std::vector<CMasternode>& vMasternodesIn)
+{
+    LOCK(cs);
+
+    mapMasternodes.clear();
+    vMasternodes.clear();
+    mapMasternodesByPubKey.clear();
+    mapMasternodesByAddr.clear();
+    vMasternodes.reserve(vMasternodesIn.size());
+    BOOST_FOREACH(const CMasternode& mn, vMasternodesIn)
+    {
+        if(mapMasternodes.count(mn.vin.prevout)) continue;
+        InsertMasternode(mn, false);
+    }
+    MarkListChanged();
 }
 
 CMasternode *CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn> &vecToExclude, int protocolVersion)
@@ -416,7 +1025,8 @@ CMasternode *CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn> &vecToExclude
     LogPrintf("CMasternodeMan::FindRandomNotInVec - rand %d\n", rand);
     bool found;
 
-    BOOST_FOREACH(CMasternode &mn, vMasternodes) {
+    BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes) {
+        CMasternode& mn = *pmn;
         if(mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
         found = false;
         BOOST_FOREACH(CTxIn &usedVin, vecToExclude) {
@@ -436,98 +1046,45 @@ CMasternode *CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn> &vecToExclude
 
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    unsigned int score = 0;
-    CMasternode* winner = NULL;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        mn.Check();
-        if(mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
+    LOCK(cs);
 
-        // calculate the score for each masternode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, true);
+    if(pTable == NULL || pTable->vecScores.empty()) return NULL;
 
-        // determine the winner
-        if(n2 > score){
-            score = n2;
-            winner = &mn;
-        }
-    }
+    // a zero score means the block hash was unknown when scoring
+    if(pTable->vecScores[0].first == 0) return NULL;
 
-    return winner;
+    return Find(pTable->vecScores[0].second);
 }
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
+    LOCK(cs);
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly());
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, fOnlyActive);
+    if(pTable == NULL) return -1;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecMasternodeScores){
-        rank++;
-        if(s.second == vin) {
-            return rank;
-        }
-    }
+    std::map<COutPoint, int>::const_iterator it = pTable->mapRanks.find(vin.prevout);
+    if(it == pTable->mapRanks.end()) return -1;
 
-    return -1;
+    return it->second;
 }
 
 std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<unsigned int, CMasternode> > vecMasternodeScores;
-    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        mn.Check();
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(!mn.IsEnabled()) {
-            continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
+    LOCK(cs);
 
-        vecMasternodeScores.push_back(make_pair(n2, mn));
-    }
+    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnlyMN());
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, true);
+    if(pTable == NULL) return vecMasternodeRanks;
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CMasternode)& s, vecMasternodeScores){
+    BOOST_FOREACH (const PAIRTYPE(unsigned int, CTxIn)& s, pTable->vecScores){
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        std::map<COutPoint, CMasternodePtr>::iterator it = mapMasternodes.find(s.second.prevout);
+        if(it != mapMasternodes.end())
+            vecMasternodeRanks.push_back(make_pair(rank, *(it->second)));
     }
 
     return vecMasternodeRanks;
@@ -535,35 +1092,13 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly());
+    LOCK(cs);
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecMasternodeScores){
-        rank++;
-        if(rank == nRank) {
-            return Find(s.second);
-        }
-    }
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, fOnlyActive);
+    if(pTable == NULL) return NULL;
+    if(nRank < 1 || nRank > (int)pTable->vecScores.size()) return NULL;
 
-    return NULL;
+    return Find(pTable->vecScores[nRank - 1].second);
 }
 
 void CMasternodeMan::ProcessMasternodeConnections()
@@ -658,128 +1193,32 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             return;
         }
 
-        std::string errorMessage = "";
-        if(!darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)){
-            LogPrintf("dsee - Got bad masternode address signature\n");
-            Misbehaving(pfrom->GetId(), 100);
-            return;
-        }
-
-        //search existing masternode list, this is where we update existing masternodes with new dsee broadcasts
+        // don't queue a signature check for a known entry that ProcessDsee would leave alone anyway
         CMasternode* pmn = this->Find(vin);
-        // if we are a masternode but with undefined vin and this dsee is ours (matches our Masternode privkey) then just skip this part
-        if(pmn != NULL && !(fMasterNode && activeMasternode.vin == CTxIn() && pubkey2 == activeMasternode.pubKeyMasternode))
-        {
-            // count == -1 when it's a new entry
-            //   e.g. We don't want the entry relayed/time updated when we're syncing the list
-            // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
-            //   after that they just need to match
-            if(count == -1 && pmn->pubkey == pubkey && !pmn->UpdatedWithin(MASTERNODE_MIN_DSEE_SECONDS)){
-                pmn->UpdateLastSeen();
-
-                if(pmn->sigTime < sigTime){ //take the newest entry
-                    LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
-                    pmn->pubkey2 = pubkey2;
-                    pmn->sigTime = sigTime;
-                    pmn->sig = vchSig;
-                    pmn->protocolVersion = protocolVersion;
-                    pmn->addr = addr;
-                    pmn->donationAddress = donationAddress;
-                    pmn->donationPercentage = donationPercentage;
-                    pmn->Check();
-                    if(pmn->IsEnabled())
-                        mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
-                }
-            }
-
+        if(pmn != NULL && !(fMasterNode && activeMasternode.vin == CTxIn() && pubkey2 == activeMasternode.pubKeyMasternode) &&
+            !(count == -1 && pmn->pubkey == pubkey && !pmn->UpdatedWithin(MASTERNODE_MIN_DSEE_SECONDS))) {
             return;
         }
 
-        // make sure the vout that was signed is related to the transaction that spawned the masternode
-        //  - this is expensive, so it's only done once per masternode
-        if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
-            LogPrintf("dsee - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 100);
-            return;
-        }
-
-        LogPrint("masternode", "dsee - Got NEW masternode entry %s\n", addr.ToString().c_str());
-
-        // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
-
-        CValidationState state;
-        CTransaction tx = CTransaction();
-        CTxOut vout = CTxOut((MasternodeCollateral(pindexBest->nHeight) - 1)*COIN, darkSendPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-        bool fAcceptable = false;
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if(!lockMain) return;
-            fAcceptable = AcceptableInputs(mempool, tx, false, NULL);
-        }
-        if(fAcceptable){
-            LogPrint("masternode", "dsee - Accepted masternode entry %i %i\n", count, current);
-
-            if(GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS){
-                LogPrintf("dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
-                Misbehaving(pfrom->GetId(), 20);
-                return;
-            }
-
-            // verify that sig time is legit in past
-            // should be at least not earlier than block when 5,000 Arion tx got MASTERNODE_MIN_CONFIRMATIONS
-            uint256 hashBlock = 0;
-            GetTransaction(vin.prevout.hash, tx, hashBlock);
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-           if (mi != mapBlockIndex.end() && (*mi).second)
-            {
-                CBlockIndex* pMNIndex = (*mi).second; // block for 5,000 Arion tx -> 1 confirmation
-                CBlockIndex* pConfIndex = FindBlockByHeight((pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1)); // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-                if(pConfIndex->GetBlockTime() > sigTime)
-                {
-                    LogPrintf("dsee - Bad sigTime %d for masternode %20s %105s (%i conf block is at %d)\n",
-                              sigTime, addr.ToString(), vin.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
-                    return;
-                }
-            }
-
-
-            // use this as a peer
-            addrman.Add(CAddress(addr), pfrom->addr, 2*60*60);
-
-            //doesn't support multisig addresses
-            if(donationAddress.IsPayToScriptHash()){
-                donationAddress = CScript();
-                donationPercentage = 0;
-            }
-
-            // add our masternode
-            CMasternode mn(addr, vin, pubkey, vchSig, sigTime, pubkey2, protocolVersion, donationAddress, donationPercentage);
-            mn.UpdateLastSeen(lastUpdated);
-            this->Add(mn);
-
-            // if it matches our masternodeprivkey, then we've been remotely activated
-            if(pubkey2 == activeMasternode.pubKeyMasternode && protocolVersion == PROTOCOL_VERSION){
-                activeMasternode.EnableHotColdMasterNode(vin, addr);
-            }
-
-            if(count == -1 && !isLocal)
-                mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
-
-        } else {
-            LogPrintf("dsee - Rejected masternode entry %s\n", addr.ToString().c_str());
-
-            int nDoS = 0;
-            if (state.IsInvalid(nDoS))
-            {
-                LogPrintf("dsee - %s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
-                    pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str());
-                if (nDoS > 0)
-                    Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
+        // the rest happens in ProcessDsee once the signature is checked
+        CMasternodeDsee dsee;
+        dsee.vin = vin;
+        dsee.addr = addr;
+        dsee.pubkey = pubkey;
+        dsee.pubkey2 = pubkey2;
+        dsee.vchSig = vchSig;
+        dsee.sigTime = sigTime;
+        dsee.count = count;
+        dsee.current = current;
+        dsee.lastUpdated = lastUpdated;
+        dsee.protocolVersion = protocolVersion;
+        dsee.donationAddress = donationAddress;
+        dsee.donationPercentage = donationPercentage;
+        dsee.isLocal = isLocal;
+        dsee.nodeFrom = pfrom->GetId();
+        dsee.addrFrom = pfrom->addr;
+        dsee.strSubVerFrom = pfrom->cleanSubVer;
+        messageVerifier.VerifyAsync(pubkey, vchSig, strMessage, boost::bind(&CMasternodeMan::ProcessDsee, this, dsee, _1), pfrom->GetId());
     }
 
     else if (strCommand == "dseep") { //DarkSend Election Entry Ping
@@ -812,27 +1251,9 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             {
                 std::string strMessage = pmn->addr.ToString() + boost::lexical_cast<std::string>(sigTime) + boost::lexical_cast<std::string>(stop);
 
-                std::string errorMessage = "";
-                if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchSig, strMessage, errorMessage))
-                {
-                    LogPrintf("dseep - Got bad masternode address signature %s \n", vin.ToString().c_str());
-                    //Misbehaving(pfrom->GetId(), 100);
-                    return;
-                }
-
-                pmn->lastDseep = sigTime;
-
-                if(!pmn->UpdatedWithin(MASTERNODE_MIN_DSEEP_SECONDS))
-                {
-                    if(stop) pmn->Disable();
-                    else
-                    {
-                        pmn->UpdateLastSeen();
-                        pmn->Check();
-                        if(!pmn->IsEnabled()) return;
-                    }
-                    mnodeman.RelayMasternodeEntryPing(vin, vchSig, sigTime, stop);
-                }
+                // applied in ProcessDseep once the signature is checked
+                messageVerifier.VerifyAsync(pmn->pubkey2, vchSig, strMessage,
+                    boost::bind(&CMasternodeMan::ProcessDseep, this, vin, vchSig, sigTime, stop, _1), pfrom->GetId());
             }
             return;
         }
@@ -915,7 +1336,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         int count = this->size();
         int i = 0;
 
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        BOOST_FOREACH(CMasternodePtr& pmn, vMasternodes) {
+            CMasternode& mn = *pmn;
 
             if(mn.addr.IsRFC1918()) continue; //local network
 
@@ -938,9 +1360,192 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 }
 
+void CMasternodeMan::ProcessDsee(const CMasternodeDsee& dsee, bool fSigValid)
+{
+    LOCK(cs_process_message);
+
+    CTxIn vin = dsee.vin;
+    CService addr = dsee.addr;
+    CPubKey pubkey = dsee.pubkey;
+    CPubKey pubkey2 = dsee.pubkey2;
+    vector<unsigned char> vchSig = dsee.vchSig;
+    int64_t sigTime = dsee.sigTime;
+    int count = dsee.count;
+    int current = dsee.current;
+    int64_t lastUpdated = dsee.lastUpdated;
+    int protocolVersion = dsee.protocolVersion;
+    CScript donationAddress = dsee.donationAddress;
+    int donationPercentage = dsee.donationPercentage;
+    bool isLocal = dsee.isLocal;
+
+    if(!fSigValid){
+        LogPrintf("dsee - Got bad masternode address signature\n");
+        Misbehaving(dsee.nodeFrom, 100);
+        return;
+    }
+
+    //search existing masternode list, this is where we update existing masternodes with new dsee broadcasts
+    CMasternode* pmn = this->Find(vin);
+    // if we are a masternode but with undefined vin and this dsee is ours (matches our Masternode privkey) then just skip this part
+    if(pmn != NULL && !(fMasterNode && activeMasternode.vin == CTxIn() && pubkey2 == activeMasternode.pubKeyMasternode))
+    {
+        // count == -1 when it's a new entry
+        //   e.g. We don't want the entry relayed/time updated when we're syncing the list
+        // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
+        //   after that they just need to match
+        if(count == -1 && pmn->pubkey == pubkey && !pmn->UpdatedWithin(MASTERNODE_MIN_DSEE_SECONDS)){
+            pmn->UpdateLastSeen();
+
+            if(pmn->sigTime < sigTime){ //take the newest entry
+                LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
+                UnindexMasternode(*pmn);
+                pmn->pubkey2 = pubkey2;
+                pmn->sigTime = sigTime;
+                pmn->sig = vchSig;
+                pmn->protocolVersion = protocolVersion;
+                pmn->addr = addr;
+                pmn->donationAddress = donationAddress;
+                pmn->donationPercentage = donationPercentage;
+                IndexMasternode(*pmn);
+                pmn->Check();
+                MarkListChanged();
+                if(pmn->IsEnabled())
+                    mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
+            }
+        }
+
+        return;
+    }
+
+    // make sure the vout that was signed is related to the transaction that spawned the masternode
+    //  - this is expensive, so it's only done once per masternode
+    if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
+        LogPrintf("dsee - Got mismatched pubkey and vin\n");
+        Misbehaving(dsee.nodeFrom, 100);
+        return;
+    }
+
+    LogPrint("masternode", "dsee - Got NEW masternode entry %s\n", addr.ToString().c_str());
+
+    // make sure it's still unspent
+    //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
+
+    CValidationState state;
+    CTransaction tx = CTransaction();
+    CTxOut vout = CTxOut((MasternodeCollateral(pindexBest->nHeight) - 1)*COIN, darkSendPool.collateralPubKey);
+    tx.vin.push_back(vin);
+    tx.vout.push_back(vout);
+    bool fAcceptable = false;
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if(!lockMain) return;
+        fAcceptable = AcceptableInputs(mempool, tx, false, NULL);
+    }
+    if(fAcceptable){
+        LogPrint("masternode", "dsee - Accepted masternode entry %i %i\n", count, current);
+
+        if(GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS){
+            LogPrintf("dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
+            Misbehaving(dsee.nodeFrom, 20);
+            return;
+        }
+
+        // verify that sig time is legit in past
+        // should be at least not earlier than block when 5,000 Arion tx got MASTERNODE_MIN_CONFIRMATIONS
+        uint256 hashBlock = 0;
+        GetTransaction(vin.prevout.hash, tx, hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+       if (mi != mapBlockIndex.end() && (*mi).second)
+        {
+            CBlockIndex* pMNIndex = (*mi).second; // block for 5,000 Arion tx -> 1 confirmation
+            CBlockIndex* pConfIndex = FindBlockByHeight((pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1)); // block where tx got MASTERNODE_MIN_CONFIRMATIONS
+            if(pConfIndex->GetBlockTime() > sigTime)
+            {
+                LogPrintf("dsee - Bad sigTime %d for masternode %20s %105s (%i conf block is at %d)\n",
+                          sigTime, addr.ToString(), vin.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
+                return;
+            }
+        }
+
+
+        // use this as a peer
+        addrman.Add(CAddress(addr), dsee.addrFrom, 2*60*60);
+
+        //doesn't support multisig addresses
+        if(donationAddress.IsPayToScriptHash()){
+            donationAddress = CScript();
+            donationPercentage = 0;
+        }
+
+        // add our masternode
+        CMasternode mn(addr, vin, pubkey, vchSig, sigTime, pubkey2, protocolVersion, donationAddress, donationPercentage);
+        mn.UpdateLastSeen(lastUpdated);
+        this->Add(mn);
+
+        // if it matches our masternodeprivkey, then we've been remotely activated
+        if(pubkey2 == activeMasternode.pubKeyMasternode && protocolVersion == PROTOCOL_VERSION){
+            activeMasternode.EnableHotColdMasterNode(vin, addr);
+        }
+
+        if(count == -1 && !isLocal)
+            mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
+
+    } else {
+        LogPrintf("dsee - Rejected masternode entry %s\n", addr.ToString().c_str());
+
+        int nDoS = 0;
+        if (state.IsInvalid(nDoS))
+        {
+            LogPrintf("dsee - %s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
+                dsee.addrFrom.ToString().c_str(), dsee.strSubVerFrom.c_str());
+            if (nDoS > 0)
+                Misbehaving(dsee.nodeFrom, nDoS);
+        }
+    }
+}
+
+void CMasternodeMan::ProcessDseep(const CTxIn& vin, const std::vector<unsigned char>& vchSig, int64_t sigTime, bool stop, bool fSigValid)
+{
+    LOCK(cs_process_message);
+
+    CMasternode* pmn = this->Find(vin);
+    if(pmn == NULL) return;
+
+    // a newer ping may have been applied while this one was being checked
+    if(pmn->lastDseep >= sigTime) return;
+
+    if(!fSigValid)
+    {
+        LogPrintf("dseep - Got bad masternode address signature %s \n", vin.ToString().c_str());
+        //Misbehaving(pfrom->GetId(), 100);
+        return;
+    }
+
+    pmn->lastDseep = sigTime;
+
+    if(!pmn->UpdatedWithin(MASTERNODE_MIN_DSEEP_SECONDS))
+    {
+        int nPrevState = pmn->activeState;
+        if(stop)
+        {
+            pmn->Disable();
+            MarkListChanged();
+        }
+        else
+        {
+            pmn->UpdateLastSeen();
+            pmn->Check();
+            if(pmn->activeState != nPrevState) MarkListChanged();
+            if(!pmn->IsEnabled()) return;
+        }
+        mnodeman.RelayMasternodeEntryPing(vin, vchSig, sigTime, stop);
+    }
+}
+
 void CMasternodeMan::RelayMasternodeEntry(const CTxIn vin, const CService addr, const std::vector<unsigned char> vchSig, const int64_t nNow, const CPubKey pubkey, const CPubKey pubkey2, const int count, const int current, const int64_t lastUpdated, const int protocolVersion, CScript donationAddress, int donationPercentage)
 {
     LOCK(cs_vNodes);
+    CSchedulerLockTimer lockTimer;
     BOOST_FOREACH(CNode* pnode, vNodes)
         pnode->PushMessage("dsee", vin, addr, vchSig, nNow, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
 }
@@ -948,6 +1553,7 @@ void CMasternodeMan::RelayMasternodeEntry(const CTxIn vin, const CService addr,
 void CMasternodeMan::RelayMasternodeEntryPing(const CTxIn vin, const std::vector<unsigned char> vchSig, const int64_t nNow, const bool stop)
 {
     LOCK(cs_vNodes);
+    CSchedulerLockTimer lockTimer;
     BOOST_FOREACH(CNode* pnode, vNodes)
         pnode->PushMessage("dseep", vin, vchSig, nNow, stop);
 }
@@ -956,13 +1562,12 @@ void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    vector<CMasternode>::iterator it = vMasternodes.begin();
-    while(it != vMasternodes.end()){
-        if((*it).vin == vin){
-            LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
-            vMasternodes.erase(it);
-            break;
-        }
+    std::map<COutPoint, CMasternodePtr>::iterator it = mapMasternodes.find(vin.prevout);
+    if(it != mapMasternodes.end()){
+        LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).second->addr.ToString().c_str(), size() - 1);
+        collateralWatcher.Unwatch(vin.prevout);
+        EraseMasternode(vin.prevout);
+        MarkListChanged();
     }
 }
 
@@ -970,7 +1575,7 @@ std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
 
-    info << "masternodes: " << (int)vMasternodes.size() <<
+    info << "masternodes: " << (int)mapMasternodes.size() <<
             ", peers who asked us for masternode list: " << (int)mAskedUsForMasternodeList.size() <<
             ", peers we asked for masternode list: " << (int)mWeAskedForMasternodeList.size() <<
             ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size() <<
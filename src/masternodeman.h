@@ -17,23 +17,41 @@
 #include "main.h"
 #include "masternode.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_RANK_CACHE_SIZE            16
+#define MASTERNODES_JOURNAL_MAX_RECORDS        96 // a day of dumps before mncache.dat is rewritten
 
 using namespace std;
 
 class CMasternodeMan;
 
+typedef boost::shared_ptr<CMasternode> CMasternodePtr;
+
 extern CMasternodeMan mnodeman;
 
 void DumpMasternodes();
+// Read mncache.dat in the background, its list is added to mnodeman once the checksum is verified
+void LoadMasternodes(boost::thread_group& threadGroup);
 
-/** Access to the MN database (mncache.dat) */
+/** Access to the MN database (mncache.dat snapshot plus the mncache.log journal of changes since) */
 class CMasternodeDB
 {
 private:
     boost::filesystem::path pathMN;
+    boost::filesystem::path pathJournal;
     std::string strMagicMessage;
+    std::string strJournalMagicMessage;
+
+    // Hash every entry without its last-seen times, which every ping changes, and collect those times separately
+    static void GetEntryHashes(const CMasternodeMan& mnodeman, std::map<COutPoint, uint256>& mapHashesRet,
+                               std::map<COutPoint, std::pair<int64_t, int64_t> >& mapSeenRet);
+    // Apply mncache.log on top of a freshly read snapshot, returns the number of records replayed
+    int ReadJournal(CMasternodeMan& mnodemanToLoad, const uint256& hashSnapshot);
 public:
     enum ReadResult {
         Ok,
@@ -45,9 +63,83 @@ public:
         IncorrectFormat
     };
 
+private:
+    // Read mncache.dat into memory, without checking the checksum
+    ReadResult ReadSnapshot(std::vector<unsigned char>& vchData, uint256& hashIn);
+
+public:
     CMasternodeDB();
-    bool Write(const CMasternodeMan &mnodemanToSave);
-    ReadResult Read(CMasternodeMan& mnodemanToLoad);
+    // Write a full snapshot and start a new journal
+    bool Write(CMasternodeMan &mnodemanToSave);
+    // Append the changes since the last dump to the journal, false if a full Write is due instead
+    bool WriteJournal(CMasternodeMan &mnodemanToSave);
+    // The checksum is verified before anything is deserialized. With fReplayJournal mncache.log is applied too and
+    // what is on disk is remembered, so later dumps only journal the changes
+    ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fReplayJournal = true);
+    // The snapshot on disk is the one last read or written by mnodeman
+    bool HasSnapshot(const CMasternodeMan& mnodeman);
+};
+
+/** Last-seen times of an entry that changed nothing else, as ages relative to its mncache.log record */
+class CMasternodeSeen
+{
+public:
+    COutPoint outpoint;
+    uint64_t nSeenAge;
+    uint64_t nDseepAge;
+
+    CMasternodeSeen() : nSeenAge(0), nDseepAge(0) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(outpoint.hash);
+        READWRITE(VARINT(outpoint.n));
+        READWRITE(VARINT(nSeenAge));
+        READWRITE(VARINT(nDseepAge));
+    )
+};
+
+/** A dsee broadcast waiting for its signature check */
+class CMasternodeDsee
+{
+public:
+    CTxIn vin;
+    CService addr;
+    CPubKey pubkey;
+    CPubKey pubkey2;
+    std::vector<unsigned char> vchSig;
+    int64_t sigTime;
+    int count;
+    int current;
+    int64_t lastUpdated;
+    int protocolVersion;
+    CScript donationAddress;
+    int donationPercentage;
+    bool isLocal;
+    // the peer it came from
+    NodeId nodeFrom;
+    CAddress addrFrom;
+    std::string strSubVerFrom;
+};
+
+/** Masternodes ordered by score for one (block height, protocol) pair */
+class CMasternodeRankTable
+{
+public:
+    // block hash the scores were calculated against
+    uint256 hashBlock;
+    // list version the table was built from
+    unsigned int nListVersion;
+    // earliest time a ranked masternode expires, the table is rebuilt after it
+    int64_t nExpireTime;
+    // LRU stamp
+    unsigned int nLastUsed;
+    // (score, vin) ordered best first, rank is index + 1
+    std::vector<pair<unsigned int, CTxIn> > vecScores;
+    // collateral outpoint -> rank
+    std::map<COutPoint, int> mapRanks;
+
+    CMasternodeRankTable() : hashBlock(0), nListVersion(0), nExpireTime(0), nLastUsed(0) {}
 };
 
 class CMasternodeMan
@@ -56,8 +148,13 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    // map to hold all MNs
-    std::vector<CMasternode> vMasternodes;
+    // map to hold all MNs, keyed by collateral outpoint
+    std::map<COutPoint, CMasternodePtr> mapMasternodes;
+    // the same MNs in the order they were added; the list is walked in this order, payee tie-breaks depend on it
+    std::vector<CMasternodePtr> vMasternodes;
+    // secondary indexes into mapMasternodes
+    std::multimap<CPubKey, COutPoint> mapMasternodesByPubKey;
+    std::multimap<CService, COutPoint> mapMasternodesByAddr;
     // who's asked for the masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the masternode list and the last time
@@ -65,6 +162,37 @@ private:
     // which masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // bumped whenever an entry is added, removed or changes state, or the collateral watcher saw a collateral touched
+    unsigned int nListVersion;
+    // collateral watcher version nListVersion last caught up with
+    unsigned int nCollateralVersion;
+    // rank tables keyed by (block height, min protocol, only active)
+    std::map<boost::tuple<int64_t, int, bool>, CMasternodeRankTable> mapRankCache;
+    unsigned int nRankCacheClock;
+
+    // what is on disk: checksum of mncache.dat (0 if none yet), stored entry hashes, last-seen times and journal length
+    uint256 hashPersistedSnapshot;
+    std::map<COutPoint, uint256> mapPersistedHashes;
+    std::map<COutPoint, std::pair<int64_t, int64_t> > mapPersistedSeen;
+    int nJournalRecords;
+    // mncache.dat is being read in the background and must not be written meanwhile
+    bool fLoading;
+
+    friend class CMasternodeDB;
+
+    // Maintain the secondary indexes for an entry
+    void IndexMasternode(const CMasternode& mn);
+    void UnindexMasternode(const CMasternode& mn);
+
+    // Add / drop an entry in the list and its indexes. The list used to be a vector of entries, copying an
+    // entry restarts its payment age and the vector copied entries as it grew or shifted; fCopied keeps
+    // doing that, without it the stored payment ages are kept (loading from disk)
+    void InsertMasternode(const CMasternode& mn, bool fCopied = true);
+    void EraseMasternode(const COutPoint& outpoint, bool fCopied = true);
+
+    // Find or build the rank table for the given block, NULL if the block is unknown
+    const CMasternodeRankTable* GetRankTable(int64_t nBlockHeight, int minProtocol, bool fOnlyActive);
+
 public:
     // keep track of dsq count to prevent masternodes from gaming darksend queue
     int64_t nDsqCount;
@@ -78,7 +206,13 @@ public:
                 LOCK(cs);
                 unsigned char nVersion = 0;
                 READWRITE(nVersion);
-                READWRITE(vMasternodes);
+                // stored as a plain vector so the file format is unchanged
+                std::vector<CMasternode> vEntries;
+                if (!fRead)
+                    GetMasternodeVector().swap(vEntries);
+                READWRITE(vEntries);
+                if (fRead)
+                    const_cast<CMasternodeMan*>(this)->SetMasternodeVector(vEntries);
                 READWRITE(mAskedUsForMasternodeList);
                 READWRITE(mWeAskedForMasternodeList);
                 READWRITE(mWeAskedForMasternodeListEntry);
@@ -104,6 +238,15 @@ public:
     // Clear masternode vector
     void Clear();
 
+    // Loading mncache.dat: mark it as started, then hand over what was read (an empty list if that failed).
+    // Entries heard from the network meanwhile are newer and are kept, after the loaded ones
+    void SetLoading();
+    void AddLoaded(CMasternodeMan& mnodemanLoaded);
+    bool IsLoading() const;
+
+    // Drop cached rank tables, called when an entry is added, removed or changes state
+    void MarkListChanged();
+
     int CountEnabled(int protocolVersion = -1);
 
     int CountMasternodesAboveProtocol(int protocolVersion);
@@ -113,6 +256,7 @@ public:
     // Find an entry
     CMasternode* Find(const CTxIn& vin);
     CMasternode* Find(const CPubKey& pubKeyMasternode);
+    CMasternode* Find(const CService& addr);
 
     //Find an entry thta do not match every entry provided vector
     CMasternode* FindOldestNotInVec(const std::vector<CTxIn> &vVins, int nMinimumAge);
@@ -126,7 +270,12 @@ public:
     // Get the current winner for this block
     CMasternode* GetCurrentMasterNode(int mod=1, int64_t nBlockHeight=0, int minProtocol=0);
 
-    std::vector<CMasternode> GetFullMasternodeVector() { Check(); return vMasternodes; }
+    // Copies of every entry after checking them, dsee / dseep keep updating the live ones under cs
+    std::vector<CMasternode> GetFullMasternodeVector();
+
+    // Copies of every entry / replace all entries, used for serialization
+    std::vector<CMasternode> GetMasternodeVector() const;
+    void SetMasternodeVector(const std::vector<CMasternode>& vMasternodesIn);
 
     std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol=0);
     int GetMasternodeRank(const CTxIn &vin, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
@@ -136,8 +285,12 @@ public:
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
+    // Continue dsee / dseep processing once the message signature is checked
+    void ProcessDsee(const CMasternodeDsee& dsee, bool fSigValid);
+    void ProcessDseep(const CTxIn& vin, const std::vector<unsigned char>& vchSig, int64_t sigTime, bool stop, bool fSigValid);
+
     // Return the number of (unique) masternodes
-    int size() { return vMasternodes.size(); }
+    int size() { LOCK(cs); return mapMasternodes.size(); }
 
     std::string ToString() const;
 
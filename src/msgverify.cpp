@@ -0,0 +1,264 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgverify.h"
+#include "hash.h"
+#include "main.h"
+#include "ui_interface.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+CMessageVerifier messageVerifier;
+
+CMessageVerifier::CMessageVerifier()
+{
+    nWorkers = 0;
+    nVerified = 0;
+    nCacheHits = 0;
+    nJoined = 0;
+    nOverflow = 0;
+}
+
+uint256 CMessageVerifier::GetMessageHash(const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+    return ss.GetHash();
+}
+
+uint256 CMessageVerifier::GetCacheKey(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << hashMessage << vchSig << keyID;
+    return ss.GetHash();
+}
+
+bool CMessageVerifier::VerifyCompact(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID, std::string& errorMessage)
+{
+    CPubKey pubkey2;
+    if (!pubkey2.RecoverCompact(hashMessage, vchSig)) {
+        errorMessage = _("Error recovering public key.");
+        return false;
+    }
+
+    if (fDebug && (pubkey2.GetID() != keyID))
+        LogPrintf("CMessageVerifier::VerifyCompact -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), keyID.ToString());
+
+    return (pubkey2.GetID() == keyID);
+}
+
+bool CMessageVerifier::GetCached(const uint256& hashKey, bool& fValid)
+{
+    LOCK(cs_cache);
+
+    std::map<uint256, bool>::iterator it = mapResults.find(hashKey);
+    if (it == mapResults.end())
+        return false;
+
+    fValid = it->second;
+    nCacheHits++;
+    return true;
+}
+
+void CMessageVerifier::SetCached(const uint256& hashKey, bool fValid)
+{
+    LOCK(cs_cache);
+
+    nVerified++;
+
+    // DoS prevention: evict a random entry, same as the script signature cache
+    while (mapResults.size() >= MESSAGE_VERIFY_CACHE_SIZE)
+    {
+        std::map<uint256, bool>::iterator it = mapResults.lower_bound(GetRandHash());
+        if (it == mapResults.end())
+            it = mapResults.begin();
+        mapResults.erase(it);
+    }
+
+    mapResults[hashKey] = fValid;
+}
+
+bool CMessageVerifier::Verify(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage, std::string& errorMessage)
+{
+    uint256 hashMessage = GetMessageHash(strMessage);
+    CKeyID keyID = pubkey.GetID();
+    uint256 hashKey = GetCacheKey(hashMessage, vchSig, keyID);
+
+    bool fValid;
+    if (GetCached(hashKey, fValid))
+        return fValid;
+
+    fValid = VerifyCompact(hashMessage, vchSig, keyID, errorMessage);
+    SetCached(hashKey, fValid);
+
+    return fValid;
+}
+
+void CMessageVerifier::VerifyAsync(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage, const MessageVerifyCallback& callback, NodeId nodeFrom)
+{
+    uint256 hashMessage = GetMessageHash(strMessage);
+    CKeyID keyID = pubkey.GetID();
+    uint256 hashKey = GetCacheKey(hashMessage, vchSig, keyID);
+
+    bool fValid;
+    if (GetCached(hashKey, fValid))
+    {
+        callback(fValid);
+        return;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        std::map<NodeId, int>::iterator mi = mapNodePending.find(nodeFrom);
+        bool fFull = mapJobs.size() >= MESSAGE_VERIFY_MAX_QUEUE || (mi != mapNodePending.end() && mi->second >= MESSAGE_VERIFY_MAX_PER_NODE);
+        if (nWorkers > 0 && !fFull)
+        {
+            if (nodeFrom >= 0)
+                mapNodePending[nodeFrom]++;
+
+            std::map<uint256, CVerifyJob>::iterator it = mapJobs.find(hashKey);
+            if (it != mapJobs.end())
+            {
+                // the same message from another peer, wait for the first check
+                it->second.vCallbacks.push_back(callback);
+                it->second.vNodes.push_back(nodeFrom);
+                LOCK(cs_cache);
+                nJoined++;
+                return;
+            }
+
+            CVerifyJob& job = mapJobs[hashKey];
+            job.hashMessage = hashMessage;
+            job.keyID = keyID;
+            job.vchSig = vchSig;
+            job.vCallbacks.push_back(callback);
+            job.vNodes.push_back(nodeFrom);
+            queueWork.push_back(hashKey);
+            condWork.notify_one();
+            return;
+        }
+
+        if (fFull)
+        {
+            LOCK(cs_cache);
+            nOverflow++;
+        }
+    }
+
+    std::string errorMessage;
+    fValid = VerifyCompact(hashMessage, vchSig, keyID, errorMessage);
+    SetCached(hashKey, fValid);
+    callback(fValid);
+}
+
+void CMessageVerifier::ProcessCompleted()
+{
+    std::vector<CVerifyJob> vJobs;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vCompleted.empty())
+            return;
+        vJobs.swap(vCompleted);
+    }
+
+    BOOST_FOREACH(const CVerifyJob& job, vJobs)
+        BOOST_FOREACH(const MessageVerifyCallback& callback, job.vCallbacks)
+            callback(job.fValid);
+}
+
+void CMessageVerifier::ThreadVerify()
+{
+    std::vector<uint256> vKeys;
+    std::vector<CVerifyJob> vBatch;
+
+    while (true)
+    {
+        vKeys.clear();
+        vBatch.clear();
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queueWork.empty())
+                condWork.wait(lock);
+
+            while (!queueWork.empty() && vKeys.size() < MESSAGE_VERIFY_BATCH_SIZE)
+            {
+                CVerifyJob& job = mapJobs[queueWork.front()];
+                CVerifyJob jobCopy;
+                jobCopy.hashMessage = job.hashMessage;
+                jobCopy.keyID = job.keyID;
+                jobCopy.vchSig = job.vchSig;
+                vKeys.push_back(queueWork.front());
+                vBatch.push_back(jobCopy);
+                queueWork.pop_front();
+            }
+        }
+
+        std::string errorMessage;
+        for (unsigned int i = 0; i < vBatch.size(); i++)
+        {
+            vBatch[i].fValid = VerifyCompact(vBatch[i].hashMessage, vBatch[i].vchSig, vBatch[i].keyID, errorMessage);
+            SetCached(vKeys[i], vBatch[i].fValid);
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            for (unsigned int i = 0; i < vKeys.size(); i++)
+            {
+                std::map<uint256, CVerifyJob>::iterator it = mapJobs.find(vKeys[i]);
+                if (it == mapJobs.end())
+                    continue;
+                it->second.fValid = vBatch[i].fValid;
+                BOOST_FOREACH(NodeId node, it->second.vNodes)
+                {
+                    std::map<NodeId, int>::iterator mi = mapNodePending.find(node);
+                    if (mi != mapNodePending.end() && --mi->second <= 0)
+                        mapNodePending.erase(mi);
+                }
+                vCompleted.push_back(it->second);
+                mapJobs.erase(it);
+            }
+        }
+
+        boost::this_thread::interruption_point();
+    }
+}
+
+void CMessageVerifier::Start(boost::thread_group& threadGroup, int nThreads)
+{
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    if (nThreads <= 0)
+        nThreads = 1;
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nWorkers = nThreads;
+    }
+
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msgverify",
+            boost::function<void()>(boost::bind(&CMessageVerifier::ThreadVerify, this))));
+
+    LogPrintf("Message signature verification using %d threads\n", nThreads);
+}
+
+std::string CMessageVerifier::ToString() const
+{
+    LOCK(cs_cache);
+
+    std::ostringstream info;
+
+    info << "verified: " << nVerified <<
+            ", cache hits: " << nCacheHits <<
+            ", joined in-flight: " << nJoined <<
+            ", checked inline when full: " << nOverflow <<
+            ", cached results: " << (int)mapResults.size();
+
+    return info.str();
+}
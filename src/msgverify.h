@@ -0,0 +1,110 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MSGVERIFY_H
+#define MSGVERIFY_H
+
+#include "key.h"
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#define MESSAGE_VERIFY_CACHE_SIZE              50000
+#define MESSAGE_VERIFY_BATCH_SIZE              64
+#define MESSAGE_VERIFY_MAX_QUEUE               10000 // queued and running checks
+#define MESSAGE_VERIFY_MAX_PER_NODE            500   // queued checks for messages from one peer
+
+class CMessageVerifier;
+
+extern CMessageVerifier messageVerifier;
+
+/** Called with the outcome of an asynchronous message signature check */
+typedef boost::function<void (bool fValid)> MessageVerifyCallback;
+
+//
+// Verifies the compact signatures on masternode, spork and InstantX messages.
+//
+// Results are cached by (message hash, signature, key id), so a message relayed to us by every
+// peer is only checked once. VerifyAsync queues the check for a pool of worker threads which
+// take queued jobs in batches; a job already queued or running picks up further callbacks
+// instead of being verified again. Callbacks are run from ProcessCompleted() on the message
+// handler thread, so they see the same locking context as the message handlers themselves.
+//
+// The queue is bounded in total and per peer. Once either limit is reached, further messages
+// are checked right away on the calling thread, so a peer flooding signed messages is slowed
+// down to the speed of its own message handling and punished without delay.
+//
+class CMessageVerifier
+{
+private:
+    class CVerifyJob
+    {
+    public:
+        uint256 hashMessage;
+        CKeyID keyID;
+        std::vector<unsigned char> vchSig;
+        std::vector<MessageVerifyCallback> vCallbacks;
+        std::vector<NodeId> vNodes;     // peer each callback is for, -1 if none
+        bool fValid;
+
+        CVerifyJob() : fValid(false) {}
+    };
+
+    // queued, running and finished jobs
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    std::map<uint256, CVerifyJob> mapJobs;
+    std::deque<uint256> queueWork;
+    std::vector<CVerifyJob> vCompleted;
+    std::map<NodeId, int> mapNodePending;
+    int nWorkers;
+
+    // (message hash, signature, key id) -> valid
+    mutable CCriticalSection cs_cache;
+    std::map<uint256, bool> mapResults;
+
+    // statistics
+    uint64_t nVerified;
+    uint64_t nCacheHits;
+    uint64_t nJoined;
+    uint64_t nOverflow;
+
+    static uint256 GetCacheKey(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID);
+    static bool VerifyCompact(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID, std::string& errorMessage);
+
+    bool GetCached(const uint256& hashKey, bool& fValid);
+    void SetCached(const uint256& hashKey, bool fValid);
+
+    void ThreadVerify();
+
+public:
+    CMessageVerifier();
+
+    // Hash of a signed message as produced by CDarkSendSigner::SignMessage
+    static uint256 GetMessageHash(const std::string& strMessage);
+
+    // Verify on the calling thread, using and filling the cache
+    bool Verify(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage, std::string& errorMessage);
+
+    // Verify on a worker thread, callback runs from ProcessCompleted(). Without workers, on a cache hit
+    // or when the queue is full for nodeFrom, the check and the callback run immediately
+    void VerifyAsync(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage, const MessageVerifyCallback& callback, NodeId nodeFrom = -1);
+
+    // Deliver finished results to their callbacks
+    void ProcessCompleted();
+
+    // Start the worker threads, nThreads <= 0 means one per core
+    void Start(boost::thread_group& threadGroup, int nThreads);
+
+    std::string ToString() const;
+};
+
+#endif
@@ -0,0 +1,199 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcserver.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+//
+// Read-only REST interface for indexers and explorers. Blocks, transactions and headers go out in
+// their serialized form, as bytes or hex, without JSON and without touching the wallet:
+//
+//   GET /rest/block/<hash>.<bin|hex>
+//   GET /rest/tx/<txid>.<bin|hex>
+//   GET /rest/headers/<count>/<hash>.<bin|hex>   up to <count> headers of the best chain from <hash> on
+//
+
+// headers per /rest/headers request at most
+#define MAX_REST_HEADERS_RESULTS              2000
+
+enum RESTFormat
+{
+    RF_UNDEF,
+    RF_BINARY,
+    RF_HEX,
+};
+
+static int RESTError(int nStatus, const string& strMessage, string& strBody, string& strContentType)
+{
+    strBody = strMessage + "\r\n";
+    strContentType = "text/plain";
+    return nStatus;
+}
+
+// Split "<param>.<format>"
+static RESTFormat ParseDataFormat(const string& strReq, string& strParam)
+{
+    string::size_type nDot = strReq.rfind('.');
+    if (nDot == string::npos)
+        return RF_UNDEF;
+
+    strParam = strReq.substr(0, nDot);
+    string strFormat = strReq.substr(nDot + 1);
+    if (strFormat == "bin")
+        return RF_BINARY;
+    if (strFormat == "hex")
+        return RF_HEX;
+    return RF_UNDEF;
+}
+
+static bool ParseHash(const string& strHash, uint256& hash)
+{
+    if (strHash.size() != 64 || !IsHex(strHash))
+        return false;
+    hash.SetHex(strHash);
+    return true;
+}
+
+static int RESTReply(RESTFormat rf, string& strBody, string& strContentType)
+{
+    if (rf == RF_HEX)
+    {
+        strBody = HexStr(strBody.begin(), strBody.end()) + "\n";
+        strContentType = "text/plain";
+    }
+    else
+        strContentType = "application/octet-stream";
+    return HTTP_OK;
+}
+
+// The block as it is stored, without deserializing it
+static bool ReadRawBlockFromDisk(const CBlockIndex* pindex, string& strData)
+{
+    // the size is stored right in front of the block
+    if (pindex->nBlockPos < sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk() : bad block position");
+    CAutoFile filein = CAutoFile(OpenBlockFile(pindex->nFile, pindex->nBlockPos - sizeof(unsigned int), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadRawBlockFromDisk() : OpenBlockFile failed");
+
+    unsigned int nSize;
+    try {
+        filein >> nSize;
+    }
+    catch (std::exception &e) {
+        return error("%s() : I/O error", __PRETTY_FUNCTION__);
+    }
+    if (nSize > MAX_BLOCK_SIZE)
+        return error("ReadRawBlockFromDisk() : bad block size %u", nSize);
+
+    strData.resize(nSize);
+    if (nSize > 0 && fread(&strData[0], 1, nSize, filein) != nSize)
+        return error("ReadRawBlockFromDisk() : I/O error");
+    return true;
+}
+
+static int RESTBlock(const string& strReq, string& strBody, string& strContentType)
+{
+    string strHash;
+    RESTFormat rf = ParseDataFormat(strReq, strHash);
+    if (rf == RF_UNDEF)
+        return RESTError(HTTP_BAD_REQUEST, "Output format not found (available: bin, hex)", strBody, strContentType);
+    uint256 hash;
+    if (!ParseHash(strHash, hash))
+        return RESTError(HTTP_BAD_REQUEST, "Invalid hash: " + strHash, strBody, strContentType);
+
+    CBlockIndex* pindex = NULL;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end())
+            pindex = mi->second;
+    }
+    if (!pindex)
+        return RESTError(HTTP_NOT_FOUND, strHash + " not found", strBody, strContentType);
+
+    // block files are only appended to, so the block is read without cs_main
+    if (!ReadRawBlockFromDisk(pindex, strBody))
+        return RESTError(HTTP_NOT_FOUND, strHash + " not available", strBody, strContentType);
+
+    return RESTReply(rf, strBody, strContentType);
+}
+
+static int RESTTransaction(const string& strReq, string& strBody, string& strContentType)
+{
+    string strHash;
+    RESTFormat rf = ParseDataFormat(strReq, strHash);
+    if (rf == RF_UNDEF)
+        return RESTError(HTTP_BAD_REQUEST, "Output format not found (available: bin, hex)", strBody, strContentType);
+    uint256 hash;
+    if (!ParseHash(strHash, hash))
+        return RESTError(HTTP_BAD_REQUEST, "Invalid hash: " + strHash, strBody, strContentType);
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock))
+        return RESTError(HTTP_NOT_FOUND, strHash + " not found", strBody, strContentType);
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    strBody.assign(ssTx.begin(), ssTx.end());
+
+    return RESTReply(rf, strBody, strContentType);
+}
+
+static int RESTHeaders(const string& strCount, const string& strReq, string& strBody, string& strContentType)
+{
+    string strHash;
+    RESTFormat rf = ParseDataFormat(strReq, strHash);
+    if (rf == RF_UNDEF)
+        return RESTError(HTTP_BAD_REQUEST, "Output format not found (available: bin, hex)", strBody, strContentType);
+    uint256 hash;
+    if (!ParseHash(strHash, hash))
+        return RESTError(HTTP_BAD_REQUEST, "Invalid hash: " + strHash, strBody, strContentType);
+    int nCount = atoi(strCount);
+    if (nCount < 1 || nCount > MAX_REST_HEADERS_RESULTS)
+        return RESTError(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", strCount), strBody, strContentType);
+
+    // the headers are in the block index, nothing is read from disk
+    CDataStream ssHeaders(SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            return RESTError(HTTP_NOT_FOUND, strHash + " not found", strBody, strContentType);
+
+        int nHeaders = 0;
+        for (CBlockIndex* pindex = mi->second; pindex && nHeaders < nCount && pindex->IsInMainChain(); pindex = pindex->pnext)
+        {
+            ssHeaders << pindex->GetBlockHeader();
+            nHeaders++;
+        }
+    }
+    strBody.assign(ssHeaders.begin(), ssHeaders.end());
+
+    return RESTReply(rf, strBody, strContentType);
+}
+
+int HandleRESTRequest(const std::string& strMethod, const std::string& strURI, std::string& strBody, std::string& strContentType)
+{
+    if (strMethod != "GET")
+        return RESTError(HTTP_BAD_REQUEST, "Only GET is supported", strBody, strContentType);
+
+    vector<string> vPath;
+    boost::split(vPath, strURI.substr(strlen("/rest/")), boost::is_any_of("/"));
+
+    if (vPath.size() == 2 && vPath[0] == "block")
+        return RESTBlock(vPath[1], strBody, strContentType);
+    if (vPath.size() == 2 && vPath[0] == "tx")
+        return RESTTransaction(vPath[1], strBody, strContentType);
+    if (vPath.size() == 3 && vPath[0] == "headers")
+        return RESTHeaders(vPath[1], vPath[2], strBody, strContentType);
+
+    return RESTError(HTTP_NOT_FOUND, "Unknown REST request", strBody, strContentType);
+}
@@ -7,6 +7,7 @@
 #include "main.h"
 #include "kernel.h"
 #include "checkpoints.h"
+#include "txdb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -106,37 +107,45 @@ double GetPoSKernelPS()
     return result;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+// the transactions are written one by one, a block with all details is never held as a whole
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& writer)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    writer.BeginObject();
+    writer.WritePair("hash", block.GetHash().GetHex());
     int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (blockindex->IsInMainChain())
-        confirmations = nBestHeight - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
-    result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
-    result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
+    const CBlockIndex* pindexNext = NULL;
+    {
+        // the rest of the index entry doesn't change once it is added
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (blockindex->IsInMainChain())
+            confirmations = nBestHeight - blockindex->nHeight + 1;
+        pindexNext = blockindex->pnext;
+    }
+    writer.WritePair("confirmations", confirmations);
+    writer.WritePair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.WritePair("height", blockindex->nHeight);
+    writer.WritePair("version", block.nVersion);
+    writer.WritePair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.WritePair("mint", ValueFromAmount(blockindex->nMint));
+    writer.WritePair("time", (int64_t)block.GetBlockTime());
+    writer.WritePair("nonce", (uint64_t)block.nNonce);
+    writer.WritePair("bits", strprintf("%08x", block.nBits));
+    writer.WritePair("difficulty", GetDifficulty(blockindex));
+    writer.WritePair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0'));
+    writer.WritePair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0'));
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-
-    result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
-    result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
-    result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
-    result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
-    result.push_back(Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
-    Array txinfo;
+        writer.WritePair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    if (pindexNext)
+        writer.WritePair("nextblockhash", pindexNext->GetBlockHash().GetHex());
+
+    writer.WritePair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": ""));
+    writer.WritePair("proofhash", blockindex->hashProof.GetHex());
+    writer.WritePair("entropybit", (int)blockindex->GetStakeEntropyBit());
+    writer.WritePair("modifier", strprintf("%016x", blockindex->nStakeModifier));
+    writer.WritePair("modifierv2", blockindex->bnStakeModifierV2.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
     BOOST_FOREACH (const CTransaction& tx, block.vtx)
     {
         if (fPrintTransactionDetail)
@@ -146,18 +155,17 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
             entry.push_back(Pair("txid", tx.GetHash().GetHex()));
             TxToJSON(tx, 0, entry);
 
-            txinfo.push_back(entry);
+            writer.Write(entry);
         }
         else
-            txinfo.push_back(tx.GetHash().GetHex());
+            writer.Write(tx.GetHash().GetHex());
     }
-
-    result.push_back(Pair("tx", txinfo));
+    writer.EndArray();
 
     if (block.IsProofOfStake())
-        result.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+        writer.WritePair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
 
-    return result;
+    writer.EndObject();
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -167,7 +175,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    return GetChainTip().hash.GetHex();
 }
 
 Value getblockcount(const Array& params, bool fHelp)
@@ -177,7 +185,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainTip().nHeight;
 }
 
 
@@ -191,7 +199,10 @@ Value getdifficulty(const Array& params, bool fHelp)
     //Object obj;
     //obj.push_back(Pair("proof-of-work",        GetDifficulty()));
     //obj.push_back(Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(pindexBest, true))));
-    return GetDifficulty(GetLastBlockIndex(pindexBest, true));
+    CChainTip tip = GetChainTip();
+    if (!tip.pindex)
+        return 1.0;
+    return GetDifficulty(GetLastBlockIndex(tip.pindex, true));
 }
 
 
@@ -220,6 +231,8 @@ Value getblockhash(const Array& params, bool fHelp)
             "Returns hash of block in best-block-chain at <index>.");
 
     int nHeight = params[0].get_int();
+
+    LOCK(cs_main);
     if (nHeight < 0 || nHeight > nBestHeight)
         throw runtime_error("Block number out of range.");
 
@@ -227,7 +240,7 @@ Value getblockhash(const Array& params, bool fHelp)
     return pblockindex->phashBlock->GetHex();
 }
 
-Value getblock(const Array& params, bool fHelp)
+void getblock(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -238,17 +251,23 @@ Value getblock(const Array& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+    }
 
+    // block files are only appended to, so the block is read without cs_main
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
-Value getblockbynumber(const Array& params, bool fHelp)
+void getblockbynumber(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -257,20 +276,19 @@ Value getblockbynumber(const Array& params, bool fHelp)
             "Returns details of a block with given block-number.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
-        throw runtime_error("Block number out of range.");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > nBestHeight)
+            throw runtime_error("Block number out of range.");
+        pblockindex = FindBlockByHeight(nHeight);
+    }
 
-    pblockindex = mapBlockIndex[hash];
+    CBlock block;
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
 // ppcoin: get information of sync-checkpoint
@@ -292,3 +310,46 @@ Value getcheckpoint(const Array& params, bool fHelp)
 
     return result;
 }
+
+Value dbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "dbstats\n"
+            "Returns the settings of the block index database and what LevelDB did since it was opened.");
+
+    CTxDB txdb("r");
+    const CTxDBProfile& profile = CTxDB::GetProfile();
+    CTxDBStats stats = CTxDB::GetStats();
+
+    Object result;
+    result.push_back(Pair("profile", profile.strName));
+    result.push_back(Pair("cachesize", profile.nCacheSize));
+    result.push_back(Pair("writebuffersize", profile.nWriteBufferSize));
+    result.push_back(Pair("maxopenfiles", profile.nMaxOpenFiles));
+    result.push_back(Pair("blocksize", profile.nBlockSize));
+    result.push_back(Pair("compression", profile.fCompression));
+    result.push_back(Pair("compressionrequested", profile.fCompressionRequested));
+
+    uint64_t nLookups = stats.nCacheHits + stats.nCacheMisses;
+    result.push_back(Pair("cachehits", stats.nCacheHits));
+    result.push_back(Pair("cachemisses", stats.nCacheMisses));
+    result.push_back(Pair("cachehitratio", nLookups ? (double)stats.nCacheHits / nLookups : 0.0));
+    result.push_back(Pair("flushes", stats.nFlushes));
+    result.push_back(Pair("compactions", stats.nCompactions));
+    result.push_back(Pair("trivialmoves", stats.nTrivialMoves));
+    result.push_back(Pair("writestalls", stats.nWriteStalls));
+
+    Array files;
+    std::string strValue;
+    for (int nLevel = 0; txdb.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        files.push_back(atoi(strValue));
+    result.push_back(Pair("filesperlevel", files));
+
+    if (txdb.GetProperty("leveldb.stats", strValue))
+        result.push_back(Pair("stats", strValue));
+    if (txdb.GetProperty("leveldb.sstables", strValue))
+        result.push_back(Pair("sstables", strValue));
+
+    return result;
+}
@@ -166,6 +166,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "searchrawtransactions", 1 },
     { "searchrawtransactions", 2 },
     { "searchrawtransactions", 3 },
+    { "searchrawtransactions", 4 },
+    { "searchrawtransactions", 5 },
 };
 
 class CRPCConvertTable
@@ -10,6 +10,7 @@
 #include "activemasternode.h"
 #include "masternodeman.h"
 #include "masternodeconfig.h"
+#include "instantx.h"
 #include "rpcserver.h"
 #include <boost/lexical_cast.hpp>
 //#include "amount.h"
@@ -126,6 +127,61 @@ Value getpoolinfo(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getinstantxinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getinstantxinfo\n"
+            "Returns an object containing InstantX lock counts and vote latency.\n"
+            "Latencies are in milliseconds after the lock was first seen.");
+
+    Object obj;
+    obj.push_back(Pair("requests",          txLockStore.CountRequests()));
+    obj.push_back(Pair("votes",             txLockStore.CountVotes()));
+    obj.push_back(Pair("locks",             txLockStore.CountLocks()));
+    obj.push_back(Pair("complete_locks",    txLockStore.CountCompleteLocks()));
+    obj.push_back(Pair("locked_inputs",     txLockStore.CountLockedInputs()));
+    obj.push_back(Pair("locks_completed",   (boost::int64_t)txLockStore.GetLocksCompleted()));
+    obj.push_back(Pair("locks_expired",     (boost::int64_t)txLockStore.GetLocksExpired()));
+    obj.push_back(Pair("votes_received",    (boost::int64_t)txLockStore.GetVotesAdded()));
+    obj.push_back(Pair("avg_vote_latency",  txLockStore.GetAverageVoteLatency()));
+    obj.push_back(Pair("max_vote_latency",  txLockStore.GetMaxVoteLatency()));
+    obj.push_back(Pair("avg_lock_latency",  txLockStore.GetAverageLockLatency()));
+    obj.push_back(Pair("max_lock_latency",  txLockStore.GetMaxLockLatency()));
+    return obj;
+}
+
+Value getschedulerinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "Returns an array of objects with run time and lock time statistics for each Darksend and Masternode maintenance task.\n"
+            "Times are in milliseconds, lock time is the time the task held cs_main.");
+
+    std::vector<CScheduler::CTaskStats> vStats;
+    darkSendScheduler.GetStats(vStats);
+
+    int64_t nNow = GetTimeMillis();
+    Array ret;
+    BOOST_FOREACH(const CScheduler::CTaskStats& stats, vStats)
+    {
+        Object obj;
+        obj.push_back(Pair("name",            stats.strName));
+        obj.push_back(Pair("interval",        stats.nInterval));
+        obj.push_back(Pair("next_run_in",     stats.nNextRun == 0 ? -1 : std::max(stats.nNextRun - nNow, (int64_t)0)));
+        obj.push_back(Pair("last_run",        stats.nLastRun / 1000));
+        obj.push_back(Pair("runs",            (boost::int64_t)stats.nRuns));
+        obj.push_back(Pair("total_time",      (double)stats.nTotalTime / 1000));
+        obj.push_back(Pair("avg_time",        (double)(stats.nRuns == 0 ? 0 : stats.nTotalTime / (int64_t)stats.nRuns) / 1000));
+        obj.push_back(Pair("max_time",        (double)stats.nMaxTime / 1000));
+        obj.push_back(Pair("total_lock_time", (double)stats.nTotalLockTime / 1000));
+        obj.push_back(Pair("max_lock_time",   (double)stats.nMaxLockTime / 1000));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 
 Value masternode(const Array& params, bool fHelp)
 {
@@ -308,7 +364,9 @@ Value masternode(const Array& params, bool fHelp)
     {
         Array newParams(params.size() - 1);
         std::copy(params.begin() + 1, params.end(), newParams.begin());
-        return masternodelist(newParams, fHelp);
+        CJSONTreeWriter writer;
+        masternodelist(newParams, fHelp, writer);
+        return writer.GetValue();
     }
 
     if (strCommand == "count")
@@ -754,7 +812,7 @@ Value masternode(const Array& params, bool fHelp)
     return Value::null;
 }
 
-Value masternodelist(const Array& params, bool fHelp)
+void masternodelist(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     std::string strMode = "status";
     std::string strFilter = "";
@@ -787,13 +845,19 @@ Value masternodelist(const Array& params, bool fHelp)
                 );
     }
 
-    Object obj;
+    // entries are written as they are made, from copies of the list
+    writer.BeginObject();
     if (strMode == "rank") {
-        std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(pindexBest->nHeight);
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = pindexBest->nHeight;
+        }
+        std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(nHeight);
         BOOST_FOREACH(PAIRTYPE(int, CMasternode)& s, vMasternodeRanks) {
             std::string strVin = s.second.vin.prevout.ToStringShort();
             if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-            obj.push_back(Pair(strVin,       s.first));
+            writer.WritePair(strVin,       s.first);
         }
     } else {
         std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeVector();
@@ -801,7 +865,7 @@ Value masternodelist(const Array& params, bool fHelp)
             std::string strVin = mn.vin.prevout.ToStringShort();
             if (strMode == "activeseconds") {
                 if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)(mn.lastTimeSeen - mn.sigTime)));
+                writer.WritePair(strVin,       (int64_t)(mn.lastTimeSeen - mn.sigTime));
             } else if (strMode == "donation") {
                 CTxDestination address1;
                 ExtractDestination(mn.donationAddress, address1);
@@ -817,7 +881,7 @@ Value masternodelist(const Array& params, bool fHelp)
                     strOut += ":";
                     strOut += boost::lexical_cast<std::string>(mn.donationPercentage);
                 }
-                obj.push_back(Pair(strVin,       strOut.c_str()));
+                writer.WritePair(strVin,       strOut.c_str());
             } else if (strMode == "full") {
                 CScript pubkey;
                 pubkey.SetDestination(mn.pubkey.GetID());
@@ -841,14 +905,14 @@ Value masternodelist(const Array& params, bool fHelp)
                 stringStream << " " << strVin;
                 if(strFilter !="" && stringStream.str().find(strFilter) == string::npos &&
                         strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(addrStream.str(), output));
+                writer.WritePair(addrStream.str(), output);
             } else if (strMode == "lastseen") {
                 if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)mn.lastTimeSeen));
+                writer.WritePair(strVin,       (int64_t)mn.lastTimeSeen);
             } else if (strMode == "protocol") {
                 if(strFilter !="" && strFilter != boost::lexical_cast<std::string>(mn.protocolVersion) &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)mn.protocolVersion));
+                writer.WritePair(strVin,       (int64_t)mn.protocolVersion);
             } else if (strMode == "pubkey") {
                 CScript pubkey;
                 pubkey.SetDestination(mn.pubkey.GetID());
@@ -858,15 +922,15 @@ Value masternodelist(const Array& params, bool fHelp)
 
                 if(strFilter !="" && address2.ToString().find(strFilter) == string::npos &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       address2.ToString().c_str()));
+                writer.WritePair(strVin,       address2.ToString().c_str());
             } else if(strMode == "status") {
                 std::string strStatus = mn.Status();
                 if(strFilter !="" && strVin.find(strFilter) == string::npos && strStatus.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       strStatus.c_str()));
+                writer.WritePair(strVin,       strStatus.c_str());
             } else if (strMode == "addr") {
                 if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       mn.addr.ToString().c_str()));
+                writer.WritePair(strVin,       mn.addr.ToString().c_str());
             } else if(strMode == "votes"){
                 std::string strStatus = "ABSTAIN";
 
@@ -878,14 +942,13 @@ Value masternodelist(const Array& params, bool fHelp)
                 }
 
                 if(strFilter !="" && (strVin.find(strFilter) == string::npos && strStatus.find(strFilter) == string::npos)) continue;
-                obj.push_back(Pair(strVin,       strStatus.c_str()));
+                writer.WritePair(strVin,       strStatus.c_str());
             } else if(strMode == "lastpaid"){
                 if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,      (int64_t)mn.nLastPaid));
+                writer.WritePair(strVin,      (int64_t)mn.nLastPaid);
             }
         }
     }
-    return obj;
-
+    writer.EndObject();
 }
@@ -3,6 +3,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addrindex.h"
 #include "base58.h"
 #include "init.h"
 #include "main.h"
@@ -57,6 +58,10 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("connections",   (int)vNodes.size()));
     obj.push_back(Pair("proxy",         (proxy.first.IsValid() ? proxy.first.ToStringIPPort() : string())));
     obj.push_back(Pair("ip",            GetLocalAddress(NULL).ToStringIP()));
+    if (fAddrIndex) {
+        obj.push_back(Pair("addrindex",       addrIndexBuilder.GetState()));
+        obj.push_back(Pair("addrindexheight", addrIndexBuilder.GetHeight()));
+    }
 
     diff.push_back(Pair("proof-of-work",  GetDifficulty()));
     diff.push_back(Pair("proof-of-stake", GetDifficulty(GetLastBlockIndex(pindexBest, true))));
@@ -244,13 +249,12 @@ Value verifymessage(const Array& params, bool fHelp)
 Value spork(const Array& params, bool fHelp)
 {
     if(params.size() == 1 && params[0].get_str() == "show"){
-        std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
+        std::vector<CSporkMessage> vSporks;
+        GetActiveSporks(vSporks);
 
         Object ret;
-        while(it != mapSporksActive.end()) {
-            ret.push_back(Pair(sporkManager.GetSporkNameByID(it->second.nSporkID), it->second.nValue));
-            it++;
-        }
+        BOOST_FOREACH(const CSporkMessage& spork, vSporks)
+            ret.push_back(Pair(sporkManager.GetSporkNameByID(spork.nSporkID), spork.nValue));
         return ret;
     } else if (params.size() == 2){
         int nSporkID = sporkManager.GetSporkIDByName(params[0].get_str());
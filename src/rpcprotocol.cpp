@@ -77,29 +77,35 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time(), FormatFullVersion());
+    return HTTPReplyHeader(nStatus, keepalive, strMsg.size()) + strMsg;
+}
+
+// A negative nContentLength announces a chunked body
+string HTTPReplyHeader(int nStatus, bool keepalive, int64_t nContentLength, const string& strContentType)
+{
     const char *cStatus;
          if (nStatus == HTTP_OK) cStatus = "OK";
     else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
-            "Content-Length: %u\r\n"
-            "Content-Type: application/json\r\n"
+            "%s"
+            "Content-Type: %s\r\n"
             "Server: arion-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
+            "\r\n",
         nStatus,
         cStatus,
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
-        strMsg.size(),
-        FormatFullVersion(),
-        strMsg);
+        nContentLength < 0 ? string("Transfer-Encoding: chunked\r\n") : strprintf("Content-Length: %d\r\n", nContentLength),
+        strContentType,
+        FormatFullVersion());
 }
 
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
@@ -178,6 +184,40 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, map<string, string>& mapHe
 }
 
 
+// Body sent in chunks, as the server does for large replies
+static bool ReadHTTPChunkedBody(std::basic_istream<char>& stream, string& strMessageRet, size_t max_size)
+{
+    while (true)
+    {
+        string str;
+        std::getline(stream, str);
+        if (!stream)
+            return false;
+        size_t nChunk = strtoul(str.c_str(), NULL, 16);
+        if (nChunk == 0)
+            break;
+        if (strMessageRet.size() + nChunk > max_size)
+            return false;
+
+        size_t ptr = strMessageRet.size();
+        strMessageRet.resize(ptr + nChunk);
+        stream.read(&strMessageRet[ptr], nChunk);
+        std::getline(stream, str);
+        if (!stream)
+            return false;
+    }
+
+    // skip the trailer
+    while (true)
+    {
+        string str;
+        std::getline(stream, str);
+        if (!stream || str.empty() || str == "\r")
+            break;
+    }
+    return true;
+}
+
 int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
                     string>& mapHeadersRet, string& strMessageRet,
                     int nProto, size_t max_size)
@@ -191,7 +231,13 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    map<string, string>::const_iterator it = mapHeadersRet.find("transfer-encoding");
+    if (it != mapHeadersRet.end() && boost::iequals(it->second, "chunked"))
+    {
+        if (!ReadHTTPChunkedBody(stream, strMessageRet, max_size))
+            return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
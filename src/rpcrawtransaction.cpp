@@ -5,6 +5,7 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include "addrindex.h"
 #include "base58.h"
 #include "rpcserver.h"
 #include "txdb.h"
@@ -89,7 +90,8 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second)
         {
             CBlockIndex* pindex = (*mi).second;
@@ -141,7 +143,7 @@ Value getrawtransaction(const Array& params, bool fHelp)
 }
 
 #ifdef ENABLE_WALLET
-Value listunspent(const Array& params, bool fHelp)
+void listunspent(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -177,56 +179,70 @@ Value listunspent(const Array& params, bool fHelp)
         }
     }
 
-    Array results;
-    vector<COutput> vecOutputs;
+    // the wallet is listed a batch of transactions per lock acquisition, in the same order as a whole
+    writer.BeginArray();
     assert(pwalletMain != NULL);
-    pwalletMain->AvailableCoins(vecOutputs, false);
-    BOOST_FOREACH(const COutput& out, vecOutputs)
+    uint256 hashNext = 0;
+    bool fMore = true;
+    // depths come from one cs_main snapshot, the batches only hold the wallet shared
+    CChainDepthSnapshot depths(pwalletMain->GetTxBlockHashes());
+    while (fMore)
     {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
-
-        if(setAddress.size())
+        Array entries;
         {
-            CTxDestination address;
-            if(!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-                continue;
+            LOCK_SHARED(pwalletMain->cs_wallet);
+            vector<COutput> vecOutputs;
+            fMore = pwalletMain->AvailableCoinsBatch(vecOutputs, hashNext, JSON_STREAM_LOCK_BATCH, false);
+            BOOST_FOREACH(const COutput& out, vecOutputs)
+            {
+                if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
+                    continue;
 
-            if (!setAddress.count(address))
-                continue;
-        }
+                if(setAddress.size())
+                {
+                    CTxDestination address;
+                    if(!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+                        continue;
 
-        int64_t nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        Object entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
-        CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-        {
-            entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address]));
-        }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        if (pk.IsPayToScriptHash())
-        {
-            CTxDestination address;
-            if (ExtractDestination(pk, address))
-            {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                    if (!setAddress.count(address))
+                        continue;
+                }
+
+                int64_t nValue = out.tx->vout[out.i].nValue;
+                const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+                Object entry;
+                entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
+                entry.push_back(Pair("vout", out.i));
+                CTxDestination address;
+                if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+                {
+                    entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
+                    map<CTxDestination, string>::const_iterator mi = pwalletMain->mapAddressBook.find(address);
+                    if (mi != pwalletMain->mapAddressBook.end())
+                        entry.push_back(Pair("account", (*mi).second));
+                }
+                entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+                if (pk.IsPayToScriptHash())
+                {
+                    CTxDestination address;
+                    if (ExtractDestination(pk, address))
+                    {
+                        const CScriptID& hash = boost::get<CScriptID>(address);
+                        CScript redeemScript;
+                        if (pwalletMain->GetCScript(hash, redeemScript))
+                            entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                    }
+                }
+                entry.push_back(Pair("amount",ValueFromAmount(nValue)));
+                entry.push_back(Pair("confirmations",out.nDepth));
+                entry.push_back(Pair("spendable", out.fSpendable));
+                entries.push_back(entry);
             }
         }
-        entry.push_back(Pair("amount",ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations",out.nDepth));
-        entry.push_back(Pair("spendable", out.fSpendable));
-        results.push_back(entry);
+        BOOST_FOREACH(const Value& entry, entries)
+            writer.Write(entry);
     }
-
-    return results;
+    writer.EndArray();
 }
 #endif
 
@@ -599,23 +615,28 @@ Value sendrawtransaction(const Array& params, bool fHelp)
 }
 
 
-Value searchrawtransactions(const Array &params, bool fHelp)
+void searchrawtransactions(const Array &params, bool fHelp, CJSONWriter& writer)
 {
-    if (fHelp || params.size() < 1 || params.size() > 4)
+    if (fHelp || params.size() < 1 || params.size() > 6)
         throw runtime_error(
-            "searchrawtransactions <address> [verbose=1] [skip=0] [count=100]\n");
+            "searchrawtransactions <address> [verbose=1] [skip=0] [count=100] [startheight=0] [endheight=-1]\n"
+            "Transactions sending to or spending from <address> in chain order, needs -addrindex.\n"
+            "A negative skip counts from the last transaction, endheight -1 means no upper bound.\n");
+
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addrindex");
+    if (!addrIndexBuilder.IsSynced())
+        throw JSONRPCError(RPC_MISC_ERROR, addrIndexBuilder.GetStatus());
 
     CBitcoinAddress address(params[0].get_str());
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
     CTxDestination dest = address.Get();
 
-    std::vector<uint256> vtxhash;
-    if (!FindTransactionsByDestination(dest, vtxhash))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
-
     int nSkip = 0;
     int nCount = 100;
+    int nHeightStart = 0;
+    int nHeightEnd = -1;
     bool fVerbose = true;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
@@ -623,27 +644,29 @@ Value searchrawtransactions(const Array &params, bool fHelp)
         nSkip = params[2].get_int();
     if (params.size() > 3)
         nCount = params[3].get_int();
+    if (params.size() > 4)
+        nHeightStart = std::max(0, params[4].get_int());
+    if (params.size() > 5)
+        nHeightEnd = params[5].get_int();
 
-    if (nSkip < 0)
-        nSkip += vtxhash.size();
-    if (nSkip < 0)
-        nSkip = 0;
     if (nCount < 0)
         nCount = 0;
 
-    std::vector<uint256>::const_iterator it = vtxhash.begin();
-    while (it != vtxhash.end() && nSkip--) it++;
+    // only the requested page is read from the index
+    std::vector<uint256> vtxhash;
+    if (!FindTransactionsByDestination(dest, vtxhash, nSkip, nCount, nHeightStart, nHeightEnd))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
 
-    Array result;
-    while (it != vtxhash.end() && nCount--) {
+    writer.BeginArray();
+    BOOST_FOREACH(const uint256& hashTx, vtxhash) {
         CTransaction tx;
         uint256 hashBlock;
-        if (!GetTransaction(*it, tx, hashBlock))
+        if (!GetTransaction(hashTx, tx, hashBlock))
         {
            // throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
            Object obj;
 	   obj.push_back(Pair("ERROR", "Cannot read transaction from disk"));
-	   result.push_back(obj);
+	   writer.Write(obj);
 	}
 	else
 	{
@@ -655,13 +678,38 @@ Value searchrawtransactions(const Array &params, bool fHelp)
             Object object;
             TxToJSON(tx, hashBlock, object);
             object.push_back(Pair("hex", strHex));
-            result.push_back(object);
+            writer.Write(object);
         } else {
-            result.push_back(strHex);
+            writer.Write(strHex);
         }
 
         }
-        it++;
     }
+    writer.EndArray();
+}
+
+Value getaddressbalance(const Array &params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance <address>\n"
+            "Balance and total received of <address> in the best chain, needs -addrindex.\n");
+
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addrindex");
+    if (!addrIndexBuilder.IsSynced())
+        throw JSONRPCError(RPC_MISC_ERROR, addrIndexBuilder.GetStatus());
+
+    CBitcoinAddress address(params[0].get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+
+    int64_t nBalance, nReceived;
+    if (!GetAddressBalance(address.Get(), nBalance, nReceived))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read address balance");
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
     return result;
 }
@@ -22,6 +22,7 @@
 #include <boost/asio/ip/v6_only.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
@@ -29,6 +30,7 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
+#include <deque>
 #include <list>
 
 using namespace std;
@@ -43,6 +45,25 @@ static asio::io_service* rpc_io_service = NULL;
 static map<string, boost::shared_ptr<deadline_timer> > deadlineTimers;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
+static boost::thread* rpc_io_thread = NULL;
+static class CRPCWorkQueue* rpc_work_queue = NULL;
+
+// Largest request line plus headers accepted from a client
+static const size_t MAX_HTTP_HEADERS_SIZE = 8192;
+// Seconds a client gets for each read and write, and to send the next request on a kept-alive connection
+static int nRPCServerTimeout = 30;
+// Threads serving calls from the work queue
+static int nRPCWorkers = 0;
+// Locked batch entries run this many at a time under one lock acquisition, so a big batch doesn't
+// hold up the node for its whole length
+static const unsigned int RPC_BATCH_LOCK_GROUP = 100;
+// Thread-safe batch entries are handed to the workers in slices of at least this many
+static const unsigned int RPC_BATCH_SLICE_SIZE = 16;
+// Bytes of a chunked reply a connection holds for a slow client before the call has to wait for it
+static const size_t RPC_STREAM_MAX_BUFFER = 16 * JSON_STREAM_FLUSH_SIZE;
+// REST requests are served, with or without the RPC password
+static bool fRESTEnabled = false;
+static bool fRESTAuth = false;
 
 void RPCTypeCheck(const Array& params,
                   const list<Value_type>& typesExpected,
@@ -163,9 +184,13 @@ string CRPCTable::help(string strCommand) const
         try
         {
             Array params;
-            rpcfn_type pfn = pcmd->actor;
-            if (setDone.insert(pfn).second)
-                (*pfn)(params, true);
+            if (pcmd->streamActor)
+            {
+                CJSONTreeWriter writer;
+                (*pcmd->streamActor)(params, true, writer);
+            }
+            else if (setDone.insert(pcmd->actor).second)
+                (*pcmd->actor)(params, true);
         }
         catch (std::exception& e)
         {
@@ -217,117 +242,124 @@ Value stop(const Array& params, bool fHelp)
 //
 
 
+// threadSafe commands run without cs_main and cs_wallet and take what they need themselves, so that
+// chain queries run side by side on the -rpcthreads. Commands with a streamActor write large results
+// out as they go.
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  ------------------------  -----------------------  ---------- ---------- ---------
-    { "help",                   &help,                   true,      true,      false },
-    { "stop",                   &stop,                   true,      true,      false },
-    { "getbestblockhash",       &getbestblockhash,       true,      false,     false },
-    { "getblockcount",          &getblockcount,          true,      false,     false },
-    { "getconnectioncount",     &getconnectioncount,     true,      false,     false },
-    { "getpeerinfo",            &getpeerinfo,            true,      false,     false },
-    { "addnode",                &addnode,                true,      true,      false },
-    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false },
-    { "ping",                   &ping,                   true,      false,     false },
-    { "getnettotals",           &getnettotals,           true,      true,      false },
-    { "getdifficulty",          &getdifficulty,          true,      false,     false },
-    { "getinfo",                &getinfo,                true,      false,     false },
-    { "getvelocityinfo",        &getvelocityinfo,        true,      false,     false },
-    { "getrawmempool",          &getrawmempool,          true,      false,     false },
-    { "getblock",               &getblock,               false,     false,     false },
-    { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
-    { "getblockhash",           &getblockhash,           false,     false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false,     false },
-    { "createrawtransaction",   &createrawtransaction,   false,     false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false },
-    { "decodescript",           &decodescript,           false,     false,     false },
-    { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
-    { "getcheckpoint",          &getcheckpoint,          true,      false,     false },
-    { "sendalert",              &sendalert,              false,     false,     false },
-    { "validateaddress",        &validateaddress,        true,      false,     false },
-    { "validatepubkey",         &validatepubkey,         true,      false,     false },
-    { "verifymessage",          &verifymessage,          false,     false,     false },
-    { "searchrawtransactions",  &searchrawtransactions,  false,     false,     false },
+{ //  name                      actor (function)         okSafeMode threadSafe reqWallet  streamActor
+  //  ------------------------  -----------------------  ---------- ---------- ---------  -----------
+    { "help",                   &help,                   true,      true,      false,     NULL },
+    { "stop",                   &stop,                   true,      true,      false,     NULL },
+    { "getbestblockhash",       &getbestblockhash,       true,      true,      false,     NULL },
+    { "getblockcount",          &getblockcount,          true,      true,      false,     NULL },
+    { "getconnectioncount",     &getconnectioncount,     true,      false,     false,     NULL },
+    { "getpeerinfo",            &getpeerinfo,            true,      false,     false,     NULL },
+    { "addnode",                &addnode,                true,      true,      false,     NULL },
+    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false,     NULL },
+    { "ping",                   &ping,                   true,      false,     false,     NULL },
+    { "getnettotals",           &getnettotals,           true,      true,      false,     NULL },
+    { "getdifficulty",          &getdifficulty,          true,      true,      false,     NULL },
+    { "getinfo",                &getinfo,                true,      false,     false,     NULL },
+    { "getvelocityinfo",        &getvelocityinfo,        true,      false,     false,     NULL },
+    { "getrawmempool",          &getrawmempool,          true,      true,      false,     NULL },
+    { "getblock",               NULL,                    false,     true,      false,     &getblock },
+    { "getblockbynumber",       NULL,                    false,     true,      false,     &getblockbynumber },
+    { "getblockhash",           &getblockhash,           false,     true,      false,     NULL },
+    { "getrawtransaction",      &getrawtransaction,      false,     true,      false,     NULL },
+    { "createrawtransaction",   &createrawtransaction,   false,     true,      false,     NULL },
+    { "decoderawtransaction",   &decoderawtransaction,   false,     true,      false,     NULL },
+    { "decodescript",           &decodescript,           false,     true,      false,     NULL },
+    { "signrawtransaction",     &signrawtransaction,     false,     false,     false,     NULL },
+    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false,     NULL },
+    { "getcheckpoint",          &getcheckpoint,          true,      false,     false,     NULL },
+    { "dbstats",                &dbstats,                true,      true,      false,     NULL },
+    { "sendalert",              &sendalert,              false,     false,     false,     NULL },
+    { "validateaddress",        &validateaddress,        true,      false,     false,     NULL },
+    { "validatepubkey",         &validatepubkey,         true,      false,     false,     NULL },
+    { "verifymessage",          &verifymessage,          false,     true,      false,     NULL },
+    { "searchrawtransactions",  NULL,                    false,     true,      false,     &searchrawtransactions },
+    { "getaddressbalance",      &getaddressbalance,      false,     true,      false,     NULL },
 
 /* Dark features */
-    { "spork",                  &spork,                  true,      false,      false },
-    { "masternode",             &masternode,             true,      false,      true },
-    { "masternodelist",         &masternodelist,         true,      false,      false },
+    { "spork",                  &spork,                  true,      false,      false,    NULL },
+    { "masternode",             &masternode,             true,      false,      true,     NULL },
+    { "masternodelist",         NULL,                    true,      true,       false,    &masternodelist },
+    { "getinstantxinfo",        &getinstantxinfo,        true,      false,      false,    NULL },
+    { "getschedulerinfo",       &getschedulerinfo,       true,      false,      false,    NULL },
 
 #ifdef ENABLE_WALLET
-    { "darksend",               &darksend,               false,     false,      true },
-    { "getmininginfo",          &getmininginfo,          true,      false,     false },
-    { "getstakinginfo",         &getstakinginfo,         true,      false,     false },
-    { "getnewaddress",          &getnewaddress,          true,      false,     true },
-    { "getnewpubkey",           &getnewpubkey,           true,      false,     true },
-    { "getaccountaddress",      &getaccountaddress,      true,      false,     true },
-    { "setaccount",             &setaccount,             true,      false,     true },
-    { "getaccount",             &getaccount,             false,     false,     true },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true },
-    { "sendtoaddress",          &sendtoaddress,          false,     false,     true },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true },
-    { "backupwallet",           &backupwallet,           true,      false,     true },
-    { "keypoolrefill",          &keypoolrefill,          true,      false,     true },
-    { "walletpassphrase",       &walletpassphrase,       true,      false,     true },
-    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true },
-    { "walletlock",             &walletlock,             true,      false,     true },
-    { "encryptwallet",          &encryptwallet,          false,     false,     true },
-    { "getbalance",             &getbalance,             false,     false,     true },
-    { "move",                   &movecmd,                false,     false,     true },
-    { "sendfrom",               &sendfrom,               false,     false,     true },
-    { "sendmany",               &sendmany,               false,     false,     true },
-    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true },
-    { "addredeemscript",        &addredeemscript,        false,     false,     true },
-    { "gettransaction",         &gettransaction,         false,     false,     true },
-    { "listtransactions",       &listtransactions,       false,     false,     true },
-    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true },
-    { "signmessage",            &signmessage,            false,     false,     true },
-    { "getwork",                &getwork,                true,      false,     true },
-    { "getworkex",              &getworkex,              true,      false,     true },
-    { "listaccounts",           &listaccounts,           false,     false,     true },
-    { "getblocktemplate",       &getblocktemplate,       true,      false,     false },
-    { "submitblock",            &submitblock,            false,     false,     false },
-    { "listsinceblock",         &listsinceblock,         false,     false,     true },
-    { "dumpprivkey",            &dumpprivkey,            false,     false,     true },
-    { "dumpwallet",             &dumpwallet,             true,      false,     true },
-    { "importprivkey",          &importprivkey,          false,     false,     true },
-    { "importwallet",           &importwallet,           false,     false,     true },
-    { "importaddress",          &importaddress,          false,     false,     true },
-    { "listunspent",            &listunspent,            false,     false,     true },
-    { "cclistcoins",            &cclistcoins,            false,     false,     true },
-    { "settxfee",               &settxfee,               false,     false,     true },
-    { "getsubsidy",             &getsubsidy,             true,      true,      false },
-    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false },
-    { "reservebalance",         &reservebalance,         false,     true,      true },
-    { "createmultisig",         &createmultisig,         true,      true,      false },
-    { "checkwallet",            &checkwallet,            false,     true,      true },
-    { "repairwallet",           &repairwallet,           false,     true,      true },
-    { "resendtx",               &resendtx,               false,     true,      true },
-    { "makekeypair",            &makekeypair,            false,     true,      false },
-    { "checkkernel",            &checkkernel,            true,      false,     true },
-    { "getnewstealthaddress",   &getnewstealthaddress,   false,     false,     true },
-    { "liststealthaddresses",   &liststealthaddresses,   false,     false,     true },
-    { "scanforalltxns",         &scanforalltxns,         false,     false,     false },
-    { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false },
-    { "importstealthaddress",   &importstealthaddress,   false,     false,     true },
-    { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     true },
-    { "smsgenable",             &smsgenable,             false,     false,     false },
-    { "smsgdisable",            &smsgdisable,            false,     false,     false },
-    { "smsglocalkeys",          &smsglocalkeys,          false,     false,     false },
-    { "smsgoptions",            &smsgoptions,            false,     false,     false },
-    { "smsgscanchain",          &smsgscanchain,          false,     false,     false },
-    { "smsgscanbuckets",        &smsgscanbuckets,        false,     false,     false },
-    { "smsgaddkey",             &smsgaddkey,             false,     false,     false },
-    { "smsggetpubkey",          &smsggetpubkey,          false,     false,     false },
-    { "smsgsend",               &smsgsend,               false,     false,     false },
-    { "smsgsendanon",           &smsgsendanon,           false,     false,     false },
-    { "smsginbox",              &smsginbox,              false,     false,     false },
-    { "smsgoutbox",             &smsgoutbox,             false,     false,     false },
-    { "smsgbuckets",            &smsgbuckets,            false,     false,     false },
+    { "darksend",               &darksend,               false,     false,      true,     NULL },
+    { "getmininginfo",          &getmininginfo,          true,      false,     false,     NULL },
+    { "getstakinginfo",         &getstakinginfo,         true,      false,     false,     NULL },
+    { "getnewaddress",          &getnewaddress,          true,      false,     true,      NULL },
+    { "getnewpubkey",           &getnewpubkey,           true,      false,     true,      NULL },
+    { "getaccountaddress",      &getaccountaddress,      true,      false,     true,      NULL },
+    { "setaccount",             &setaccount,             true,      false,     true,      NULL },
+    { "getaccount",             &getaccount,             false,     false,     true,      NULL },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true,      NULL },
+    { "sendtoaddress",          &sendtoaddress,          false,     false,     true,      NULL },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true,      NULL },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true,      NULL },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true,      NULL },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true,      NULL },
+    { "backupwallet",           &backupwallet,           true,      false,     true,      NULL },
+    { "keypoolrefill",          &keypoolrefill,          true,      false,     true,      NULL },
+    { "walletpassphrase",       &walletpassphrase,       true,      false,     true,      NULL },
+    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true,      NULL },
+    { "walletlock",             &walletlock,             true,      false,     true,      NULL },
+    { "encryptwallet",          &encryptwallet,          false,     false,     true,      NULL },
+    { "getbalance",             &getbalance,             false,     true,      true,      NULL },
+    { "move",                   &movecmd,                false,     false,     true,      NULL },
+    { "sendfrom",               &sendfrom,               false,     false,     true,      NULL },
+    { "sendmany",               &sendmany,               false,     false,     true,      NULL },
+    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true,      NULL },
+    { "addredeemscript",        &addredeemscript,        false,     false,     true,      NULL },
+    { "gettransaction",         &gettransaction,         false,     false,     true,      NULL },
+    { "listtransactions",       NULL,                    false,     true,      true,      &listtransactions },
+    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true,      NULL },
+    { "signmessage",            &signmessage,            false,     false,     true,      NULL },
+    { "getwork",                &getwork,                true,      false,     true,      NULL },
+    { "getworkex",              &getworkex,              true,      false,     true,      NULL },
+    { "listaccounts",           &listaccounts,           false,     false,     true,      NULL },
+    { "getblocktemplate",       &getblocktemplate,       true,      false,     false,     NULL },
+    { "submitblock",            &submitblock,            false,     false,     false,     NULL },
+    { "listsinceblock",         &listsinceblock,         false,     false,     true,      NULL },
+    { "dumpprivkey",            &dumpprivkey,            false,     false,     true,      NULL },
+    { "dumpwallet",             &dumpwallet,             true,      false,     true,      NULL },
+    { "importprivkey",          &importprivkey,          false,     false,     true,      NULL },
+    { "importwallet",           &importwallet,           false,     false,     true,      NULL },
+    { "importaddress",          &importaddress,          false,     false,     true,      NULL },
+    { "listunspent",            NULL,                    false,     true,      true,      &listunspent },
+    { "cclistcoins",            &cclistcoins,            false,     false,     true,      NULL },
+    { "settxfee",               &settxfee,               false,     false,     true,      NULL },
+    { "getsubsidy",             &getsubsidy,             true,      true,      false,     NULL },
+    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false,     NULL },
+    { "reservebalance",         &reservebalance,         false,     true,      true,      NULL },
+    { "createmultisig",         &createmultisig,         true,      true,      false,     NULL },
+    { "checkwallet",            &checkwallet,            false,     true,      true,      NULL },
+    { "repairwallet",           &repairwallet,           false,     true,      true,      NULL },
+    { "resendtx",               &resendtx,               false,     true,      true,      NULL },
+    { "makekeypair",            &makekeypair,            false,     true,      false,     NULL },
+    { "checkkernel",            &checkkernel,            true,      false,     true,      NULL },
+    { "getnewstealthaddress",   &getnewstealthaddress,   false,     false,     true,      NULL },
+    { "liststealthaddresses",   &liststealthaddresses,   false,     false,     true,      NULL },
+    { "scanforalltxns",         &scanforalltxns,         false,     false,     false,     NULL },
+    { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false,     NULL },
+    { "importstealthaddress",   &importstealthaddress,   false,     false,     true,      NULL },
+    { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     true,      NULL },
+    { "smsgenable",             &smsgenable,             false,     false,     false,     NULL },
+    { "smsgdisable",            &smsgdisable,            false,     false,     false,     NULL },
+    { "smsglocalkeys",          &smsglocalkeys,          false,     false,     false,     NULL },
+    { "smsgoptions",            &smsgoptions,            false,     false,     false,     NULL },
+    { "smsgscanchain",          &smsgscanchain,          false,     false,     false,     NULL },
+    { "smsgscanbuckets",        &smsgscanbuckets,        false,     false,     false,     NULL },
+    { "smsgaddkey",             &smsgaddkey,             false,     false,     false,     NULL },
+    { "smsggetpubkey",          &smsggetpubkey,          false,     false,     false,     NULL },
+    { "smsgsend",               &smsgsend,               false,     false,     false,     NULL },
+    { "smsgsendanon",           &smsgsendanon,           false,     false,     false,     NULL },
+    { "smsginbox",              NULL,                    false,     true,      false,     &smsginbox },
+    { "smsgoutbox",             &smsgoutbox,             false,     false,     false,     NULL },
+    { "smsgbuckets",            &smsgbuckets,            false,     false,     false,     NULL },
 #endif
 };
 
@@ -362,15 +394,16 @@ bool HTTPAuthorized(map<string, string>& mapHeaders)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+static void ErrorReply(const Object& objError, const Value& id, int& nStatus, CJSONStreamWriter& writer)
 {
     // Send error reply from json-rpc error object
-    int nStatus = HTTP_INTERNAL_SERVER_ERROR;
+    nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
-    string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    writer.Clear();
+    writer.Write(JSONRPCReplyObj(Value::null, objError, id));
+    writer.EndLine();
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -396,61 +429,502 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-class AcceptedConnection
+//
+// Bounded queue of requests waiting for an RPC worker thread. A request that finds it full is
+// answered with 503 right away instead of stalling its connection until a worker frees up.
+// Batch slices wait in a separate queue of the same depth, so a big batch can't crowd requests
+// out; a slice that doesn't fit is left to the batch thread.
+//
+class CRPCWorkQueue
 {
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::function<void()> > queue;
+    std::deque<boost::function<void()> > queueSlices;
+    size_t nMaxDepth;
+    bool fRunning;
+
 public:
-    virtual ~AcceptedConnection() {}
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    // false if the queue is full or stopped
+    bool Enqueue(const boost::function<void()>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(func);
+        cond.notify_one();
+        return true;
+    }
 
-    virtual std::iostream& stream() = 0;
-    virtual std::string peer_address_to_string() const = 0;
-    virtual void close() = 0;
+    // false if the slice queue is full or stopped
+    bool EnqueueSlice(const boost::function<void()>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || queueSlices.size() >= nMaxDepth)
+            return false;
+        queueSlices.push_back(func);
+        cond.notify_one();
+        return true;
+    }
+
+    // Worker thread, runs requests until stopped, and batch slices while no request waits
+    void Run()
+    {
+        RenameThread("arion-rpcworker");
+        while (true)
+        {
+            boost::function<void()> func;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (fRunning && queue.empty() && queueSlices.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    return;
+                std::deque<boost::function<void()> >& queueNext = queue.empty() ? queueSlices : queue;
+                func = queueNext.front();
+                queueNext.pop_front();
+            }
+            func();
+        }
+    }
+
+    // Drop the waiting requests and let the workers return once their current request is done
+    void Stop()
+    {
+        std::deque<boost::function<void()> > queueDropped, queueSlicesDropped;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fRunning = false;
+            queue.swap(queueDropped);
+            queueSlices.swap(queueSlicesDropped);
+            cond.notify_all();
+        }
+    }
 };
 
+static bool ExecuteRPCRequest(const string& strRequest, int& nStatus, CJSONStreamWriter& writer);
+
+//
+// A client connection, served by asynchronous reads and writes on the RPC I/O thread so a slow
+// client doesn't hold a thread. Its handlers run through a strand; the call itself runs on a worker
+// from the work queue, which hands the reply back through the strand. There is at most one request
+// in flight per connection, the next one is read once the reply is written if the client keeps the
+// connection alive.
+//
+// A reply that outgrows JSON_STREAM_FLUSH_SIZE goes to HTTP/1.1 clients in chunks while the call
+// still runs. The worker queues the chunks and the strand writes them out, so a slow client
+// doesn't hold the worker; only once RPC_STREAM_MAX_BUFFER is queued does the worker wait for the
+// client, so a connection holds that much at most however large the result is.
+//
 template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+class RPCConnection : public boost::enable_shared_from_this< RPCConnection<Protocol> >
 {
 public:
-    AcceptedConnectionImpl(
+    RPCConnection(
             asio::io_service& io_service,
             ssl::context &context,
-            bool fUseSSL) :
+            bool fUseSSLIn) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        strand(io_service),
+        timer(io_service),
+        buf(MAX_HTTP_HEADERS_SIZE),
+        fUseSSL(fUseSSLIn),
+        fKeepAlive(false),
+        fChunked(false),
+        nProto(0),
+        nChunkBytes(0),
+        fChunkWriting(false),
+        fChunkLast(false),
+        fChunkFailed(false)
     {
     }
 
-    virtual std::iostream& stream()
+    void Start()
     {
-        return _stream;
-    }
+        if (!fUseSSL)
+        {
+            ReadHeaders();
+            return;
+        }
 
-    virtual std::string peer_address_to_string() const
-    {
-        return peer.address().to_string();
+        SetTimeout();
+        sslStream.async_handshake(ssl::stream_base::server,
+            strand.wrap(boost::bind(&RPCConnection::HandleHandshake, this->shared_from_this(), asio::placeholders::error)));
     }
 
-    virtual void close()
+    // Turn away a client that is not allowed to connect
+    void Reject()
     {
-        _stream.close();
+        // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
+        if (fUseSSL)
+            Close();
+        else
+            WriteReply(HTTPReply(HTTP_FORBIDDEN, "", false));
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    asio::io_service::strand strand;
+    deadline_timer timer;
+    asio::streambuf buf;
+    bool fUseSSL;
+    bool fKeepAlive;
+    bool fChunked;      // the reply headers are out, the body follows in chunks
+
+    // request being served
+    int nProto;
+    string strMethod;
+    string strURI;
+    map<string, string> mapHeaders;
+    string strRequest;
+    string strReply;    // status line and headers, or a whole reply
+    string strBody;
+    string strContentType;
+
+    // hand-over of chunks from the worker
+    boost::mutex mutexChunk;
+    boost::condition_variable condChunk;
+    std::deque<string> queueChunks;
+    size_t nChunkBytes;     // queued and being written
+    bool fChunkWriting;     // the strand is writing the queue out
+    bool fChunkLast;        // the last chunk is queued
+    bool fChunkFailed;
+
+    void SetTimeout()
+    {
+        timer.expires_from_now(posix_time::seconds(nRPCServerTimeout));
+        timer.async_wait(strand.wrap(boost::bind(&RPCConnection::HandleTimeout, this->shared_from_this(), asio::placeholders::error)));
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // a wait that completed just before the timer was moved or cancelled isn't a timeout
+        if (error != asio::error::operation_aborted && timer.expires_at() <= deadline_timer::traits_type::now())
+            Close();
+    }
+
+    void Close()
+    {
+        // aborts the pending operations, the connection goes away with the last handler
+        boost::system::error_code ec;
+        timer.cancel(ec);
+        sslStream.lowest_layer().close(ec);
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            ReadHeaders();
+    }
+
+    void ReadHeaders()
+    {
+        SetTimeout();
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buf, "\r\n\r\n",
+                strand.wrap(boost::bind(&RPCConnection::HandleHeaders, this->shared_from_this(), asio::placeholders::error)));
+        else
+            asio::async_read_until(sslStream.next_layer(), buf, "\r\n\r\n",
+                strand.wrap(boost::bind(&RPCConnection::HandleHeaders, this->shared_from_this(), asio::placeholders::error)));
+    }
+
+    void HandleHeaders(const boost::system::error_code& error)
+    {
+        // also fails when the headers don't fit in MAX_HTTP_HEADERS_SIZE
+        if (error)
+        {
+            Close();
+            return;
+        }
 
-void ServiceConnection(AcceptedConnection *conn);
+        std::istream stream(&buf);
+        mapHeaders.clear();
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI))
+        {
+            Close();
+            return;
+        }
+        int nLen = ReadHTTPHeaders(stream, mapHeaders);
+        if (nLen < 0 || (size_t)nLen > MAX_SIZE)
+        {
+            Close();
+            return;
+        }
+
+        string sConHdr = mapHeaders["connection"];
+        fKeepAlive = (sConHdr == "keep-alive") || (sConHdr != "close" && nProto >= 1);
+
+        // the start of the body usually comes in with the headers, anything after it is the next request
+        strRequest.assign(nLen, '\0');
+        size_t nHave = std::min(buf.size(), (size_t)nLen);
+        if (nHave > 0)
+            stream.read(&strRequest[0], nHave);
+        if (nHave == (size_t)nLen)
+        {
+            HandleRequest();
+            return;
+        }
+
+        if (fUseSSL)
+            asio::async_read(sslStream, asio::buffer(&strRequest[nHave], nLen - nHave),
+                strand.wrap(boost::bind(&RPCConnection::HandleBody, this->shared_from_this(), asio::placeholders::error)));
+        else
+            asio::async_read(sslStream.next_layer(), asio::buffer(&strRequest[nHave], nLen - nHave),
+                strand.wrap(boost::bind(&RPCConnection::HandleBody, this->shared_from_this(), asio::placeholders::error)));
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            HandleRequest();
+    }
+
+    void HandleRequest()
+    {
+        timer.cancel();
+
+        bool fREST = fRESTEnabled && strURI.compare(0, strlen("/rest/"), "/rest/") == 0;
+        if (strURI != "/" && !fREST)
+        {
+            fKeepAlive = false;
+            WriteReply(HTTPReply(HTTP_NOT_FOUND, "", false));
+            return;
+        }
+
+        // Check authorization, REST requests are public unless -restauth is set
+        if (!fREST || fRESTAuth)
+        {
+            if (mapHeaders.count("authorization") == 0)
+            {
+                fKeepAlive = false;
+                WriteReply(HTTPReply(HTTP_UNAUTHORIZED, "", false));
+                return;
+            }
+            if (!HTTPAuthorized(mapHeaders))
+            {
+                LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", peer.address().to_string());
+                fKeepAlive = false;
+                strReply = HTTPReply(HTTP_UNAUTHORIZED, "", false);
+                /* Deter brute-forcing short passwords.
+                   If this results in a DoS the user really
+                   shouldn't have their RPC port exposed. */
+                if (mapArgs["-rpcpassword"].size() < 20)
+                {
+                    timer.expires_from_now(posix_time::milliseconds(250));
+                    timer.async_wait(strand.wrap(boost::bind(&RPCConnection::HandleDelayedReply, this->shared_from_this(), asio::placeholders::error)));
+                }
+                else
+                    WriteReply(strReply);
+                return;
+            }
+        }
+
+        boost::function<void()> func;
+        if (fREST)
+            func = boost::bind(&RPCConnection::ExecuteREST, this->shared_from_this());
+        else
+            func = boost::bind(&RPCConnection::Execute, this->shared_from_this());
+        if (!rpc_work_queue->Enqueue(func))
+        {
+            LogPrint("rpc", "ThreadRPCServer work queue full, refusing request from %s\n", peer.address().to_string());
+            WriteReply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", fKeepAlive));
+        }
+    }
+
+    void HandleDelayedReply(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            WriteReply(strReply);
+    }
+
+    // Runs on a worker thread, nothing else touches the request until the reply is posted back
+    void Execute()
+    {
+        // HTTP/1.0 clients don't know chunks, their reply is collected in full
+        CJSONStreamWriter::FlushFunction flush;
+        if (nProto >= 1)
+            flush = boost::bind(&RPCConnection::WriteChunk, this, _1);
+        CJSONStreamWriter writer(flush);
+
+        int nStatus;
+        bool fOk = ExecuteRPCRequest(strRequest, nStatus, writer);
+
+        if (!fOk)
+            strand.post(boost::bind(&RPCConnection::Close, this->shared_from_this()));
+        else if (writer.HasFlushed())
+            QueueChunk(writer.GetBuffer(), true);
+        else
+        {
+            // the strand doesn't touch the body until the handler is posted
+            strBody.swap(writer.GetBuffer());
+            strContentType = "application/json";
+            strand.post(boost::bind(&RPCConnection::HandleResult, this->shared_from_this(), nStatus));
+        }
+    }
+
+    // Runs on a worker thread like Execute
+    void ExecuteREST()
+    {
+        int nStatus = HandleRESTRequest(strMethod, strURI, strBody, strContentType);
+        strand.post(boost::bind(&RPCConnection::HandleResult, this->shared_from_this(), nStatus));
+    }
+
+    // Worker side of a chunked reply, false if the chunk can't be written
+    bool WriteChunk(string& strData)
+    {
+        return QueueChunk(strData, false);
+    }
+
+    // Queue a chunk for the strand, waiting only while the queue is full. The last one, what is left
+    // of the body, is queued whatever the size.
+    bool QueueChunk(string& strData, bool fLast)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexChunk);
+        while (!fLast && !fChunkFailed && nChunkBytes >= RPC_STREAM_MAX_BUFFER)
+            condChunk.wait(lock);
+        if (fChunkFailed)
+            return false;
+
+        queueChunks.push_back(string());
+        queueChunks.back().swap(strData);
+        nChunkBytes += queueChunks.back().size();
+        fChunkLast = fLast;
+        if (!fChunkWriting)
+        {
+            fChunkWriting = true;
+            strand.post(boost::bind(&RPCConnection::HandleChunk, this->shared_from_this()));
+        }
+        return true;
+    }
+
+    // Write the next queued chunk, and after the last one the empty chunk that ends the body
+    void HandleChunk()
+    {
+        bool fLast;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexChunk);
+            strBody.swap(queueChunks.front());
+            queueChunks.pop_front();
+            fLast = fChunkLast && queueChunks.empty();
+        }
+
+        strReply.clear();
+        if (!fChunked)
+        {
+            // the call went well so far, the status can't change any more from here
+            fChunked = true;
+            strReply = HTTPReplyHeader(HTTP_OK, fKeepAlive, -1);
+        }
+        if (!strBody.empty())
+            strReply += strprintf("%x\r\n", strBody.size());
+
+        std::vector<asio::const_buffer> vBuffers;
+        vBuffers.push_back(asio::buffer(strReply));
+        vBuffers.push_back(asio::buffer(strBody));
+        if (!strBody.empty())
+            vBuffers.push_back(asio::buffer("\r\n", 2));
+        if (fLast)
+        {
+            vBuffers.push_back(asio::buffer("0\r\n\r\n", 5));
+            Write(vBuffers, boost::bind(&RPCConnection::HandleWrite, this->shared_from_this(), asio::placeholders::error));
+        }
+        else
+            Write(vBuffers, boost::bind(&RPCConnection::HandleChunkWritten, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleChunkWritten(const boost::system::error_code& error)
+    {
+        timer.cancel();
+        {
+            boost::unique_lock<boost::mutex> lock(mutexChunk);
+            nChunkBytes -= strBody.size();
+            strBody.clear();
+            if (error)
+                fChunkFailed = true;
+            condChunk.notify_one();
+            if (!error && queueChunks.empty())
+            {
+                fChunkWriting = false;
+                return;
+            }
+        }
+        if (error)
+            Close();
+        else
+            HandleChunk();
+    }
+
+    void HandleResult(int nStatus)
+    {
+        // errors close the connection
+        if (nStatus != HTTP_OK)
+            fKeepAlive = false;
+        strReply = HTTPReplyHeader(nStatus, fKeepAlive, strBody.size(), strContentType);
+
+        std::vector<asio::const_buffer> vBuffers;
+        vBuffers.push_back(asio::buffer(strReply));
+        vBuffers.push_back(asio::buffer(strBody));
+        Write(vBuffers, boost::bind(&RPCConnection::HandleWrite, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    void WriteReply(const string& strReplyIn)
+    {
+        strReply = strReplyIn;
+        strBody.clear();
+
+        std::vector<asio::const_buffer> vBuffers;
+        vBuffers.push_back(asio::buffer(strReply));
+        Write(vBuffers, boost::bind(&RPCConnection::HandleWrite, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    template <typename Handler>
+    void Write(const std::vector<asio::const_buffer>& vBuffers, Handler handler)
+    {
+        SetTimeout();
+        if (fUseSSL)
+            asio::async_write(sslStream, vBuffers, strand.wrap(handler));
+        else
+            asio::async_write(sslStream.next_layer(), vBuffers, strand.wrap(handler));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        timer.cancel();
+        if (fChunked)
+        {
+            // the worker is done with the reply once its last chunk is queued
+            boost::unique_lock<boost::mutex> lock(mutexChunk);
+            nChunkBytes = 0;
+            fChunkWriting = false;
+            fChunkLast = false;
+        }
+        fChunked = false;
+        strReply.clear();
+        strBody.clear();
+        if (error || !fKeepAlive)
+            Close();
+        else
+            ReadHeaders();
+    }
+};
 
 // Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr< RPCConnection<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -462,7 +936,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL);
+    boost::shared_ptr< RPCConnection<Protocol> > conn(new RPCConnection<Protocol>(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -483,36 +957,24 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr< RPCConnection<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn);
-
     // TODO: Actually handle errors
     if (error)
-    {
-        delete conn;
-    }
+        return;
 
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading the request, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
-    {
-        // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
-        if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        delete conn;
-    }
-    else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
-    }
+    if (!ClientAllowed(conn->peer.address()))
+        conn->Reject();
+    else
+        conn->Start();
 }
 
 void StartRPCThreads()
@@ -550,6 +1012,11 @@ void StartRPCThreads()
     assert(rpc_io_service == NULL);
     rpc_io_service = new asio::io_service();
     rpc_ssl_context = new ssl::context(*rpc_io_service, ssl::context::sslv23);
+    int nWorkQueueDepth = std::max((int)GetArg("-rpcworkqueue", 16), 1);
+    rpc_work_queue = new CRPCWorkQueue(nWorkQueueDepth);
+    nRPCServerTimeout = std::max((int)GetArg("-rpcservertimeout", 30), 1);
+    fRESTEnabled = GetBoolArg("-rest", false);
+    fRESTAuth = GetBoolArg("-restauth", false);
 
     const bool fUseSSL = GetBoolArg("-rpcssl", false);
 
@@ -629,9 +1096,13 @@ void StartRPCThreads()
         return;
     }
 
+    // the calls run on the workers, all connections and timers on one I/O thread
+    nRPCWorkers = std::max((int)GetArg("-rpcthreads", 4), 1);
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nRPCWorkers; i++)
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Run, rpc_work_queue));
+    rpc_io_thread = new boost::thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    LogPrintf("RPC server using %d worker threads, work queue depth %d\n", nRPCWorkers, nWorkQueueDepth);
 }
 
 void StopRPCThreads()
@@ -639,10 +1110,17 @@ void StopRPCThreads()
     if (rpc_io_service == NULL) return;
 
     deadlineTimers.clear();
-    rpc_io_service->stop();
+
+    // workers in the middle of a chunked reply need the I/O thread to finish it
+    rpc_work_queue->Stop();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
+    rpc_io_service->stop();
+    if (rpc_io_thread != NULL)
+        rpc_io_thread->join();
+    delete rpc_io_thread; rpc_io_thread = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -708,161 +1186,354 @@ void JSONRequest::parse(const Value& valRequest)
 }
 
 
-static Object JSONRPCExecOne(const Value& req)
+// Throws if the method doesn't exist or can't run now
+static const CRPCCommand* FindRPCCommand(const string& strMethod)
 {
-    Object rpc_result;
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (!pcmd)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+#ifdef ENABLE_WALLET
+    if (pcmd->reqWallet && !pwalletMain)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
+#endif
 
-    JSONRequest jreq;
-    try {
-        jreq.parse(req);
+    // Observe safe mode
+    string strWarning = GetWarnings("rpc");
+    if (strWarning != "" && !GetBoolArg("-disablesafemode", false) &&
+        !pcmd->okSafeMode)
+        throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
-    }
-    catch (Object& objError)
-    {
-        rpc_result = JSONRPCReplyObj(Value::null, objError, jreq.id);
-    }
-    catch (std::exception& e)
+    return pcmd;
+}
+
+static void CallRPCCommand(const CRPCCommand *pcmd, const Array &params, CJSONWriter* pwriter, Value& result)
+{
+    if (pcmd->streamActor && pwriter)
+        (*pcmd->streamActor)(params, false, *pwriter);
+    else if (pcmd->streamActor)
     {
-        rpc_result = JSONRPCReplyObj(Value::null,
-                                     JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        CJSONTreeWriter writer;
+        (*pcmd->streamActor)(params, false, writer);
+        result = writer.GetValue();
     }
-
-    return rpc_result;
+    else if (pwriter)
+        pwriter->Write(pcmd->actor(params, false));
+    else
+        result = pcmd->actor(params, false);
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+// Thread-safe commands that only read, the ones a batch may run side by side and so out of order
+static const char* const vRPCParallelCommands[] =
 {
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    "help", "getbestblockhash", "getblockcount", "getaddednodeinfo", "getnettotals", "getdifficulty",
+    "getrawmempool", "getblock", "getblockbynumber", "getblockhash", "getrawtransaction",
+    "createrawtransaction", "decoderawtransaction", "decodescript", "dbstats", "verifymessage",
+    "searchrawtransactions", "getaddressbalance", "getsubsidy", "getstakesubsidy", "createmultisig",
+    "makekeypair", "masternodelist", "listtransactions", "listunspent", "getbalance",
+};
 
-    return write_string(Value(ret), false) + "\n";
+// How the entries of a batch run
+enum RPCBatchKind
+{
+    RPC_BATCH_PARALLEL,     // read-only thread-safe ones, side by side on the workers
+    RPC_BATCH_SERIAL,       // thread-safe ones that change state, in order without cs_main
+    RPC_BATCH_LOCKED        // the rest, in order under shared lock acquisitions
+};
+
+static RPCBatchKind GetRPCBatchKind(const CRPCCommand* pcmd)
+{
+    if (!pcmd->threadSafe)
+        return RPC_BATCH_LOCKED;
+    for (unsigned int i = 0; i < sizeof(vRPCParallelCommands) / sizeof(vRPCParallelCommands[0]); i++)
+        if (pcmd->name == vRPCParallelCommands[i])
+            return RPC_BATCH_PARALLEL;
+    return RPC_BATCH_SERIAL;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+class CRPCBatchEntry
 {
-    bool fRun = true;
-    while (fRun)
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
+public:
+    JSONRequest jreq;
+    const CRPCCommand *pcmd;
+    Object reply;
+    bool fDone;
 
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+    CRPCBatchEntry() : pcmd(NULL), fDone(false) {}
+};
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+static void ExecBatchEntries(std::vector<CRPCBatchEntry>& vEntries, unsigned int nBegin, unsigned int nEnd)
+{
+    for (unsigned int i = nBegin; i < nEnd; i++)
+    {
+        CRPCBatchEntry& entry = vEntries[i];
+        if (entry.fDone)
+            continue;
 
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
+        try
+        {
+            Value result;
+            CallRPCCommand(entry.pcmd, entry.jreq.params, NULL, result);
+            entry.reply = JSONRPCReplyObj(result, Value::null, entry.jreq.id);
         }
-
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
+        catch (Object& objError)
         {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            entry.reply = JSONRPCReplyObj(Value::null, objError, entry.jreq.id);
         }
-        if (!HTTPAuthorized(mapHeaders))
+        catch (std::exception& e)
         {
-            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string());
-            /* Deter brute-forcing short passwords.
-               If this results in a DoS the user really
-               shouldn't have their RPC port exposed. */
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
-
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            entry.reply = JSONRPCReplyObj(Value::null, JSONRPCError(RPC_MISC_ERROR, e.what()), entry.jreq.id);
         }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+        entry.fDone = true;
+    }
+}
 
-        JSONRequest jreq;
-        try
+// Locked entries run in order, RPC_BATCH_LOCK_GROUP at a time under one cs_main/cs_wallet acquisition
+static void ExecBatchLocked(std::vector<CRPCBatchEntry>& vEntries, unsigned int nBegin, unsigned int nEnd)
+{
+    for (unsigned int nGroup = nBegin; nGroup < nEnd; nGroup += RPC_BATCH_LOCK_GROUP)
+    {
+        unsigned int nGroupEnd = std::min(nEnd, nGroup + RPC_BATCH_LOCK_GROUP);
+#ifdef ENABLE_WALLET
+        if (pwalletMain)
         {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            ExecBatchEntries(vEntries, nGroup, nGroupEnd);
+        }
+        else
+#endif
+        {
+            LOCK(cs_main);
+            ExecBatchEntries(vEntries, nGroup, nGroupEnd);
+        }
+    }
+}
 
-            string strReply;
+//
+// Thread-safe entries of a batch, split in slices that are offered to the RPC workers. The thread
+// running the batch works through the slices as well, so the batch finishes even when every worker
+// is busy. A slice is run by whoever claims it first, a worker that comes too late does nothing.
+//
+class CRPCBatchSlices
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CRPCBatchEntry>* pvEntries;
+    std::vector<std::pair<unsigned int, unsigned int> > vSlices;
+    std::vector<char> vClaimed;
+    unsigned int nDone;
+
+    bool Claim(unsigned int nSlice)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vClaimed[nSlice])
+            return false;
+        vClaimed[nSlice] = true;
+        return true;
+    }
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+public:
+    CRPCBatchSlices(std::vector<CRPCBatchEntry>* pvEntriesIn, unsigned int nBegin, unsigned int nEnd, unsigned int nSlices) :
+        pvEntries(pvEntriesIn), nDone(0)
+    {
+        unsigned int nPerSlice = (nEnd - nBegin + nSlices - 1) / nSlices;
+        for (unsigned int i = nBegin; i < nEnd; i += nPerSlice)
+            vSlices.push_back(std::make_pair(i, std::min(nEnd, i + nPerSlice)));
+        vClaimed.resize(vSlices.size(), false);
+    }
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+    unsigned int Size() const { return vSlices.size(); }
+
+    void Run(unsigned int nSlice)
+    {
+        if (!Claim(nSlice))
+            return;
+
+        ExecBatchEntries(*pvEntries, vSlices[nSlice].first, vSlices[nSlice].second);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nDone++;
+        cond.notify_all();
+    }
+
+    // Run what the workers haven't taken and wait for the rest
+    void RunAndWait()
+    {
+        for (unsigned int i = 0; i < vSlices.size(); i++)
+            Run(i);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nDone < vSlices.size())
+            cond.wait(lock);
+    }
+};
 
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+static void ExecBatchParallel(std::vector<CRPCBatchEntry>& vEntries, unsigned int nBegin, unsigned int nEnd)
+{
+    unsigned int nSlices = std::min((unsigned int)nRPCWorkers, (nEnd - nBegin + RPC_BATCH_SLICE_SIZE - 1) / RPC_BATCH_SLICE_SIZE);
+    if (nSlices <= 1 || rpc_work_queue == NULL)
+    {
+        ExecBatchEntries(vEntries, nBegin, nEnd);
+        return;
+    }
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+    // the batch thread starts at the first slice, the workers are offered the others outside the
+    // request queue; any they don't get to, the batch thread runs itself
+    boost::shared_ptr<CRPCBatchSlices> slices(new CRPCBatchSlices(&vEntries, nBegin, nEnd, nSlices));
+    for (unsigned int i = slices->Size() - 1; i > 0; i--)
+        rpc_work_queue->EnqueueSlice(boost::bind(&CRPCBatchSlices::Run, slices, i));
+    slices->RunAndWait();
+}
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
+//
+// A batch is parsed as a whole first, then consecutive entries of the same kind run together:
+// read-only thread-safe ones side by side on the workers, the others in order, under shared lock
+// acquisitions unless they are thread-safe. The runs follow each other in batch order, and only
+// entries that change nothing run out of order, so an entry still sees the effects of the ones
+// before it. Replies are written as each run completes.
+//
+static void JSONRPCExecBatch(const Array& vReq, CJSONWriter& writer)
+{
+    std::vector<CRPCBatchEntry> vEntries(vReq.size());
+    for (unsigned int i = 0; i < vReq.size(); i++)
+    {
+        CRPCBatchEntry& entry = vEntries[i];
+        try
+        {
+            entry.jreq.parse(vReq[i]);
+            entry.pcmd = FindRPCCommand(entry.jreq.strMethod);
         }
         catch (Object& objError)
         {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
+            entry.reply = JSONRPCReplyObj(Value::null, objError, entry.jreq.id);
+            entry.fDone = true;
         }
         catch (std::exception& e)
         {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+            entry.reply = JSONRPCReplyObj(Value::null, JSONRPCError(RPC_PARSE_ERROR, e.what()), entry.jreq.id);
+            entry.fDone = true;
+        }
+    }
+
+    writer.BeginArray();
+    unsigned int nBegin = 0;
+    while (nBegin < vEntries.size())
+    {
+        // entries that already have their reply go along with any run
+        RPCBatchKind kind = vEntries[nBegin].fDone ? RPC_BATCH_PARALLEL : GetRPCBatchKind(vEntries[nBegin].pcmd);
+        unsigned int nEnd = nBegin + 1;
+        while (nEnd < vEntries.size() && (vEntries[nEnd].fDone || GetRPCBatchKind(vEntries[nEnd].pcmd) == kind))
+            nEnd++;
+
+        if (kind == RPC_BATCH_PARALLEL)
+            ExecBatchParallel(vEntries, nBegin, nEnd);
+        else if (kind == RPC_BATCH_SERIAL)
+            ExecBatchEntries(vEntries, nBegin, nEnd);
+        else
+            ExecBatchLocked(vEntries, nBegin, nEnd);
+
+        for (unsigned int i = nBegin; i < nEnd; i++)
+        {
+            writer.Write(vEntries[i].reply);
+            Object().swap(vEntries[i].reply);
         }
+        nBegin = nEnd;
     }
+    writer.EndArray();
+}
+
+// Writes the reply into writer. False if the call failed after part of the reply was sent, the
+// connection can only be closed then.
+static bool ExecuteRPCRequest(const string& strRequest, int& nStatus, CJSONStreamWriter& writer)
+{
+    JSONRequest jreq;
+    try
+    {
+        // Parse request
+        Value valRequest;
+        if (!read_string(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+
+        // singleton request, the result goes out as the command writes it
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
+
+            writer.BeginObject();
+            writer.Key("result");
+            tableRPC.execute(jreq.strMethod, jreq.params, writer);
+            writer.WritePair("error", Value::null);
+            writer.WritePair("id", jreq.id);
+            writer.EndObject();
+
+        // array of requests
+        } else if (valRequest.type() == array_type)
+            JSONRPCExecBatch(valRequest.get_array(), writer);
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+
+        writer.EndLine();
+        nStatus = HTTP_OK;
+    }
+    catch (Object& objError)
+    {
+        if (writer.HasFlushed())
+            return false;
+        ErrorReply(objError, jreq.id, nStatus, writer);
+    }
+    catch (std::exception& e)
+    {
+        if (writer.HasFlushed())
+            return false;
+        ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, nStatus, writer);
+    }
+    return true;
 }
 
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
 {
-    // Find method
-    const CRPCCommand *pcmd = tableRPC[strMethod];
-    if (!pcmd)
-        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
-#ifdef ENABLE_WALLET
-    if (pcmd->reqWallet && !pwalletMain)
-        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found (disabled)");
-#endif
+    Value result;
+    execute(strMethod, params, NULL, result);
+    return result;
+}
 
-    // Observe safe mode
-    string strWarning = GetWarnings("rpc");
-    if (strWarning != "" && !GetBoolArg("-disablesafemode", false) &&
-        !pcmd->okSafeMode)
-        throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONWriter& writer) const
+{
+    Value result;
+    execute(strMethod, params, &writer, result);
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONWriter* pwriter, json_spirit::Value& result) const
+{
+    // Find method
+    const CRPCCommand *pcmd = FindRPCCommand(strMethod);
 
     try
     {
         // Execute
-        Value result;
+        if (pcmd->threadSafe)
+            CallRPCCommand(pcmd, params, pwriter, result);
+        else
         {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
+            // a slow client mustn't hold up the locks, the output is sent after they are released
+            if (pwriter)
+                pwriter->SetBuffered(true);
 #ifdef ENABLE_WALLET
-            else if (!pwalletMain) {
+            if (!pwalletMain) {
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                CallRPCCommand(pcmd, params, pwriter, result);
             } else {
                 LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+                CallRPCCommand(pcmd, params, pwriter, result);
             }
 #else // ENABLE_WALLET
-            else {
+            {
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                CallRPCCommand(pcmd, params, pwriter, result);
             }
 #endif // !ENABLE_WALLET
+            if (pwriter)
+                pwriter->SetBuffered(false);
         }
-        return result;
     }
     catch (std::exception& e)
     {
@@ -562,7 +562,21 @@ Value smsgsendanon(const Array& params, bool fHelp)
     return result;
 }
 
-Value smsginbox(const Array& params, bool fHelp)
+// Position it so that NextSmesg goes on after chKey, false if nothing follows it
+static bool SeekSmesgAfter(leveldb::Iterator* it, const unsigned char* chKey)
+{
+    leveldb::Slice key((const char*)chKey, 18);
+    it->Seek(key);
+    if (!it->Valid())
+        return false;
+
+    // chKey itself is gone, NextSmesg has to land on the key after it
+    if (it->key().compare(key) != 0)
+        it->Prev();
+    return true;
+}
+
+void smsginbox(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 1) // defaults to read
         throw runtime_error(
@@ -582,14 +596,20 @@ Value smsginbox(const Array& params, bool fHelp)
         mode = params[0].get_str();
     }
 
-
-    Object result;
-
     std::vector<unsigned char> vchKey;
     vchKey.resize(16);
     memset(&vchKey[0], 0, 16);
 
+    uint32_t nMessages = 0;
+    char cbuf[256];
+
+    std::string sPrefix("im");
+    unsigned char chKey[18];
+
+    writer.BeginObject();
+    if (mode == "clear")
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         LOCK(cs_smsgDB);
 
         SecMsgDB dbInbox;
@@ -597,82 +617,97 @@ Value smsginbox(const Array& params, bool fHelp)
         if (!dbInbox.Open("cr+"))
             throw runtime_error("Could not open DB.");
 
-        uint32_t nMessages = 0;
-        char cbuf[256];
+        dbInbox.TxnBegin();
 
-        std::string sPrefix("im");
-        unsigned char chKey[18];
-
-        if (mode == "clear")
+        leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
+        while (dbInbox.NextSmesgKey(it, sPrefix, chKey))
         {
-            dbInbox.TxnBegin();
+            dbInbox.EraseSmesg(chKey);
+            nMessages++;
+        };
+        delete it;
+        dbInbox.TxnCommit();
 
-            leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbInbox.NextSmesgKey(it, sPrefix, chKey))
-            {
-                dbInbox.EraseSmesg(chKey);
-                nMessages++;
-            };
-            delete it;
-            dbInbox.TxnCommit();
+        snprintf(cbuf, sizeof(cbuf), "Deleted %u messages.", nMessages);
+        writer.WritePair("result", std::string(cbuf));
+    } else
+    if (mode == "all"
+        || mode == "unread")
+    {
+        int fCheckReadStatus = mode == "unread" ? 1 : 0;
 
-            snprintf(cbuf, sizeof(cbuf), "Deleted %u messages.", nMessages);
-            result.push_back(Pair("result", std::string(cbuf)));
-        } else
-        if (mode == "all"
-            || mode == "unread")
+        // messages are decrypted a batch per lock acquisition and written after the locks are released
+        bool fFirst = true;
+        bool fMore = true;
+        while (fMore)
         {
-            int fCheckReadStatus = mode == "unread" ? 1 : 0;
+            Object result;
+            {
+                LOCK2(cs_main, pwalletMain->cs_wallet);
+                LOCK(cs_smsgDB);
 
-            SecMsgStored smsgStored;
-            MessageData msg;
+                SecMsgDB dbInbox;
 
-            dbInbox.TxnBegin();
+                if (!dbInbox.Open("cr+"))
+                    throw runtime_error("Could not open DB.");
 
-            leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbInbox.NextSmesg(it, sPrefix, chKey, smsgStored))
-            {
-                if (fCheckReadStatus
-                    && !(smsgStored.status & SMSG_MASK_UNREAD))
-                    continue;
+                SecMsgStored smsgStored;
+                MessageData msg;
 
-                uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
-                if (SecureMsgDecrypt(false, smsgStored.sAddrTo, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
-                {
-                    Object objM;
-                    objM.push_back(Pair("received", getTimeString(smsgStored.timeReceived, cbuf, sizeof(cbuf))));
-                    objM.push_back(Pair("sent", getTimeString(msg.timestamp, cbuf, sizeof(cbuf))));
-                    objM.push_back(Pair("from", msg.sFromAddress));
-                    objM.push_back(Pair("to", smsgStored.sAddrTo));
-                    objM.push_back(Pair("text", std::string((char*)&msg.vchMessage[0]))); // ugh
+                dbInbox.TxnBegin();
 
-                    result.push_back(Pair("message", objM));
-                } else
+                leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
+                fMore = fFirst || SeekSmesgAfter(it, chKey);
+                unsigned int n = 0;
+                while (fMore && n < JSON_STREAM_LOCK_BATCH && dbInbox.NextSmesg(it, sPrefix, chKey, smsgStored))
                 {
-                    result.push_back(Pair("message", "Could not decrypt."));
-                };
+                    n++;
+                    if (fCheckReadStatus
+                        && !(smsgStored.status & SMSG_MASK_UNREAD))
+                        continue;
 
-                if (fCheckReadStatus)
-                {
-                    smsgStored.status &= ~SMSG_MASK_UNREAD;
-                    dbInbox.WriteSmesg(chKey, smsgStored);
+                    uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+                    if (SecureMsgDecrypt(false, smsgStored.sAddrTo, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
+                    {
+                        Object objM;
+                        objM.push_back(Pair("received", getTimeString(smsgStored.timeReceived, cbuf, sizeof(cbuf))));
+                        objM.push_back(Pair("sent", getTimeString(msg.timestamp, cbuf, sizeof(cbuf))));
+                        objM.push_back(Pair("from", msg.sFromAddress));
+                        objM.push_back(Pair("to", smsgStored.sAddrTo));
+                        objM.push_back(Pair("text", std::string((char*)&msg.vchMessage[0]))); // ugh
+
+                        result.push_back(Pair("message", objM));
+                    } else
+                    {
+                        result.push_back(Pair("message", "Could not decrypt."));
+                    };
+
+                    if (fCheckReadStatus)
+                    {
+                        smsgStored.status &= ~SMSG_MASK_UNREAD;
+                        dbInbox.WriteSmesg(chKey, smsgStored);
+                    };
+                    nMessages++;
                 };
-                nMessages++;
-            };
-            delete it;
-            dbInbox.TxnCommit();
+                fMore = fMore && n == JSON_STREAM_LOCK_BATCH;
+                delete it;
+                dbInbox.TxnCommit();
+            }
+            fFirst = false;
 
-            snprintf(cbuf, sizeof(cbuf), "%u messages shown.", nMessages);
-            result.push_back(Pair("result", std::string(cbuf)));
+            BOOST_FOREACH(const Pair& pair, result)
+                writer.WritePair(pair.name_, pair.value_);
+        }
 
-        } else
-        {
-            result.push_back(Pair("result", "Unknown Mode."));
-            result.push_back(Pair("expected", "[all|unread|clear]."));
-        };
-    }
+        snprintf(cbuf, sizeof(cbuf), "%u messages shown.", nMessages);
+        writer.WritePair("result", std::string(cbuf));
 
-    return result;
+    } else
+    {
+        writer.WritePair("result", "Unknown Mode.");
+        writer.WritePair("expected", "[all|unread|clear].");
+    };
+    writer.EndObject();
 };
 
 Value smsgoutbox(const Array& params, bool fHelp)
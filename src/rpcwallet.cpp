@@ -51,7 +51,8 @@ void EnsureWalletIsUnlocked()
 
 void WalletTxToJSON(const CWalletTx& wtx, Object& entry)
 {
-    int confirms = wtx.GetDepthInMainChain(false);
+    CBlockIndex* pindex = NULL;
+    int confirms = wtx.GetDepthInMainChain(pindex, false);
     int confirmsTotal = GetIXConfirmations(wtx.GetHash()) + confirms;
     entry.push_back(Pair("confirmations", confirmsTotal));
     entry.push_back(Pair("bcconfirmations", confirms));
@@ -61,7 +62,7 @@ void WalletTxToJSON(const CWalletTx& wtx, Object& entry)
     {
         entry.push_back(Pair("blockhash", wtx.hashBlock.GetHex()));
         entry.push_back(Pair("blockindex", wtx.nIndex));
-        entry.push_back(Pair("blocktime", (int64_t)(mapBlockIndex[wtx.hashBlock]->nTime)));
+        entry.push_back(Pair("blocktime", (int64_t)pindex->nTime));
     }
     uint256 hash = wtx.GetHash();
     entry.push_back(Pair("txid", hash.GetHex()));
@@ -764,6 +765,10 @@ Value getbalance(const Array& params, bool fHelp)
         if(params[2].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
+    // runs thread-safe: depths come from one cs_main snapshot, the wallet is only held shared
+    CChainDepthSnapshot depths(pwalletMain->GetTxBlockHashes());
+    LOCK_SHARED(pwalletMain->cs_wallet);
+
     if (params[0].get_str() == "*") {
         // Calculate total balance a different way from GetBalance()
         // (GetBalance() sums up all unspent TxOuts)
@@ -1457,7 +1462,7 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+void listtransactions(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 4)
         throw runtime_error(
@@ -1535,39 +1540,99 @@ Value listtransactions(const Array& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    Array ret;
-
-    const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    // The window is found first: walking back from the newest transaction, until nFrom+nCount entries
+    // are counted. It is then written oldest to newest, a batch of transactions per lock acquisition.
+    // Transactions are found again by order position, as the locks are let go in between.
+    int64_t nPosFirst = 0;
+    int64_t nPosLast = 0;
+    int nDupSkip = 0;       // transactions at nPosFirst that are older than the window
+    int nTotal = 0;
+    // depths come from one cs_main snapshot, the wallet is only held shared
+    CChainDepthSnapshot depths(pwalletMain->GetTxBlockHashes());
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
-
-        if ((int)ret.size() >= (nCount+nFrom)) break;
+        LOCK_SHARED(pwalletMain->cs_wallet);
+        const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+        int nDupVisited = 0;
+        for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        {
+            Array ret;
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, strAccount, ret);
+
+            if (it == txOrdered.rbegin())
+                nPosLast = (*it).first;
+            if (it != txOrdered.rbegin() && (*it).first == nPosFirst)
+                nDupVisited++;
+            else
+                nDupVisited = 1;
+            nPosFirst = (*it).first;
+
+            nTotal += ret.size();
+            if (nTotal >= (nCount+nFrom)) break;
+        }
+        if (nTotal > 0)
+            nDupSkip = txOrdered.count(nPosFirst) - nDupVisited;
     }
-    // ret is newest to oldest
 
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom+nCount);
+    // the entries counted from the newest on are [nFrom, nFrom+nCount), oldest to newest they follow nSkip older ones
+    int nSkip = nTotal - std::min(nTotal, nCount+nFrom);
+    int nLeft = std::max(0, std::min(nTotal, nCount+nFrom) - nFrom);
 
-    if (last != ret.end()) ret.erase(last, ret.end());
-    if (first != ret.begin()) ret.erase(ret.begin(), first);
+    writer.BeginArray();
+    int64_t nPosNext = nPosFirst;
+    int nDupNext = nDupSkip;
+    while (nLeft > 0)
+    {
+        Array entries;
+        bool fMore;
+        {
+            LOCK_SHARED(pwalletMain->cs_wallet);
+            const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+            CWallet::TxItems::const_iterator it = txOrdered.lower_bound(nPosNext);
+            for (int i = 0; i < nDupNext && it != txOrdered.end() && (*it).first == nPosNext; i++)
+                ++it;
+            for (unsigned int n = 0; n < JSON_STREAM_LOCK_BATCH && nLeft > 0 && it != txOrdered.end() && (*it).first <= nPosLast; ++it, ++n)
+            {
+                if ((*it).first == nPosNext)
+                    nDupNext++;
+                else
+                {
+                    nPosNext = (*it).first;
+                    nDupNext = 1;
+                }
 
-    std::reverse(ret.begin(), ret.end()); // Return oldest to newest
+                Array ret;
+                CWalletTx *const pwtx = (*it).second.first;
+                if (pwtx != 0)
+                    ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+                CAccountingEntry *const pacentry = (*it).second.second;
+                if (pacentry != 0)
+                    AcentryToJSON(*pacentry, strAccount, ret);
 
-    return ret;
+                // the newest-first list used to be reversed as a whole, entries of one transaction too
+                for (Array::reverse_iterator ri = ret.rbegin(); ri != ret.rend() && nLeft > 0; ++ri)
+                {
+                    if (nSkip > 0)
+                    {
+                        nSkip--;
+                        continue;
+                    }
+                    entries.push_back(*ri);
+                    nLeft--;
+                }
+            }
+            fMore = it != txOrdered.end() && (*it).first <= nPosLast;
+        }
+        BOOST_FOREACH(const Value& entry, entries)
+            writer.Write(entry);
+        if (!fMore)
+            break;
+    }
+    writer.EndArray();
 }
 
 Value listaccounts(const Array& params, bool fHelp)
@@ -1825,7 +1890,7 @@ Value gettransaction(const Array& params, bool fHelp)
             else
             {
                 entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
                 if (mi != mapBlockIndex.end() && (*mi).second)
                 {
                     CBlockIndex* pindex = (*mi).second;
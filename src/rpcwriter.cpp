@@ -0,0 +1,155 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcwriter.h"
+
+#include "json/json_spirit_writer_template.h"
+
+#include <stdexcept>
+
+using namespace std;
+using namespace json_spirit;
+
+Value* CJSONTreeWriter::Add(const Value& value)
+{
+    if (vOpen.empty())
+    {
+        root = value;
+        return &root;
+    }
+
+    // only the innermost open container grows, so the pointers to the outer ones stay valid
+    Value& parent = *vOpen.back();
+    if (parent.type() == array_type)
+    {
+        parent.get_array().push_back(value);
+        return &parent.get_array().back();
+    }
+    parent.get_obj().push_back(Pair(strKey, value));
+    return &parent.get_obj().back().value_;
+}
+
+void CJSONTreeWriter::BeginObject()
+{
+    vOpen.push_back(Add(Object()));
+}
+
+void CJSONTreeWriter::EndObject()
+{
+    vOpen.pop_back();
+}
+
+void CJSONTreeWriter::BeginArray()
+{
+    vOpen.push_back(Add(Array()));
+}
+
+void CJSONTreeWriter::EndArray()
+{
+    vOpen.pop_back();
+}
+
+void CJSONTreeWriter::Key(const std::string& strKeyIn)
+{
+    strKey = strKeyIn;
+}
+
+void CJSONTreeWriter::Write(const Value& value)
+{
+    Add(value);
+}
+
+CJSONStreamWriter::CJSONStreamWriter(const FlushFunction& flushIn) : flush(flushIn)
+{
+    fAfterKey = false;
+    fBuffered = false;
+    fFlushed = false;
+    strBuffer.reserve(JSON_STREAM_FLUSH_SIZE);
+}
+
+void CJSONStreamWriter::Separate()
+{
+    // a member's value follows its key directly
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (vEmpty.empty())
+        return;
+    if (!vEmpty.back())
+        strBuffer += ',';
+    vEmpty.back() = false;
+}
+
+void CJSONStreamWriter::Check()
+{
+    if (fBuffered || flush.empty() || strBuffer.size() < JSON_STREAM_FLUSH_SIZE)
+        return;
+
+    fFlushed = true;
+    if (!flush(strBuffer))
+        throw runtime_error("RPC client disconnected");
+    strBuffer.clear();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    strBuffer += '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    strBuffer += '}';
+    vEmpty.pop_back();
+    Check();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    strBuffer += '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    strBuffer += ']';
+    vEmpty.pop_back();
+    Check();
+}
+
+void CJSONStreamWriter::Key(const std::string& strKey)
+{
+    Separate();
+    strBuffer += write_string(Value(strKey), false);
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    Separate();
+    strBuffer += write_string(value, false);
+    Check();
+}
+
+void CJSONStreamWriter::SetBuffered(bool fBufferedIn)
+{
+    fBuffered = fBufferedIn;
+}
+
+void CJSONStreamWriter::EndLine()
+{
+    strBuffer += '\n';
+}
+
+void CJSONStreamWriter::Clear()
+{
+    strBuffer.clear();
+    vEmpty.clear();
+    fAfterKey = false;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef RPCWRITER_H
+#define RPCWRITER_H
+
+#include "json/json_spirit_value.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+// bytes of output a streaming writer collects before handing them out
+#define JSON_STREAM_FLUSH_SIZE                (64 * 1024)
+// items a streaming command that needs cs_main/cs_wallet lists per lock acquisition; it writes them
+// after releasing the locks, so a slow client doesn't hold them
+#define JSON_STREAM_LOCK_BATCH                1000
+
+//
+// Receives a JSON value piece by piece, so an RPC call can emit a large result as it goes instead
+// of building the whole json_spirit tree first. Arrays and objects are opened and closed
+// explicitly, anything else is written as one json_spirit value. Every member of an object starts
+// with Key.
+//
+class CJSONWriter
+{
+public:
+    virtual ~CJSONWriter() {}
+
+    virtual void BeginObject() = 0;
+    virtual void EndObject() = 0;
+    virtual void BeginArray() = 0;
+    virtual void EndArray() = 0;
+    virtual void Key(const std::string& strKey) = 0;
+    virtual void Write(const json_spirit::Value& value) = 0;
+
+    // Keep the output until called with false, for while the call holds locks a slow client mustn't hold up
+    virtual void SetBuffered(bool fBufferedIn) {}
+
+    void WritePair(const std::string& strKey, const json_spirit::Value& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+};
+
+//
+// Builds the json_spirit value, for callers that need the result as a whole
+//
+class CJSONTreeWriter : public CJSONWriter
+{
+private:
+    json_spirit::Value root;
+    std::vector<json_spirit::Value*> vOpen;
+    std::string strKey;
+
+    json_spirit::Value* Add(const json_spirit::Value& value);
+
+public:
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKeyIn);
+    void Write(const json_spirit::Value& value);
+
+    const json_spirit::Value& GetValue() const { return root; }
+};
+
+//
+// Encodes JSON text the same way write_string does. Whenever JSON_STREAM_FLUSH_SIZE bytes are
+// collected they are handed to the flush function, which may take them by swapping the string.
+// Without a flush function, or while buffered, everything is kept.
+//
+class CJSONStreamWriter : public CJSONWriter
+{
+public:
+    // false if the output can't be delivered any more, the writer throws then to end the call
+    typedef boost::function<bool (std::string& strData)> FlushFunction;
+
+private:
+    std::string strBuffer;
+    FlushFunction flush;
+    std::vector<bool> vEmpty;   // per open container, nothing written into it yet
+    bool fAfterKey;
+    bool fBuffered;
+    bool fFlushed;
+
+    void Separate();
+    void Check();
+
+public:
+    CJSONStreamWriter(const FlushFunction& flushIn = FlushFunction());
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    void SetBuffered(bool fBufferedIn);
+
+    // End the text with a newline like the other replies
+    void EndLine();
+    // Drop what wasn't handed out yet, to write something else instead
+    void Clear();
+
+    // Part of the output was handed out, so it can't be replaced any more
+    bool HasFlushed() const { return fFlushed; }
+    // Output that wasn't handed out yet
+    std::string& GetBuffer() { return strBuffer; }
+};
+
+#endif
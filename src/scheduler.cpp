@@ -0,0 +1,137 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "scheduler.h"
+#include "util.h"
+
+using namespace std;
+
+// lock time of the task running on this thread, only set on scheduler threads
+class CTaskLockTime
+{
+public:
+    int64_t nTime;          // us
+    int nTimers;            // open CSchedulerLockTimers, only the outermost one counts
+
+    CTaskLockTime() : nTime(0), nTimers(0) {}
+};
+static boost::thread_specific_ptr<CTaskLockTime> pTaskLockTime;
+
+CSchedulerLockTimer::CSchedulerLockTimer()
+{
+    CTaskLockTime* pLockTime = pTaskLockTime.get();
+    nStart = (pLockTime && pLockTime->nTimers++ == 0) ? GetTimeMicros() : 0;
+}
+
+CSchedulerLockTimer::~CSchedulerLockTimer()
+{
+    CTaskLockTime* pLockTime = pTaskLockTime.get();
+    if (pLockTime && --pLockTime->nTimers == 0)
+        pLockTime->nTime += GetTimeMicros() - nStart;
+}
+
+void CScheduler::ScheduleLocked(CTask& task, int64_t nTime)
+{
+    if (task.fQueued)
+    {
+        if (task.itQueue->first <= nTime)
+            return;
+        mapQueue.erase(task.itQueue);
+    }
+
+    task.itQueue = mapQueue.insert(make_pair(nTime, task.stats.strName));
+    task.fQueued = true;
+    task.stats.nNextRun = nTime;
+
+    // the service thread might be waiting for a later deadline
+    if (task.itQueue == mapQueue.begin())
+        condQueue.notify_one();
+}
+
+void CScheduler::AddTask(const std::string& strName, Function func, int64_t nInterval, int64_t nDelay)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    CTask& task = mapTasks[strName];
+    task.func = func;
+    task.stats.strName = strName;
+    task.stats.nInterval = nInterval;
+
+    ScheduleLocked(task, GetTimeMillis() + nDelay);
+}
+
+void CScheduler::Schedule(const std::string& strName, int64_t nTime)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    std::map<std::string, CTask>::iterator it = mapTasks.find(strName);
+    if (it == mapTasks.end())
+        return;
+
+    ScheduleLocked(it->second, nTime);
+}
+
+void CScheduler::Trigger(const std::string& strName)
+{
+    Schedule(strName, GetTimeMillis());
+}
+
+void CScheduler::ServiceQueue()
+{
+    pTaskLockTime.reset(new CTaskLockTime());
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        if (mapQueue.empty())
+        {
+            condQueue.wait(lock);
+            continue;
+        }
+
+        int64_t nNow = GetTimeMillis();
+        std::multimap<int64_t, std::string>::iterator itNext = mapQueue.begin();
+        if (itNext->first > nNow)
+        {
+            // woken up early when a task is moved forward, so look at the queue again either way
+            condQueue.timed_wait(lock, boost::posix_time::milliseconds(itNext->first - nNow));
+            continue;
+        }
+
+        CTask& task = mapTasks[itNext->second];
+        mapQueue.erase(itNext);
+        task.fQueued = false;
+        task.stats.nNextRun = 0;
+
+        // the task can reschedule itself while it runs, so don't hold the queue
+        Function func = task.func;
+        pTaskLockTime->nTime = 0;
+        int64_t nStart = GetTimeMicros();
+        lock.unlock();
+        func();
+        lock.lock();
+        int64_t nTime = GetTimeMicros() - nStart;
+
+        task.stats.nRuns++;
+        task.stats.nLastRun = GetTimeMillis();
+        task.stats.nTotalTime += nTime;
+        task.stats.nMaxTime = max(task.stats.nMaxTime, nTime);
+        task.stats.nTotalLockTime += pTaskLockTime->nTime;
+        task.stats.nMaxLockTime = max(task.stats.nMaxLockTime, pTaskLockTime->nTime);
+
+        if (task.stats.nInterval > 0)
+            ScheduleLocked(task, task.stats.nLastRun + task.stats.nInterval);
+    }
+}
+
+void CScheduler::GetStats(std::vector<CTaskStats>& vStats)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    vStats.clear();
+    for (std::map<std::string, CTask>::const_iterator it = mapTasks.begin(); it != mapTasks.end(); ++it)
+        vStats.push_back(it->second.stats);
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2015 The Arion developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+//
+// Runs named maintenance tasks on one thread, each when its deadline comes up.
+//
+// Instead of polling, a task is scheduled for the time it next has something to do or triggered
+// by the event that gives it work (a new block, a pool state change, a new lock, ...). A task
+// with an interval runs again at the latest that long after its previous run. Scheduling a task
+// that is already due earlier does nothing, so a running task can move its next run forward by
+// scheduling itself.
+//
+class CScheduler
+{
+public:
+    typedef boost::function<void (void)> Function;
+
+    class CTaskStats
+    {
+    public:
+        std::string strName;
+        int64_t nInterval;          // ms, 0 if the task only runs when scheduled
+        int64_t nNextRun;           // ms, 0 if not scheduled
+        int64_t nLastRun;           // ms
+        uint64_t nRuns;
+        int64_t nTotalTime;         // us spent running
+        int64_t nMaxTime;           // us
+        int64_t nTotalLockTime;     // us spent holding locks measured by CSchedulerLockTimer
+        int64_t nMaxLockTime;       // us
+
+        CTaskStats()
+        {
+            nInterval = 0;
+            nNextRun = 0;
+            nLastRun = 0;
+            nRuns = 0;
+            nTotalTime = 0;
+            nMaxTime = 0;
+            nTotalLockTime = 0;
+            nMaxLockTime = 0;
+        }
+    };
+
+private:
+    class CTask
+    {
+    public:
+        Function func;
+        CTaskStats stats;
+        std::multimap<int64_t, std::string>::iterator itQueue;
+        bool fQueued;
+
+        CTask() : fQueued(false) {}
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condQueue;
+    // name -> task
+    std::map<std::string, CTask> mapTasks;
+    // deadline (ms) -> task name
+    std::multimap<int64_t, std::string> mapQueue;
+
+    void ScheduleLocked(CTask& task, int64_t nTime);
+
+public:
+    // Add a task running first nDelay ms from now and then at least every nInterval ms (0: only when scheduled)
+    void AddTask(const std::string& strName, Function func, int64_t nInterval, int64_t nDelay = 0);
+
+    // Run the task at nTime (ms) unless it is already due earlier. Unknown tasks are ignored
+    void Schedule(const std::string& strName, int64_t nTime);
+
+    // Run the task as soon as possible
+    void Trigger(const std::string& strName);
+
+    // Run tasks as they come due, until the thread is interrupted
+    void ServiceQueue();
+
+    void GetStats(std::vector<CTaskStats>& vStats);
+};
+
+//
+// Charges the time the enclosing scope runs to the lock time of the scheduler task running on this
+// thread, if any. Declare it right after taking the lock to be measured. A timer inside another one
+// adds nothing, so callees can be measured on their own too.
+//
+class CSchedulerLockTimer
+{
+private:
+    int64_t nStart;
+
+public:
+    CSchedulerLockTimer();
+    ~CSchedulerLockTimer();
+};
+
+#endif
@@ -14,6 +14,8 @@
 #include "protocol.h"
 #include "spork.h"
 #include "main.h"
+#include <boost/atomic.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
 using namespace std;
@@ -24,8 +26,56 @@ class CSporkManager;
 
 CSporkManager sporkManager;
 
-std::map<uint256, CSporkMessage> mapSporks;
-std::map<int, CSporkMessage> mapSporksActive;
+// guards the spork maps and publishing snapshots
+static CCriticalSection cs_spork;
+static std::map<uint256, CSporkMessage> mapSporks;
+static std::map<int, CSporkMessage> mapSporksActive;
+static const CSporkSnapshot sporkDefaults;
+static boost::atomic<const CSporkSnapshot*> pSporkSnapshot(&sporkDefaults);
+// every snapshot published so far, see CSporkSnapshot
+static std::vector<const CSporkSnapshot*> vSporkSnapshots;
+
+CSporkSnapshot::CSporkSnapshot()
+{
+    for(int i = 0; i <= SPORK_END - SPORK_START; i++)
+        nValue[i] = -1;
+
+    nValue[SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT - SPORK_START] = SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
+    nValue[SPORK_2_INSTANTX - SPORK_START] = SPORK_2_INSTANTX_DEFAULT;
+    nValue[SPORK_3_INSTANTX_BLOCK_FILTERING - SPORK_START] = SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
+    nValue[SPORK_5_MAX_VALUE - SPORK_START] = SPORK_5_MAX_VALUE_DEFAULT;
+    nValue[SPORK_6_REPLAY_BLOCKS - SPORK_START] = SPORK_6_REPLAY_BLOCKS_DEFAULT;
+    nValue[SPORK_7_MASTERNODE_SCANNING - SPORK_START] = SPORK_7_MASTERNODE_SCANNING;
+    nValue[SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT - SPORK_START] = SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT_DEFAULT;
+    nValue[SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT - SPORK_START] = SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT_DEFAULT;
+    nValue[SPORK_10_MASTERNODE_PAY_UPDATED_NODES - SPORK_START] = SPORK_10_MASTERNODE_PAY_UPDATED_NODES_DEFAULT;
+    nValue[SPORK_11_RESET_BUDGET - SPORK_START] = SPORK_11_RESET_BUDGET_DEFAULT;
+    nValue[SPORK_12_RECONSIDER_BLOCKS - SPORK_START] = SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
+    nValue[SPORK_13_ENABLE_SUPERBLOCKS - SPORK_START] = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
+}
+
+// Publish the active sporks as a new snapshot, cs_spork must be held
+static void PublishSporks()
+{
+    CSporkSnapshot* psnapshot = new CSporkSnapshot();
+    for(std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin(); it != mapSporksActive.end(); ++it)
+        if(it->first >= SPORK_START && it->first <= SPORK_END)
+            psnapshot->nValue[it->first - SPORK_START] = it->second.nValue;
+
+    vSporkSnapshots.push_back(psnapshot);
+    pSporkSnapshot.store(psnapshot, boost::memory_order_release);
+}
+
+// Save the active sporks to sporks.dat, cs_spork must be held
+static void SaveSporks()
+{
+    std::vector<CSporkMessage> vSporks;
+    for(std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin(); it != mapSporksActive.end(); ++it)
+        vSporks.push_back(it->second);
+
+    CSporkDB sporkdb;
+    sporkdb.Write(vSporks);
+}
 
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
@@ -40,6 +90,8 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 
         if(pindexBest == NULL) return;
 
+        LOCK(cs_spork);
+
         uint256 hash = spork.GetHash();
         if(mapSporksActive.count(spork.nSporkID)) {
             if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
@@ -60,6 +112,8 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 
         mapSporks[hash] = spork;
         mapSporksActive[spork.nSporkID] = spork;
+        PublishSporks();
+        SaveSporks();
         sporkManager.Relay(spork);
 
         //does a task if needed
@@ -67,6 +121,8 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
     }
     if (strCommand == "getsporks")
     {
+        LOCK(cs_spork);
+
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
 
         while(it != mapSporksActive.end()) {
@@ -80,26 +136,8 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 // grab the spork, otherwise say it's off
 bool IsSporkActive(int nSporkID)
 {
-    int64_t r = -1;
+    int64_t r = GetSporkValue(nSporkID);
 
-    if(mapSporksActive.count(nSporkID)){
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if(nSporkID == SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT) r = SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_2_INSTANTX) r = SPORK_2_INSTANTX_DEFAULT;
-        if(nSporkID == SPORK_3_INSTANTX_BLOCK_FILTERING) r = SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
-        if(nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if(nSporkID == SPORK_6_REPLAY_BLOCKS) r = SPORK_6_REPLAY_BLOCKS_DEFAULT;
-        if(nSporkID == SPORK_7_MASTERNODE_SCANNING) r = SPORK_7_MASTERNODE_SCANNING;
-        if(nSporkID == SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT) r = SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT) r = SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_10_MASTERNODE_PAY_UPDATED_NODES) r = SPORK_10_MASTERNODE_PAY_UPDATED_NODES_DEFAULT;
-        if(nSporkID == SPORK_11_RESET_BUDGET) r = SPORK_11_RESET_BUDGET_DEFAULT;
-        if(nSporkID == SPORK_12_RECONSIDER_BLOCKS) r = SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
-        if(nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) r = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
-
-        if(r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
-    }
     if(r == -1) r = 4070908800; //return 2099-1-1 by default
 
     return r < GetTime();
@@ -110,24 +148,10 @@ int64_t GetSporkValue(int nSporkID)
 {
     int64_t r = -1;
 
-    if(mapSporksActive.count(nSporkID)){
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if(nSporkID == SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT) r = SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_2_INSTANTX) r = SPORK_2_INSTANTX_DEFAULT;
-        if(nSporkID == SPORK_3_INSTANTX_BLOCK_FILTERING) r = SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
-        if(nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if(nSporkID == SPORK_6_REPLAY_BLOCKS) r = SPORK_6_REPLAY_BLOCKS_DEFAULT;
-        if(nSporkID == SPORK_7_MASTERNODE_SCANNING) r = SPORK_7_MASTERNODE_SCANNING;
-        if(nSporkID == SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT) r = SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT) r = SPORK_9_MASTERNODE_BUDGET_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_10_MASTERNODE_PAY_UPDATED_NODES) r = SPORK_10_MASTERNODE_PAY_UPDATED_NODES_DEFAULT;
-        if(nSporkID == SPORK_11_RESET_BUDGET) r = SPORK_11_RESET_BUDGET_DEFAULT;
-        if(nSporkID == SPORK_12_RECONSIDER_BLOCKS) r = SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
-        if(nSporkID == SPORK_13_ENABLE_SUPERBLOCKS) r = SPORK_13_ENABLE_SUPERBLOCKS_DEFAULT;
-
-        if(r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
-    }
+    if(nSporkID >= SPORK_START && nSporkID <= SPORK_END)
+        r = pSporkSnapshot.load(boost::memory_order_acquire)->nValue[nSporkID - SPORK_START];
+
+    if(r == -1) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
 
     return r;
 }
@@ -136,6 +160,154 @@ void ExecuteSpork(int nSporkID, int nValue)
 {
 }
 
+bool HaveSpork(const uint256& hash)
+{
+    LOCK(cs_spork);
+    return mapSporks.count(hash);
+}
+
+bool GetSpork(const uint256& hash, CSporkMessage& spork)
+{
+    LOCK(cs_spork);
+
+    std::map<uint256, CSporkMessage>::iterator it = mapSporks.find(hash);
+    if(it == mapSporks.end()) return false;
+
+    spork = it->second;
+    return true;
+}
+
+void GetActiveSporks(std::vector<CSporkMessage>& vSporks)
+{
+    LOCK(cs_spork);
+
+    vSporks.clear();
+    for(std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin(); it != mapSporksActive.end(); ++it)
+        vSporks.push_back(it->second);
+}
+
+void LoadSporks()
+{
+    std::vector<CSporkMessage> vSporks;
+    CSporkDB sporkdb;
+    if(!sporkdb.Read(vSporks)) return;
+
+    LOCK(cs_spork);
+
+    int nLoaded = 0;
+    BOOST_FOREACH(CSporkMessage& spork, vSporks) {
+        // it's our own file, but a spork only counts with the right signature
+        if(!sporkManager.CheckSignature(spork)) {
+            LogPrintf("LoadSporks - invalid signature on spork %d\n", spork.nSporkID);
+            continue;
+        }
+        if(mapSporksActive.count(spork.nSporkID) && mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned)
+            continue;
+
+        mapSporks[spork.GetHash()] = spork;
+        mapSporksActive[spork.nSporkID] = spork;
+        nLoaded++;
+    }
+
+    if(nLoaded > 0) PublishSporks();
+
+    LogPrintf("Loaded %d sporks from sporks.dat\n", nLoaded);
+}
+
+//
+// CSporkDB
+//
+
+CSporkDB::CSporkDB()
+{
+    pathSporks = GetDataDir() / "sporks.dat";
+    strMagicMessage = "SporkCache";
+}
+
+bool CSporkDB::Write(const std::vector<CSporkMessage>& vSporks)
+{
+    // serialize sporks, checksum data up to that point, then append csum
+    CDataStream ssSporks(SER_DISK, CLIENT_VERSION);
+    ssSporks << strMagicMessage;
+    ssSporks << FLATDATA(Params().MessageStart()); // network specific magic number
+    ssSporks << vSporks;
+    uint256 hash = Hash(ssSporks.begin(), ssSporks.end());
+    ssSporks << hash;
+
+    // write to a temporary file first, a spork update must not leave a torn file behind
+    boost::filesystem::path pathTmp = pathSporks;
+    pathTmp += ".new";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+
+    try {
+        fileout << ssSporks;
+    }
+    catch (std::exception &e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, pathSporks))
+        return error("%s : Rename-into-place failed", __func__);
+
+    return true;
+}
+
+bool CSporkDB::Read(std::vector<CSporkMessage>& vSporks)
+{
+    FILE *file = fopen(pathSporks.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return false;
+
+    // use file size to size memory buffer
+    int fileSize = boost::filesystem::file_size(pathSporks);
+    int dataSize = fileSize - sizeof(uint256);
+    if (dataSize < 0)
+        dataSize = 0;
+    vector<unsigned char> vchData;
+    vchData.resize(dataSize);
+    uint256 hashIn;
+
+    try {
+        filein.read((char *)&vchData[0], dataSize);
+        filein >> hashIn;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    CDataStream ssSporks(vchData, SER_DISK, CLIENT_VERSION);
+
+    if (hashIn != Hash(ssSporks.begin(), ssSporks.end()))
+        return error("%s : Checksum mismatch, data corrupted", __func__);
+
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    try {
+        ssSporks >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp)
+            return error("%s : Invalid spork cache magic message", __func__);
+
+        ssSporks >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : Invalid network magic number", __func__);
+
+        ssSporks >> vSporks;
+    }
+    catch (std::exception &e) {
+        vSporks.clear();
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
 /*void ReprocessBlocks(int nBlocks)
 {
     std::map<uint256, int64_t>::iterator it = mapRejectedBlocks.begin();
@@ -219,8 +391,11 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
 
     if(Sign(msg)){
         Relay(msg);
+        LOCK(cs_spork);
         mapSporks[msg.GetHash()] = msg;
         mapSporksActive[nSporkID] = msg;
+        PublishSporks();
+        SaveSporks();
         return true;
     }
 
@@ -33,6 +33,9 @@ using namespace boost;
 #define SPORK_12_RECONSIDER_BLOCKS                            10011
 #define SPORK_13_ENABLE_SUPERBLOCKS                           10012
 
+#define SPORK_START                                           SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT
+#define SPORK_END                                             SPORK_13_ENABLE_SUPERBLOCKS
+
 #define SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT       4070908800   // OFF
 #define SPORK_2_INSTANTX_DEFAULT                              0            // ON
 #define SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT              0            // ON
@@ -48,6 +51,7 @@ using namespace boost;
 
 class CSporkMessage;
 class CSporkManager;
+class CSporkSnapshot;
 
 #include "bignum.h"
 #include "net.h"
@@ -60,14 +64,18 @@ class CSporkManager;
 using namespace std;
 using namespace boost;
 
-extern std::map<uint256, CSporkMessage> mapSporks;
-extern std::map<int, CSporkMessage> mapSporksActive;
 extern CSporkManager sporkManager;
 
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 int64_t GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
 void ExecuteSpork(int nSporkID, int nValue);
+// The spork messages we know, under the lock that guards them
+bool HaveSpork(const uint256& hash);
+bool GetSpork(const uint256& hash, CSporkMessage& spork);
+void GetActiveSporks(std::vector<CSporkMessage>& vSporks);
+// Read the sporks saved in sporks.dat, so they apply before any peer sends them again
+void LoadSporks();
 //void ReprocessBlocks(int nBlocks);
 
 //
@@ -101,6 +109,36 @@ public:
 };
 
 
+//
+// The value of every known spork at one point in time, the network value or the default.
+//
+// A snapshot is never changed once it is published. Accepting a spork publishes a new one in
+// place of the old, so GetSporkValue and IsSporkActive only load a pointer and index an array,
+// without taking a lock. Replaced snapshots stay allocated since readers may still be using
+// them; a new one is only made for a validly signed spork update.
+//
+class CSporkSnapshot
+{
+public:
+    int64_t nValue[SPORK_END - SPORK_START + 1];
+
+    // The defaults, -1 for sporks without one
+    CSporkSnapshot();
+};
+
+/** Access to sporks.dat, the signed spork messages we have accepted */
+class CSporkDB
+{
+private:
+    boost::filesystem::path pathSporks;
+    std::string strMagicMessage;
+
+public:
+    CSporkDB();
+    bool Write(const std::vector<CSporkMessage>& vSporks);
+    bool Read(std::vector<CSporkMessage>& vSporks);
+};
+
 class CSporkManager
 {
 private:
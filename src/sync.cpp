@@ -146,3 +146,91 @@ void AssertLockHeldInternal(const char *pszName, const char* pszFile, int nLine,
 }
 
 #endif /* DEBUG_LOCKORDER */
+
+void CRecursiveSharedMutex::lock()
+{
+    boost::unique_lock<boost::mutex> guard(mutex);
+    boost::thread::id id = boost::this_thread::get_id();
+    if (nExclusive > 0 && idOwner == id)
+    {
+        nExclusive++;
+        return;
+    }
+    std::map<boost::thread::id, int>::iterator it = mapShared.find(id);
+    if (it != mapShared.end())
+    {
+        // a reader stays a reader: waiting for the others to leave could deadlock
+        it->second++;
+        return;
+    }
+    while (nExclusive > 0 || !mapShared.empty())
+        cond.wait(guard);
+    idOwner = id;
+    nExclusive = 1;
+}
+
+bool CRecursiveSharedMutex::try_lock()
+{
+    boost::unique_lock<boost::mutex> guard(mutex);
+    boost::thread::id id = boost::this_thread::get_id();
+    if (nExclusive > 0 && idOwner == id)
+    {
+        nExclusive++;
+        return true;
+    }
+    std::map<boost::thread::id, int>::iterator it = mapShared.find(id);
+    if (it != mapShared.end())
+    {
+        it->second++;
+        return true;
+    }
+    if (nExclusive > 0 || !mapShared.empty())
+        return false;
+    idOwner = id;
+    nExclusive = 1;
+    return true;
+}
+
+void CRecursiveSharedMutex::lock_shared()
+{
+    boost::unique_lock<boost::mutex> guard(mutex);
+    boost::thread::id id = boost::this_thread::get_id();
+    if (nExclusive > 0 && idOwner == id)
+    {
+        nExclusive++;
+        return;
+    }
+    std::map<boost::thread::id, int>::iterator it = mapShared.find(id);
+    if (it != mapShared.end())
+    {
+        it->second++;
+        return;
+    }
+    // readers do not queue behind a waiting writer, a nested shared lock would deadlock
+    while (nExclusive > 0)
+        cond.wait(guard);
+    mapShared[id] = 1;
+}
+
+void CRecursiveSharedMutex::unlock()
+{
+    boost::unique_lock<boost::mutex> guard(mutex);
+    boost::thread::id id = boost::this_thread::get_id();
+    if (nExclusive > 0 && idOwner == id)
+    {
+        if (--nExclusive == 0)
+        {
+            idOwner = boost::thread::id();
+            cond.notify_all();
+        }
+        return;
+    }
+    std::map<boost::thread::id, int>::iterator it = mapShared.find(id);
+    assert(it != mapShared.end());
+    if (--it->second == 0)
+    {
+        mapShared.erase(it);
+        if (mapShared.empty())
+            cond.notify_all();
+    }
+}
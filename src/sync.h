@@ -12,6 +12,9 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <map>
 
 
 ////////////////////////////////////////////////
@@ -84,6 +87,38 @@ typedef AnnotatedMixin<boost::recursive_mutex> CCriticalSection;
 /** Wrapped boost mutex: supports waiting but not recursive locking */
 typedef AnnotatedMixin<boost::mutex> CWaitableCriticalSection;
 
+/** Recursive mutex that readers can also hold shared (LOCK_SHARED). A thread holding it
+ *  shared stays a reader when it locks it again, through LOCK as well, so code called
+ *  from a reader must not modify what the lock guards. */
+class CRecursiveSharedMutex
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::thread::id idOwner;
+    int nExclusive;
+    std::map<boost::thread::id, int> mapShared;
+
+public:
+    CRecursiveSharedMutex() : nExclusive(0) {}
+
+    void lock();
+    bool try_lock();
+    void lock_shared();
+    // releases the calling thread's last lock, exclusive or shared
+    void unlock();
+};
+
+/** Wrapped shared mutex: supports recursive locking and shared locking */
+class LOCKABLE CSharedCriticalSection : public AnnotatedMixin<CRecursiveSharedMutex>
+{
+public:
+    void lock_shared() SHARED_LOCK_FUNCTION()
+    {
+      CRecursiveSharedMutex::lock_shared();
+    }
+};
+
 #ifdef DEBUG_LOCKORDER
 void EnterCritical(const char* pszName, const char* pszFile, int nLine, void* cs, bool fTry = false);
 void LeaveCritical();
@@ -100,62 +135,93 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
-/** Wrapper around boost::unique_lock<Mutex> */
-template<typename Mutex>
-class CMutexLock
+/** Lock held for the lifetime of the object, on a CCriticalSection or exclusively on a CSharedCriticalSection */
+class CCriticalBlock
 {
 private:
-    boost::unique_lock<Mutex> lock;
+    void* pmutex;
+    void (*pfnUnlock)(void*);
 
-    void Enter(const char* pszName, const char* pszFile, int nLine)
+    template<typename Mutex>
+    static void Unlock(void* p)
     {
-        EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock())
+        static_cast<Mutex*>(p)->unlock();
+    }
+
+    // not copyable, the copy would unlock twice
+    CCriticalBlock(const CCriticalBlock&);
+    CCriticalBlock& operator=(const CCriticalBlock&);
+
+public:
+    template<typename Mutex>
+    CCriticalBlock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : pmutex(NULL), pfnUnlock(&Unlock<Mutex>)
+    {
+        EnterCritical(pszName, pszFile, nLine, (void*)&mutexIn, fTry);
+        if (fTry)
         {
-            PrintLockContention(pszName, pszFile, nLine);
+            if (!mutexIn.try_lock())
+            {
+                LeaveCritical();
+                return;
+            }
+        }
+        else
+        {
+#ifdef DEBUG_LOCKCONTENTION
+            if (!mutexIn.try_lock())
+            {
+                PrintLockContention(pszName, pszFile, nLine);
 #endif
-        lock.lock();
+            mutexIn.lock();
 #ifdef DEBUG_LOCKCONTENTION
-        }
+            }
 #endif
+        }
+        pmutex = &mutexIn;
     }
 
-    bool TryEnter(const char* pszName, const char* pszFile, int nLine)
+    ~CCriticalBlock()
     {
-        EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
-        lock.try_lock();
-        if (!lock.owns_lock())
+        if (pmutex)
+        {
             LeaveCritical();
-        return lock.owns_lock();
+            pfnUnlock(pmutex);
+        }
     }
 
-public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    operator bool()
     {
-        if (fTry)
-            TryEnter(pszName, pszFile, nLine);
-        else
-            Enter(pszName, pszFile, nLine);
+        return pmutex != NULL;
     }
+};
+
+/** Shared lock on a CSharedCriticalSection held for the lifetime of the object */
+class CSharedCriticalBlock
+{
+private:
+    CSharedCriticalSection& mutex;
 
-    ~CMutexLock()
+    CSharedCriticalBlock(const CSharedCriticalBlock&);
+    CSharedCriticalBlock& operator=(const CSharedCriticalBlock&);
+
+public:
+    CSharedCriticalBlock(CSharedCriticalSection& mutexIn, const char* pszName, const char* pszFile, int nLine) : mutex(mutexIn)
     {
-        if (lock.owns_lock())
-            LeaveCritical();
+        EnterCritical(pszName, pszFile, nLine, (void*)&mutex);
+        mutex.lock_shared();
     }
 
-    operator bool()
+    ~CSharedCriticalBlock()
     {
-        return lock.owns_lock();
+        LeaveCritical();
+        mutex.unlock();
     }
 };
 
-typedef CMutexLock<CCriticalSection> CCriticalBlock;
-
 #define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
 #define LOCK2(cs1,cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__),criticalblock2(cs2, #cs2, __FILE__, __LINE__)
 #define TRY_LOCK(cs,name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+#define LOCK_SHARED(cs) CSharedCriticalBlock sharedblock(cs, #cs, __FILE__, __LINE__)
 
 #define ENTER_CRITICAL_SECTION(cs) \
     { \
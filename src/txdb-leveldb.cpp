@@ -8,6 +8,8 @@
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
 
 #include <leveldb/env.h>
 #include <leveldb/cache.h>
@@ -26,14 +28,240 @@ using namespace boost;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
 
+// counters behind CTxDBStats, bumped from LevelDB's reader and compaction threads
+static boost::atomic<uint64_t> nCacheHits(0);
+static boost::atomic<uint64_t> nCacheMisses(0);
+static boost::atomic<uint64_t> nFlushes(0);
+static boost::atomic<uint64_t> nCompactions(0);
+static boost::atomic<uint64_t> nTrivialMoves(0);
+static boost::atomic<uint64_t> nWriteStalls(0);
+
+static CTxDBProfile txdbProfile;
+
+// The LRU block cache, counting lookups
+class CCountingCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* pcache;
+
+public:
+    CCountingCache(size_t nCapacity) : pcache(leveldb::NewLRUCache(nCapacity)) {}
+    ~CCountingCache() { delete pcache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        return pcache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key)
+    {
+        Handle* handle = pcache->Lookup(key);
+        if (handle)
+            nCacheHits++;
+        else
+            nCacheMisses++;
+        return handle;
+    }
+
+    void Release(Handle* handle) { pcache->Release(handle); }
+    void* Value(Handle* handle) { return pcache->Value(handle); }
+    void Erase(const leveldb::Slice& key) { pcache->Erase(key); }
+    uint64_t NewId() { return pcache->NewId(); }
+};
+
+// Takes LevelDB's info log into debug.log (-debug=leveldb) and counts flushes, compactions and stalls from it
+class CLevelDBLogger : public leveldb::Logger
+{
+public:
+    void Logv(const char* format, va_list ap)
+    {
+        char buf[500];
+        vsnprintf(buf, sizeof(buf), format, ap);
+        string strMessage(buf);
+
+        if (boost::starts_with(strMessage, "Compacted "))
+            nCompactions++;
+        else if (boost::starts_with(strMessage, "Moved #"))
+            nTrivialMoves++;
+        else if (boost::starts_with(strMessage, "Level-0 table #") && strMessage.find(" bytes ") != string::npos)
+            nFlushes++;
+        else if (strMessage.find("; waiting...") != string::npos)
+            nWriteStalls++;
+
+        boost::trim_right(strMessage);
+        LogPrint("leveldb", "leveldb: %s\n", strMessage);
+    }
+};
+
+// Physical memory in bytes, 0 if unknown
+static int64_t GetTotalMemory()
+{
+#ifdef WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return status.ullTotalPhys;
+#elif defined(_SC_PHYS_PAGES)
+    long nPages = sysconf(_SC_PHYS_PAGES);
+    long nPageSize = sysconf(_SC_PAGESIZE);
+    if (nPages > 0 && nPageSize > 0)
+        return (int64_t)nPages * nPageSize;
+#endif
+    return 0;
+}
+
+// Open file limit of the process, 0 if there is none
+static int GetFileDescriptorLimit()
+{
+#ifndef WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        return (int)std::min(limit.rlim_cur, (rlim_t)1000000);
+#endif
+    return 0;
+}
+
+// LevelDB quietly stores blocks uncompressed when it was built without snappy, and whether it was is only
+// known to its own build. So a compressible table is written to a database in memory to see if it shrinks
+static bool IsCompressionAvailable()
+{
+    static const size_t nProbeSize = 64 * 1024;
+    leveldb::Env* penv = leveldb::NewMemEnv(leveldb::Env::Default());
+    leveldb::Options options;
+    options.env = penv;
+    options.create_if_missing = true;
+    options.compression = leveldb::kSnappyCompression;
+
+    uint64_t nTableSize = nProbeSize;
+    leveldb::DB* pdbProbe = NULL;
+    if (leveldb::DB::Open(options, "probe", &pdbProbe).ok())
+    {
+        // compacting writes the memtable out as a table file
+        if (pdbProbe->Put(leveldb::WriteOptions(), "probe", std::string(nProbeSize, 'a')).ok())
+        {
+            pdbProbe->CompactRange(NULL, NULL);
+            nTableSize = 0;
+            std::vector<std::string> vFiles;
+            penv->GetChildren("probe", &vFiles);
+            BOOST_FOREACH(const std::string& strFile, vFiles)
+            {
+                uint64_t nSize;
+                if ((boost::algorithm::ends_with(strFile, ".ldb") || boost::algorithm::ends_with(strFile, ".sst")) &&
+                    penv->GetFileSize("probe/" + strFile, &nSize).ok())
+                    nTableSize += nSize;
+            }
+        }
+        delete pdbProbe;
+    }
+    delete penv;
+
+    return nTableSize > 0 && nTableSize < nProbeSize / 2;
+}
+
+static CTxDBProfile ChooseProfile()
+{
+    static const int64_t MiB = 1048576;
+    int64_t nMemory = GetTotalMemory();
+
+    CTxDBProfile profile;
+    profile.strName = GetArg("-dbprofile", "auto");
+    if (profile.strName == "auto")
+    {
+        if (nMemory > 0 && nMemory < 1536 * MiB)
+            profile.strName = "small";
+        else if (nMemory >= 6144 * MiB)
+            profile.strName = "large";
+        else
+            profile.strName = "default";
+    }
+
+    profile.fCompression = true;
+    if (profile.strName == "small")
+    {
+        // little RAM and slow disks: a cache of 1/32 of the memory, few open files
+        profile.nCacheSize = std::max(16 * MiB, std::min(64 * MiB, nMemory / 32));
+        profile.nWriteBufferSize = 2 * MiB;
+        profile.nMaxOpenFiles = 64;
+        profile.nBlockSize = 4096;
+    }
+    else if (profile.strName == "large")
+    {
+        // plenty of RAM and fast disks: a cache of 1/16 of the memory and large memtables, so fewer level 0 files
+        profile.nCacheSize = std::max(256 * MiB, std::min(2048 * MiB, nMemory / 16));
+        profile.nWriteBufferSize = 64 * MiB;
+        profile.nMaxOpenFiles = 4096;
+        profile.nBlockSize = 16384;
+    }
+    else
+    {
+        if (profile.strName != "default")
+            LogPrintf("Unknown -dbprofile %s, using default\n", profile.strName);
+        profile.strName = "default";
+        profile.nCacheSize = 100 * MiB;
+        profile.nWriteBufferSize = 4 * MiB;
+        profile.nMaxOpenFiles = 1000;
+        profile.nBlockSize = 4096;
+    }
+
+    // imports at startup write fastest through a large memtable, which then stays for the session
+    if (mapArgs.count("-loadblock") || filesystem::exists(GetDataDir() / "bootstrap.dat"))
+        profile.nWriteBufferSize = std::max(profile.nWriteBufferSize, 32 * MiB);
+
+    if (mapArgs.count("-dbcache"))
+        profile.nCacheSize = GetArg("-dbcache", 100) * MiB;
+    if (mapArgs.count("-dbwritebuffer"))
+        profile.nWriteBufferSize = GetArg("-dbwritebuffer", 4) * MiB;
+    if (mapArgs.count("-dbmaxopenfiles"))
+        profile.nMaxOpenFiles = GetArg("-dbmaxopenfiles", 1000);
+    if (mapArgs.count("-dbblocksize"))
+        profile.nBlockSize = GetArg("-dbblocksize", 4) * 1024;
+    profile.fCompressionRequested = GetBoolArg("-dbcompression", profile.fCompression);
+    profile.fCompression = profile.fCompressionRequested && IsCompressionAvailable();
+    if (profile.fCompressionRequested && !profile.fCompression)
+        LogPrintf("LevelDB is built without snappy, database blocks are stored uncompressed\n");
+
+    // leave file descriptors for the peers, block files and wallet
+    int nFDLimit = GetFileDescriptorLimit();
+    if (nFDLimit > 0)
+        profile.nMaxOpenFiles = std::min(profile.nMaxOpenFiles, std::max(64, nFDLimit - (int)GetArg("-maxconnections", 125) - 100));
+
+    return profile;
+}
+
 static leveldb::Options GetOptions() {
+    txdbProfile = ChooseProfile();
+    LogPrintf("Database profile %s: cache %dMiB, write buffer %dMiB, max open files %d, block size %dKiB, compression %s\n",
+        txdbProfile.strName, txdbProfile.nCacheSize / 1048576, txdbProfile.nWriteBufferSize / 1048576,
+        txdbProfile.nMaxOpenFiles, txdbProfile.nBlockSize / 1024, txdbProfile.fCompression ? "on" : "off");
+
     leveldb::Options options;
-    int nCacheSizeMB = GetArg("-dbcache", 100);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
+    options.block_cache = new CCountingCache(txdbProfile.nCacheSize);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.info_log = new CLevelDBLogger();
+    options.write_buffer_size = txdbProfile.nWriteBufferSize;
+    options.max_open_files = txdbProfile.nMaxOpenFiles;
+    options.block_size = txdbProfile.nBlockSize;
+    options.compression = txdbProfile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
     return options;
 }
 
+const CTxDBProfile& CTxDB::GetProfile()
+{
+    return txdbProfile;
+}
+
+CTxDBStats CTxDB::GetStats()
+{
+    CTxDBStats stats;
+    stats.nCacheHits = nCacheHits;
+    stats.nCacheMisses = nCacheMisses;
+    stats.nFlushes = nFlushes;
+    stats.nCompactions = nCompactions;
+    stats.nTrivialMoves = nTrivialMoves;
+    stats.nWriteStalls = nWriteStalls;
+    return stats;
+}
+
 void init_blockindex(leveldb::Options& options, bool fRemoveOld = false) {
     // First time init.
     filesystem::path directory = GetDataDir() / "txleveldb";
@@ -70,6 +298,7 @@ CTxDB::CTxDB(const char* pszMode)
 {
     assert(pszMode);
     activeBatch = NULL;
+    activeWrites = NULL;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
 
     if (txdb) {
@@ -81,7 +310,6 @@ CTxDB::CTxDB(const char* pszMode)
 
     options = GetOptions();
     options.create_if_missing = true; //options.create_if_missing = fCreate;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
     init_blockindex(options); // Init directory
     pdb = txdb;
@@ -100,6 +328,8 @@ CTxDB::CTxDB(const char* pszMode)
             txdb = pdb = NULL;
             delete activeBatch;
             activeBatch = NULL;
+            delete activeWrites;
+            activeWrites = NULL;
 
             init_blockindex(options, true); // Remove directory and create new database
             pdb = txdb;
@@ -129,14 +359,19 @@ void CTxDB::Close()
     options.filter_policy = NULL;
     delete options.block_cache;
     options.block_cache = NULL;
+    delete options.info_log;
+    options.info_log = NULL;
     delete activeBatch;
     activeBatch = NULL;
+    delete activeWrites;
+    activeWrites = NULL;
 }
 
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
     activeBatch = new leveldb::WriteBatch();
+    activeWrites = new boost::unordered_map<std::string, CTxDBPendingWrite>();
     return true;
 }
 
@@ -146,6 +381,8 @@ bool CTxDB::TxnCommit()
     leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
     delete activeBatch;
     activeBatch = NULL;
+    delete activeWrites;
+    activeWrites = NULL;
     if (!status.ok()) {
         LogPrintf("LevelDB batch commit failure: %s\n", status.ToString());
         return false;
@@ -153,75 +390,373 @@ bool CTxDB::TxnCommit()
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
-
-    CBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
+// When performing a read, if we have an active batch we need to check it first
+// before reading from the database, as the rest of the code assumes that once
+// a database transaction begins reads are consistent with it. The pending
+// writes are indexed by key, so this is a single lookup however large the
+// batch has grown.
+bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
+    assert(activeBatch);
+    *deleted = false;
+    boost::unordered_map<std::string, CTxDBPendingWrite>::const_iterator it = activeWrites->find(key.str());
+    if (it == activeWrites->end())
+        return false;
+    if (it->second.fDeleted)
+        *deleted = true;
+    else
+        *value = it->second.strValue;
+    return true;
+}
+
+bool CTxDB::WriteAddrIndex(const CAddrIndexKey& key, const CAddrIndexValue& value)
+{
+    return Write(make_pair(string("adx"), key), value);
+}
+
+bool CTxDB::EraseAddrIndex(const CAddrIndexKey& key)
+{
+    return Erase(make_pair(string("adx"), key));
+}
+
+bool CTxDB::UpdateAddrIndexSpent(const std::vector<CAddrIndexKey>& vSpent, bool fSpent)
+{
+    for (std::vector<CAddrIndexKey>::const_iterator it = vSpent.begin(); it != vSpent.end(); ++it)
+    {
+        CAddrIndexValue value;
+        if (!Read(make_pair(string("adx"), *it), value))
+        {
+            LogPrintf("UpdateAddrIndexSpent() : no entry for output %s:%u\n", it->txid.ToString(), it->nIndex);
+            continue;
         }
+        value.fSpent = fSpent;
+        if (!WriteAddrIndex(*it, value))
+            return false;
+    }
+    return true;
+}
+
+// Sum what the entries add to (or with fConnect false, take from) the balances of their addresses
+static void GetAddrBalanceChanges(const AddrIndexEntries& vEntries, bool fConnect, map<uint160, CAddrBalance>& mapChanges)
+{
+    for (AddrIndexEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+    {
+        CAddrBalance& change = mapChanges[it->first.addrid];
+        int64_t nValue = fConnect ? it->second : -it->second;
+        change.nBalance += nValue;
+        if (!it->first.fSpending)
+            change.nReceived += nValue;
     }
+}
+
+bool CTxDB::UpdateAddrBalances(const AddrIndexEntries& vEntries, bool fConnect)
+{
+    map<uint160, CAddrBalance> mapChanges;
+    GetAddrBalanceChanges(vEntries, fConnect, mapChanges);
+
+    for (map<uint160, CAddrBalance>::const_iterator it = mapChanges.begin(); it != mapChanges.end(); ++it)
+    {
+        CAddrBalance balance;
+        Read(make_pair(string("adb"), it->first), balance);
+        balance.nBalance += it->second.nBalance;
+        balance.nReceived += it->second.nReceived;
+        // an address whose last entries were disconnected has nothing left
+        if (!(balance.IsNull() ? Erase(make_pair(string("adb"), it->first)) : Write(make_pair(string("adb"), it->first), balance)))
+            return false;
+    }
+    return true;
+}
+
+leveldb::Iterator* CTxDB::SeekAddrIndex(uint160 addrid, int nHeightStart)
+{
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("adx"), CAddrIndexKey(addrid, nHeightStart, 0, false, 0));
+    iterator->Seek(ssStartKey.str());
+    return iterator;
+}
+
+bool CTxDB::ReadAddrIndexEntry(leveldb::Iterator* iterator, uint160 addrid, int nHeightEnd, CAddrIndexKey& key, CAddrIndexValue& value)
+{
+    if (!iterator->Valid())
+        return false;
 
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
+    try {
+        CDataStream ssKey(iterator->key().data(), iterator->key().data() + iterator->key().size(), SER_DISK, CLIENT_VERSION);
+        string strType;
+        ssKey >> strType;
+        if (strType != "adx")
+            return false;
+        ssKey >> key;
+        if (key.addrid != addrid || (nHeightEnd >= 0 && key.nHeight > nHeightEnd))
+            return false;
+
+        CDataStream ssValue(iterator->value().data(), iterator->value().data() + iterator->value().size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> value;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+bool CTxDB::ReadAddrIndex(uint160 addrid, std::vector<uint256>& vtxhash, int nSkip, int nCount, int nHeightStart, int nHeightEnd)
+{
+    vtxhash.clear();
+
+    CAddrIndexKey key;
+    CAddrIndexValue value;
+
+    if (nSkip < 0)
+    {
+        // count the transactions in range first
+        int nTotal = 0;
+        uint256 hashLast = 0;
+        leveldb::Iterator *iterator = SeekAddrIndex(addrid, nHeightStart);
+        for (; ReadAddrIndexEntry(iterator, addrid, nHeightEnd, key, value); iterator->Next())
+        {
+            if (key.txid != hashLast)
+                nTotal++;
+            hashLast = key.txid;
         }
+        delete iterator;
+
+        nSkip = std::max(0, nTotal + nSkip);
     }
-};
 
-// When performing a read, if we have an active batch we need to check it first
-// before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
-bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
-    assert(activeBatch);
-    *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
+    // the entries of one transaction are next to each other
+    uint256 hashLast = 0;
+    leveldb::Iterator *iterator = SeekAddrIndex(addrid, nHeightStart);
+    for (; nCount != 0 && ReadAddrIndexEntry(iterator, addrid, nHeightEnd, key, value); iterator->Next())
+    {
+        boost::this_thread::interruption_point();
+
+        if (key.txid == hashLast)
+            continue;
+        hashLast = key.txid;
+
+        if (nSkip > 0)
+        {
+            nSkip--;
+            continue;
+        }
+
+        vtxhash.push_back(key.txid);
+        if (nCount > 0)
+            nCount--;
     }
-    return scanner.foundEntry;
+    delete iterator;
+
+    return true;
 }
 
-bool CTxDB::WriteAddrIndex(uint160 addrHash, uint256 txHash)
+bool CTxDB::ReadAddrBalance(uint160 addrid, int64_t& nBalance, int64_t& nReceived)
 {
-    std::vector<uint256> txHashes;
-    if(!ReadAddrIndex(addrHash, txHashes))
+    // kept up to date with the entries, so there is no need to scan them; an address never paid has no record
+    CAddrBalance balance;
+    Read(make_pair(string("adb"), addrid), balance);
+    nBalance = balance.nBalance;
+    nReceived = balance.nReceived;
+    return true;
+}
+
+bool CTxDB::WriteAddrIndexBatch(const AddrIndexEntries& vEntries, const std::vector<CAddrIndexKey>& vSpent, uint256 hashBest)
+{
+    assert(!activeBatch);
+    if (fReadOnly)
+        assert(!"WriteAddrIndexBatch called on database in read-only mode");
+
+    map<string, CAddrIndexValue> mapEntries;
+    for (AddrIndexEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
     {
-	txHashes.push_back(txHash);
-        return Write(make_pair(string("adr"), addrHash), txHashes);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("adx"), it->first);
+        mapEntries[ssKey.str()] = CAddrIndexValue(it->second);
     }
-    else
+
+    // outputs of the batch are flagged before they are written, those of earlier batches are read back
+    for (std::vector<CAddrIndexKey>::const_iterator it = vSpent.begin(); it != vSpent.end(); ++it)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("adx"), *it);
+        map<string, CAddrIndexValue>::iterator mi = mapEntries.find(ssKey.str());
+        if (mi != mapEntries.end())
+            mi->second.fSpent = true;
+        else
+        {
+            CAddrIndexValue value;
+            if (!Read(make_pair(string("adx"), *it), value))
+            {
+                LogPrintf("WriteAddrIndexBatch() : no entry for output %s:%u\n", it->txid.ToString(), it->nIndex);
+                continue;
+            }
+            value.fSpent = true;
+            mapEntries[ssKey.str()] = value;
+        }
+    }
+
+    // LevelDB takes a batch fastest in key order, and the entries come by block
+    map<string, string> mapWrites;
+    for (map<string, CAddrIndexValue>::const_iterator it = mapEntries.begin(); it != mapEntries.end(); ++it)
     {
-	if(std::find(txHashes.begin(), txHashes.end(), txHash) == txHashes.end()) 
-    	{
-    	    txHashes.push_back(txHash);
-            return Write(make_pair(string("adr"), addrHash), txHashes);
-	}
-	else
-	{
-	    return true; // already have this tx hash
-	}
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << it->second;
+        mapWrites[it->first] = ssValue.str();
     }
+    map<string, CAddrIndexValue>().swap(mapEntries);
+
+    map<uint160, CAddrBalance> mapChanges;
+    GetAddrBalanceChanges(vEntries, true, mapChanges);
+    for (map<uint160, CAddrBalance>::const_iterator it = mapChanges.begin(); it != mapChanges.end(); ++it)
+    {
+        CAddrBalance balance;
+        Read(make_pair(string("adb"), it->first), balance);
+        balance.nBalance += it->second.nBalance;
+        balance.nReceived += it->second.nReceived;
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("adb"), it->first);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << balance;
+        mapWrites[ssKey.str()] = ssValue.str();
+    }
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << string("addrindexbest");
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << hashBest;
+    mapWrites[ssKey.str()] = ssValue.str();
+
+    leveldb::WriteBatch batch;
+    for (map<string, string>::const_iterator it = mapWrites.begin(); it != mapWrites.end(); ++it)
+        batch.Put(it->first, it->second);
+
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+    if (!status.ok())
+        return error("WriteAddrIndexBatch() : LevelDB write failure: %s", status.ToString());
+    return true;
+}
+
+bool CTxDB::EraseAllAddrIndex()
+{
+    if (!EraseAddrIndexBest())
+        return false;
+
+    const char* pszTypes[] = {"adb", "adr", "adx"};
+    for (unsigned int i = 0; i < sizeof(pszTypes) / sizeof(pszTypes[0]); i++)
+    {
+        leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+        CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+        ssStartKey << string(pszTypes[i]);
+        iterator->Seek(ssStartKey.str());
+
+        leveldb::WriteBatch batch;
+        unsigned int nBatched = 0;
+        bool fDone = false;
+        while (!fDone)
+        {
+            fDone = !iterator->Valid();
+            if (!fDone)
+            {
+                CDataStream ssKey(iterator->key().data(), iterator->key().data() + iterator->key().size(), SER_DISK, CLIENT_VERSION);
+                string strType;
+                ssKey >> strType;
+                fDone = (strType != pszTypes[i]);
+            }
+            if (!fDone)
+            {
+                batch.Delete(iterator->key());
+                nBatched++;
+                iterator->Next();
+            }
+
+            // write out in pieces, a busy index doesn't fit one batch
+            if (nBatched > 0 && (fDone || nBatched >= 100000))
+            {
+                leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+                if (!status.ok())
+                {
+                    delete iterator;
+                    return error("EraseAllAddrIndex() : LevelDB write failure: %s", status.ToString());
+                }
+                batch.Clear();
+                nBatched = 0;
+            }
+        }
+        delete iterator;
+    }
+
+    return true;
+}
+
+bool CTxDB::ReadAddrIndexVersion(int& nVersion)
+{
+    nVersion = 0;
+    return Read(string("addrindexversion"), nVersion);
+}
+
+bool CTxDB::WriteAddrIndexVersion(int nVersion)
+{
+    return Write(string("addrindexversion"), nVersion);
+}
+
+bool CTxDB::BeginBulkLoad(int nHeight, unsigned int nFile)
+{
+    return Write(string("bulkload"), make_pair(nHeight, nFile));
+}
+
+bool CTxDB::EndBulkLoad()
+{
+    assert(!activeBatch);
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << string("bulkload");
+
+    // a synced write also syncs the log with all writes before it
+    leveldb::WriteOptions syncoptions;
+    syncoptions.sync = true;
+    leveldb::Status status = pdb->Delete(syncoptions, ssKey.str());
+    if (!status.ok())
+        return error("EndBulkLoad() : LevelDB write failure: %s", status.ToString());
+    return true;
+}
+
+bool CTxDB::ReadBulkLoad(int& nHeight, unsigned int& nFile)
+{
+    pair<int, unsigned int> marker;
+    if (!Read(string("bulkload"), marker))
+        return false;
+    nHeight = marker.first;
+    nFile = marker.second;
+    return true;
+}
+
+void CTxDB::CompactType(const std::string& strType)
+{
+    // keys start with the serialized type, so they end before the type with its last character increased
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << strType;
+    string strStart = ssStart.str();
+    string strLimit = strStart;
+    strLimit[strLimit.size() - 1]++;
+
+    leveldb::Slice start(strStart);
+    leveldb::Slice limit(strLimit);
+    pdb->CompactRange(&start, &limit);
+}
+
+bool CTxDB::ReadAddrIndexBest(uint256& hashBest)
+{
+    hashBest = 0;
+    return Read(string("addrindexbest"), hashBest);
 }
 
-bool CTxDB::ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes)
+bool CTxDB::WriteAddrIndexBest(uint256 hashBest)
 {
-    return Read(make_pair(string("adr"), addrHash), txHashes);
+    return Write(string("addrindexbest"), hashBest);
+}
+
+bool CTxDB::EraseAddrIndexBest()
+{
+    return Erase(string("addrindexbest"));
 }
 
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
@@ -311,12 +846,12 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = AllocBlockIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
@@ -426,6 +961,7 @@ bool CTxDB::LoadBlockIndex()
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
+    UpdateChainTip();
 
     LogPrintf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
       hashBestChain.ToString(), nBestHeight, CBigNum(nBestChainTrust).ToString(),
@@ -441,10 +977,20 @@ bool CTxDB::LoadBlockIndex()
     int nCheckDepth = GetArg( "-checkblocks", 500);
     if (nCheckDepth == 0)
         nCheckDepth = 1000000000; // suffices until the year 19000
+    // an import that didn't finish may have left the last blocks it wrote out of the block files
+    int nBulkHeight;
+    unsigned int nBulkFile;
+    bool fBulkLoad = ReadBulkLoad(nBulkHeight, nBulkFile);
+    if (fBulkLoad)
+    {
+        LogPrintf("Block import did not finish, verifying the blocks after %d\n", nBulkHeight);
+        nCheckDepth = std::max(nCheckDepth, nBestHeight - nBulkHeight);
+    }
     if (nCheckDepth > nBestHeight)
         nCheckDepth = nBestHeight;
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CBlockIndex* pindexFork = NULL;
+    bool fUnreadable = false;
     map<pair<unsigned int, unsigned int>, CBlockIndex*> mapBlockPos;
     for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
     {
@@ -453,7 +999,15 @@ bool CTxDB::LoadBlockIndex()
             break;
         CBlock block;
         if (!block.ReadFromDisk(pindex))
-            return error("LoadBlockIndex() : block.ReadFromDisk failed");
+        {
+            // the blocks of an import that didn't finish may not have reached their file, they go like bad ones
+            if (!fBulkLoad || pindex->nHeight <= nBulkHeight)
+                return error("LoadBlockIndex() : block.ReadFromDisk failed");
+            LogPrintf("LoadBlockIndex() : *** cannot read block %d of the unfinished import, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            pindexFork = pindex->pprev;
+            fUnreadable = true;
+            continue;
+        }
         // check level 1: verify block validity
         // check level 7: verify block signature too
         if (nCheckLevel>0 && !block.CheckBlock(true, true, (nCheckLevel>6)))
@@ -557,12 +1111,142 @@ bool CTxDB::LoadBlockIndex()
         boost::this_thread::interruption_point();
         // Reorg back to the fork
         LogPrintf("LoadBlockIndex() : *** moving best chain pointer back to block %d\n", pindexFork->nHeight);
-        CBlock block;
-        if (!block.ReadFromDisk(pindexFork))
-            return error("LoadBlockIndex() : block.ReadFromDisk failed");
-        CTxDB txdb;
-        block.SetBestChain(txdb, pindexFork);
+        if (fUnreadable)
+        {
+            // Reorganize reads every block it disconnects
+            if (!RewindUnreadable(pindexFork))
+                return error("LoadBlockIndex() : RewindUnreadable failed");
+        }
+        else
+        {
+            CBlock block;
+            if (!block.ReadFromDisk(pindexFork))
+                return error("LoadBlockIndex() : block.ReadFromDisk failed");
+            CTxDB txdb;
+            block.SetBestChain(txdb, pindexFork);
+        }
+    }
+
+    if (fBulkLoad && !EndBulkLoad())
+        return error("LoadBlockIndex() : EndBulkLoad failed");
+
+    return true;
+}
+
+bool CTxDB::RewindUnreadable(CBlockIndex* pindexFork)
+{
+    set<pair<unsigned int, unsigned int> > setBlockPos;
+    set<uint256> setRemoved;
+    for (CBlockIndex* pindex = pindexBest; pindex != pindexFork; pindex = pindex->pprev)
+    {
+        setBlockPos.insert(make_pair(pindex->nFile, pindex->nBlockPos));
+        setRemoved.insert(pindex->GetBlockHash());
+    }
+
+    if (!TxnBegin())
+        return error("RewindUnreadable() : TxnBegin failed");
+
+    // What DisconnectInputs does for each transaction, found through the tx index instead of the blocks:
+    // the transactions of the blocks go, and the outputs they spent are unspent again
+    unsigned int nErased = 0;
+    unsigned int nUnspent = 0;
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("tx"), uint256(0));
+    iterator->Seek(ssStartKey.str());
+    while (iterator->Valid())
+    {
+        boost::this_thread::interruption_point();
+        CDataStream ssKey(iterator->key().data(), iterator->key().data() + iterator->key().size(), SER_DISK, CLIENT_VERSION);
+        string strType;
+        ssKey >> strType;
+        if (strType != "tx")
+            break;
+        uint256 hashTx;
+        ssKey >> hashTx;
+        CDataStream ssValue(iterator->value().data(), iterator->value().data() + iterator->value().size(), SER_DISK, CLIENT_VERSION);
+        CTxIndex txindex;
+        ssValue >> txindex;
+        iterator->Next();
+
+        bool fOk = true;
+        if (setBlockPos.count(make_pair(txindex.pos.nFile, txindex.pos.nBlockPos)))
+        {
+            fOk = Erase(make_pair(string("tx"), hashTx));
+            nErased++;
+        }
+        else
+        {
+            bool fChanged = false;
+            BOOST_FOREACH(CDiskTxPos& pos, txindex.vSpent)
+            {
+                if (!pos.IsNull() && setBlockPos.count(make_pair(pos.nFile, pos.nBlockPos)))
+                {
+                    pos.SetNull();
+                    fChanged = true;
+                    nUnspent++;
+                }
+            }
+            if (fChanged)
+                fOk = UpdateTxIndex(hashTx, txindex);
+        }
+        if (!fOk)
+        {
+            delete iterator;
+            TxnAbort();
+            return error("RewindUnreadable() : tx index update failed");
+        }
+    }
+    delete iterator;
+
+    // The blocks leave the block index too, so that they are downloaded or imported again instead of
+    // being known already. So do blocks built on them, which can't be connected any more
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        if (item.second->nHeight > pindexFork->nHeight)
+            vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    vector<CBlockIndex*> vRemove;
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        if (setRemoved.count(pindex->GetBlockHash()) || (pindex->pprev && setRemoved.count(pindex->pprev->GetBlockHash())))
+        {
+            setRemoved.insert(pindex->GetBlockHash());
+            vRemove.push_back(pindex);
+            if (!Erase(make_pair(string("blockindex"), pindex->GetBlockHash())))
+            {
+                TxnAbort();
+                return error("RewindUnreadable() : erasing the block index failed");
+            }
+        }
     }
 
+    CDiskBlockIndex blockindexFork(pindexFork);
+    blockindexFork.hashNext = 0;
+    if (!WriteBlockIndex(blockindexFork) || !WriteHashBestChain(pindexFork->GetBlockHash()))
+    {
+        TxnAbort();
+        return error("RewindUnreadable() : writing the new best chain failed");
+    }
+    if (!TxnCommit())
+        return error("RewindUnreadable() : TxnCommit failed");
+
+    BOOST_FOREACH(CBlockIndex* pindex, vRemove)
+    {
+        if (pindex->IsProofOfStake())
+            setStakeSeen.erase(make_pair(pindex->prevoutStake, pindex->nStakeTime));
+        uint256 hash = pindex->GetBlockHash();
+        mapBlockIndex.erase(hash);
+    }
+    pindexFork->pnext = NULL;
+
+    hashBestChain = pindexFork->GetBlockHash();
+    pindexBest = pindexFork;
+    nBestHeight = pindexBest->nHeight;
+    nBestChainTrust = pindexBest->nChainTrust;
+    UpdateChainTip();
+
+    LogPrintf("RewindUnreadable() : removed %u blocks, %u transactions, unspent %u outputs\n", vRemove.size(), nErased, nUnspent);
     return true;
 }
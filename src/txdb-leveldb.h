@@ -12,9 +12,67 @@
 #include <string>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+// The latest pending write to a key while a CTxDB transaction is open
+class CTxDBPendingWrite
+{
+public:
+    bool fDeleted;
+    std::string strValue;
+
+    CTxDBPendingWrite() : fDeleted(false) {}
+};
+
+// How the database is opened. -dbprofile picks the sizes from the RAM of the
+// machine and its open file limit, the -db* options override single settings.
+class CTxDBProfile
+{
+public:
+    std::string strName;
+    int64_t nCacheSize;         // bytes of uncompressed blocks kept in memory
+    int64_t nWriteBufferSize;   // bytes written before a memtable is flushed to level 0
+    int nMaxOpenFiles;
+    int nBlockSize;             // bytes
+    bool fCompression;          // blocks are stored compressed, LevelDB is built with snappy
+    bool fCompressionRequested; // -dbcompression
+
+    CTxDBProfile()
+    {
+        nCacheSize = 0;
+        nWriteBufferSize = 0;
+        nMaxOpenFiles = 0;
+        nBlockSize = 0;
+        fCompression = false;
+        fCompressionRequested = false;
+    }
+};
+
+// What LevelDB did since the database was opened
+class CTxDBStats
+{
+public:
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    uint64_t nFlushes;          // memtables written out to level 0
+    uint64_t nCompactions;
+    uint64_t nTrivialMoves;     // files moved down a level without being rewritten
+    uint64_t nWriteStalls;      // writes that waited for a flush or for level 0 to shrink
+
+    CTxDBStats()
+    {
+        nCacheHits = 0;
+        nCacheMisses = 0;
+        nFlushes = 0;
+        nCompactions = 0;
+        nTrivialMoves = 0;
+        nWriteStalls = 0;
+    }
+};
+
 // Class that provides access to a LevelDB. Note that this class is frequently
 // instantiated on the stack and then destroyed again, so instantiation has to
 // be very cheap. Unfortunately that means, a CTxDB instance is actually just a
@@ -35,6 +93,7 @@ public:
         // Note that this is not the same as Close() because it deletes only
         // data scoped to this TxDB object.
         delete activeBatch;
+        delete activeWrites;
     }
 
     // Destroys the underlying shared global state accessed by this TxDB.
@@ -46,6 +105,9 @@ private:
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
     leveldb::WriteBatch *activeBatch;
+    // The same writes and deletes by key, so reads inside the transaction find
+    // them without replaying the whole batch. Set whenever activeBatch is.
+    boost::unordered_map<std::string, CTxDBPendingWrite> *activeWrites;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
@@ -112,6 +174,9 @@ protected:
 
         if (activeBatch) {
             activeBatch->Put(ssKey.str(), ssValue.str());
+            CTxDBPendingWrite& pending = (*activeWrites)[ssKey.str()];
+            pending.fDeleted = false;
+            pending.strValue = ssValue.str();
             return true;
         }
         leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
@@ -135,6 +200,9 @@ protected:
         ssKey << key;
         if (activeBatch) {
             activeBatch->Delete(ssKey.str());
+            CTxDBPendingWrite& pending = (*activeWrites)[ssKey.str()];
+            pending.fDeleted = true;
+            pending.strValue.clear();
             return true;
         }
         leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
@@ -169,9 +237,25 @@ public:
     {
         delete activeBatch;
         activeBatch = NULL;
+        delete activeWrites;
+        activeWrites = NULL;
         return true;
     }
 
+    // Number of distinct keys written or erased by the open transaction
+    unsigned int GetPendingWriteCount() const
+    {
+        return activeWrites ? activeWrites->size() : 0;
+    }
+
+    static const CTxDBProfile& GetProfile();
+    static CTxDBStats GetStats();
+    // LevelDB property, like "leveldb.stats" or "leveldb.sstables"
+    bool GetProperty(const std::string& strProperty, std::string& strValue)
+    {
+        return pdb->GetProperty(strProperty, &strValue);
+    }
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
@@ -183,8 +267,38 @@ public:
         return Write(std::string("version"), nVersion);
     }
 
-    bool ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes);
-    bool WriteAddrIndex(uint160 addrHash, uint256 txHash);
+    bool WriteAddrIndex(const CAddrIndexKey& key, const CAddrIndexValue& value);
+    bool EraseAddrIndex(const CAddrIndexKey& key);
+    // Set or clear the spent flag of the output entries with the given keys
+    bool UpdateAddrIndexSpent(const std::vector<CAddrIndexKey>& vSpent, bool fSpent);
+    // Add (or with fConnect false, take out) the entries to the balances of their addresses
+    bool UpdateAddrBalances(const AddrIndexEntries& vEntries, bool fConnect);
+    // Distinct transactions touching addrid with heights in [nHeightStart, nHeightEnd] (no upper bound if
+    // negative), in chain order. The first nSkip are left out, counting from the end if nSkip is negative,
+    // and at most nCount are returned (all if negative). Reads what is on disk, not an open transaction.
+    bool ReadAddrIndex(uint160 addrid, std::vector<uint256>& vtxhash, int nSkip, int nCount, int nHeightStart, int nHeightEnd);
+    bool ReadAddrBalance(uint160 addrid, int64_t& nBalance, int64_t& nReceived);
+    // Write entries in key order together with the spent flags and address balances they change and the new
+    // best indexed block, as one batch. Not inside a transaction
+    bool WriteAddrIndexBatch(const AddrIndexEntries& vEntries, const std::vector<CAddrIndexKey>& vSpent, uint256 hashBest);
+    // Remove the whole address index, including the per-address lists of the old layout. The best indexed
+    // block goes first, so an interrupted wipe is done again
+    bool EraseAllAddrIndex();
+    bool ReadAddrIndexVersion(int& nVersion);
+    bool WriteAddrIndexVersion(int nVersion);
+    // Last block of the best chain whose address index entries are written, all blocks before it have theirs
+    bool ReadAddrIndexBest(uint256& hashBest);
+    bool WriteAddrIndexBest(uint256 hashBest);
+    bool EraseAddrIndexBest();
+    // Bulk loading, while importing blocks: block files are committed at the end instead of as they grow. The
+    // marker holds the best height and the block file when the import started, so that the next start can
+    // verify everything imported since if the node went down before EndBulkLoad
+    bool BeginBulkLoad(int nHeight, unsigned int nFile);
+    // Make everything written since BeginBulkLoad durable with one synced write that removes the marker
+    bool EndBulkLoad();
+    bool ReadBulkLoad(int& nHeight, unsigned int& nFile);
+    // Compact the keys of one type, like "tx" or "blockindex", blocking until done
+    void CompactType(const std::string& strType);
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
@@ -202,6 +316,12 @@ public:
     bool LoadBlockIndex();
 private:
     bool LoadBlockIndexGuts();
+    // Move the best chain back to pindexFork when blocks above it can't be read, see LoadBlockIndex
+    bool RewindUnreadable(CBlockIndex* pindexFork);
+    // Position a new iterator at the first entry of addrid at or above nHeightStart
+    leveldb::Iterator* SeekAddrIndex(uint160 addrid, int nHeightStart);
+    // Read the entry at the iterator, false once past the entries of addrid up to nHeightEnd
+    bool ReadAddrIndexEntry(leveldb::Iterator* iterator, uint160 addrid, int nHeightEnd, CAddrIndexKey& key, CAddrIndexValue& value);
 };
 
 
@@ -84,6 +84,105 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
+/** Shared state for generating a batch of keys on worker threads */
+struct CNewKeyJob
+{
+    bool fCompressed;
+    const CKeyingMaterial* pMasterKey; // NULL for unencrypted wallets
+    std::vector<CKey> vKey;
+    std::vector<CPubKey> vPubKey;
+    std::vector<std::vector<unsigned char> > vCryptedSecret;
+    std::vector<char> vOk; // char, not bool: workers write neighbouring slots concurrently
+};
+
+static void GenerateNewKeysRange(CNewKeyJob* pjob, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+    {
+        CKey& secret = pjob->vKey[i];
+        secret.MakeNewKey(pjob->fCompressed, false);
+        CPubKey pubkey = secret.GetPubKey();
+        if (!secret.VerifyPubKey(pubkey))
+            continue;
+        pjob->vPubKey[i] = pubkey;
+
+        if (pjob->pMasterKey)
+        {
+            CKeyingMaterial vchSecret(secret.begin(), secret.end());
+            if (!EncryptSecret(*pjob->pMasterKey, vchSecret, pubkey.GetHash(), pjob->vCryptedSecret[i]))
+                continue;
+        }
+        pjob->vOk[i] = 1;
+    }
+}
+
+void CWallet::GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeysRet)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    vPubKeysRet.clear();
+    if (nKeys == 0)
+        return;
+
+    int64_t nStart = GetTimeMillis();
+    CNewKeyJob job;
+    job.fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY);
+    job.pMasterKey = NULL;
+    job.vKey.resize(nKeys);
+    job.vPubKey.resize(nKeys);
+    job.vCryptedSecret.resize(nKeys);
+    job.vOk.assign(nKeys, 0);
+
+    CKeyingMaterial vMasterKeyCopy;
+    if (IsCrypted())
+    {
+        LOCK(cs_KeyStore);
+        if (vMasterKey.empty())
+            throw std::runtime_error("CWallet::GenerateNewKeys() : wallet is locked");
+        vMasterKeyCopy = vMasterKey;
+        job.pMasterKey = &vMasterKeyCopy;
+    }
+
+    if (job.fCompressed)
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    // Seed once for the whole batch, the workers only draw from the PRNG
+    RandAddSeedPerfmon();
+
+    unsigned int nThreads = std::min(boost::thread::hardware_concurrency(), nKeys / 16);
+    if (nThreads <= 1)
+        GenerateNewKeysRange(&job, 0, nKeys);
+    else
+    {
+        boost::thread_group threadGroup;
+        size_t nPerThread = (nKeys + nThreads - 1) / nThreads;
+        for (size_t nBegin = 0; nBegin < nKeys; nBegin += nPerThread)
+            threadGroup.create_thread(boost::bind(&GenerateNewKeysRange, &job, nBegin, std::min((size_t)nKeys, nBegin + nPerThread)));
+        threadGroup.join_all();
+    }
+    int64_t nDerived = GetTimeMillis();
+
+    // Add to the keystore and wallet.dat in order
+    int64_t nCreationTime = GetTime();
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        if (!job.vOk[i])
+            throw std::runtime_error("CWallet::GenerateNewKeys() : key generation failed");
+
+        const CPubKey& pubkey = job.vPubKey[i];
+        mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
+        bool fAdded = job.pMasterKey ? AddCryptedKey(pubkey, job.vCryptedSecret[i]) : AddKeyPubKey(job.vKey[i], pubkey);
+        if (!fAdded)
+            throw std::runtime_error("CWallet::GenerateNewKeys() : AddKey failed");
+        vPubKeysRet.push_back(pubkey);
+    }
+    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+        nTimeFirstKey = nCreationTime;
+
+    int64_t nElapsed = std::max(GetTimeMillis() - nStart, (int64_t)1);
+    LogPrintf("GenerateNewKeys : %u keys on %u threads in %dms (%dms derive), %.1f keys/s\n",
+              nKeys, std::max(nThreads, 1u), nElapsed, nDerived - nStart, 1000.0 * nKeys / nElapsed);
+}
+
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -438,6 +537,16 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+std::set<uint256> CWallet::GetTxBlockHashes() const
+{
+    std::set<uint256> setBlocks;
+    LOCK_SHARED(cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        if ((*it).second.hashBlock != 0)
+            setBlocks.insert((*it).second.hashBlock);
+    return setBlocks;
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -693,6 +802,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
             if (!wtx.WriteToDisk())
                 return false;
 
+        if (fInsertedNew)
+            UpdateDenominatedCoins(wtx);
+
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
@@ -779,7 +891,10 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            denominatedCoins.MarkStale();
+        }
     }
     return;
 }
@@ -927,10 +1042,7 @@ bool CWallet::IsDenominated(const CTxIn &txin) const
 
 bool CWallet::IsDenominatedAmount(int64_t nInputAmount) const
 {
-    BOOST_FOREACH(int64_t d, darkSendDenominations)
-        if(nInputAmount == d)
-            return true;
-    return false;
+    return GetDenominationIndex(nInputAmount) != -1;
 }
 
 
@@ -1170,6 +1282,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK2(cs_main, cs_wallet);
+        CDBBatch batch(strWalletFile, "ScanForWalletTransactions");
         while (pindex)
         {
             // no need to read and scan block, if block was created before
@@ -1186,6 +1299,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
                 if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
                     ret++;
             }
+            // don't keep a write from an early block locked while reading the rest of the chain
+            batch.CommitIfStale();
             pindex = pindex->pnext;
         }
     }
@@ -1272,7 +1387,7 @@ void CWalletTx::RelayWalletTransaction(CTxDB& txdb, std::string strCommand)
             uint256 hash = GetHash();
             if(strCommand == "txlreq"){
                 LogPrintf("Relaying txlreq %s\n", hash.ToString());
-                mapTxLockReq.insert(make_pair(hash, ((CTransaction)*this)));
+                txLockStore.AddRequest((CTransaction)*this);
                 CreateNewLock(((CTransaction)*this));
                 RelayTransactionLockReq((CTransaction)*this, true);
             } else {
@@ -1361,7 +1476,8 @@ CAmount CWallet::GetBalance() const
 {
     CAmount nTotal = 0;
     {
-        LOCK2(cs_main, cs_wallet);
+        CChainDepthSnapshot depths(GetTxBlockHashes());
+        LOCK_SHARED(cs_wallet);
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
@@ -1617,52 +1733,69 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     {
         LOCK2(cs_main, cs_wallet);
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
+            AddAvailableCoins((*it).first, &(*it).second, vCoins, fOnlyConfirmed, coinControl, coin_type, useIX);
+    }
+}
 
-            if (!IsFinalTx(*pcoin))
-                continue;
+bool CWallet::AvailableCoinsBatch(vector<COutput>& vCoins, uint256& hashFrom, unsigned int nMaxTx, bool fOnlyConfirmed) const
+{
+    vCoins.clear();
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+    assert(CChainDepthSnapshot::GetCurrent());
+    LOCK_SHARED(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.lower_bound(hashFrom);
+    for (unsigned int n = 0; it != mapWallet.end() && n < nMaxTx; ++it, ++n)
+        AddAvailableCoins((*it).first, &(*it).second, vCoins, fOnlyConfirmed, NULL, ALL_COINS, false);
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+    if (it == mapWallet.end())
+        return false;
+    hashFrom = (*it).first;
+    return true;
+}
 
-            if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+void CWallet::AddAvailableCoins(const uint256& hash, const CWalletTx* pcoin, vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, AvailableCoinsType coin_type, bool useIX) const
+{
+    if (!IsFinalTx(*pcoin))
+        return;
 
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            if (nDepth <= 0) // TXNOTE: coincontrol fix / ignore 0 confirm
-                continue;
+    if (fOnlyConfirmed && !pcoin->IsTrusted())
+        return;
 
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (useIX && nDepth < 10)
-                continue;
+    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+        return;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if(coin_type == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if(coin_type == ONLY_NOT10000IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == MasternodeCollateral(pindexBest->nHeight)*COIN);
-                } else if (coin_type == ONLY_NONDENOMINATED_NOT10000IFMN){
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if(found && fMasterNode) found = pcoin->vout[i].nValue != MasternodeCollateral(pindexBest->nHeight)*COIN; // do not use Hot MN funds
-                } else {
-                    found = true;
-                }
-                if(!found) continue;
+    if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
+        return;
 
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(pcoin->IsSpent(i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                {
-                    vCoins.push_back(COutput(pcoin, i, nDepth, mine & ISMINE_SPENDABLE));
-                }
-            }
+    int nDepth = pcoin->GetDepthInMainChain(false);
+    if (nDepth <= 0) // TXNOTE: coincontrol fix / ignore 0 confirm
+        return;
+
+    // do not use IX for inputs that have less then 6 blockchain confirmations
+    if (useIX && nDepth < 10)
+        return;
+
+    for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+        bool found = false;
+        if(coin_type == ONLY_DENOMINATED) {
+            found = IsDenominatedAmount(pcoin->vout[i].nValue);
+        } else if(coin_type == ONLY_NOT10000IFMN) {
+            found = !(fMasterNode && pcoin->vout[i].nValue == MasternodeCollateral(pindexBest->nHeight)*COIN);
+        } else if (coin_type == ONLY_NONDENOMINATED_NOT10000IFMN){
+            if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+            found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+            if(found && fMasterNode) found = pcoin->vout[i].nValue != MasternodeCollateral(pindexBest->nHeight)*COIN; // do not use Hot MN funds
+        } else {
+            found = true;
+        }
+        if(!found) continue;
+
+        isminetype mine = IsMine(pcoin->vout[i]);
+        if (!(pcoin->IsSpent(i)) && mine != ISMINE_NO &&
+            !IsLockedCoin(hash, i) && pcoin->vout[i].nValue > 0 &&
+            (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(hash, i)))
+        {
+            vCoins.push_back(COutput(pcoin, i, nDepth, mine & ISMINE_SPENDABLE));
         }
     }
 }
@@ -1673,6 +1806,7 @@ void CWallet::AvailableCoinsMN(vector<COutput>& vCoins, bool fOnlyConfirmed, con
 
     {
         LOCK2(cs_main, cs_wallet);
+        CSchedulerLockTimer lockTimer;     // ManageStatus picks the collateral here
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
@@ -2074,6 +2208,165 @@ struct CompareByPriority
     }
 };
 
+bool CDenominatedCoinPool::IsStale() const
+{
+    LOCK(cs);
+    return fStale;
+}
+
+void CDenominatedCoinPool::MarkStale()
+{
+    LOCK(cs);
+    fStale = true;
+}
+
+void CDenominatedCoinPool::Clear()
+{
+    LOCK(cs);
+    mapCoins.clear();
+    mapBuckets.clear();
+    fStale = false;
+}
+
+void CDenominatedCoinPool::Add(const COutPoint& outpoint, int nDenom, int nRounds)
+{
+    LOCK(cs);
+    if (mapCoins.count(outpoint))
+        return;
+
+    std::vector<COutPoint>& vBucket = mapBuckets[make_pair(nDenom, nRounds)];
+    CDenominatedCoin& coin = mapCoins[outpoint];
+    coin.nDenom = nDenom;
+    coin.nRounds = nRounds;
+    coin.nPos = vBucket.size();
+    vBucket.push_back(outpoint);
+}
+
+void CDenominatedCoinPool::Remove(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    std::map<COutPoint, CDenominatedCoin>::iterator it = mapCoins.find(outpoint);
+    if (it == mapCoins.end())
+        return;
+
+    std::map<std::pair<int, int>, std::vector<COutPoint> >::iterator itBucket = mapBuckets.find(make_pair(it->second.nDenom, it->second.nRounds));
+    std::vector<COutPoint>& vBucket = itBucket->second;
+
+    // fill the hole with the last output of the bucket
+    vBucket[it->second.nPos] = vBucket.back();
+    mapCoins[vBucket.back()].nPos = it->second.nPos;
+    vBucket.pop_back();
+    if (vBucket.empty())
+        mapBuckets.erase(itBucket);
+
+    mapCoins.erase(it);
+}
+
+void CDenominatedCoinPool::GetCoins(int nDenomMask, int nRoundsMin, int nRoundsMax, int nRoundsCap, std::vector<COutPoint>& vCoinsRet) const
+{
+    LOCK(cs);
+    vCoinsRet.clear();
+
+    // at most one bucket per denomination and round, so this doesn't grow with the wallet
+    for (std::map<std::pair<int, int>, std::vector<COutPoint> >::const_iterator it = mapBuckets.begin(); it != mapBuckets.end(); ++it)
+    {
+        if (!(nDenomMask & (1 << it->first.first)))
+            continue;
+        int nRounds = std::min(it->first.second, nRoundsCap);
+        if (nRounds < nRoundsMin || nRounds >= nRoundsMax)
+            continue;
+        vCoinsRet.insert(vCoinsRet.end(), it->second.begin(), it->second.end());
+    }
+}
+
+int CDenominatedCoinPool::size() const
+{
+    LOCK(cs);
+    return mapCoins.size();
+}
+
+void CWallet::AddDenominatedCoins(const CWalletTx& wtx) const
+{
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        int nDenom = GetDenominationIndex(wtx.vout[i].nValue);
+        if (nDenom == -1 || wtx.IsSpent(i) || IsMine(wtx.vout[i]) == ISMINE_NO)
+            continue;
+        denominatedCoins.Add(COutPoint(hash, i), nDenom, GetRealInputDarksendRounds(CTxIn(hash, i), 0));
+    }
+}
+
+void CWallet::UpdateDenominatedCoins(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+
+    // nothing to update until it's first built
+    if (denominatedCoins.IsStale())
+        return;
+
+    if (!wtx.IsCoinBase())
+    {
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            denominatedCoins.Remove(txin.prevout);
+    }
+
+    AddDenominatedCoins(wtx);
+}
+
+void CWallet::RebuildDenominatedCoins() const
+{
+    LOCK(cs_wallet);
+
+    denominatedCoins.Clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddDenominatedCoins((*it).second);
+
+    LogPrint("darksend", "RebuildDenominatedCoins -- %d denominated outputs\n", denominatedCoins.size());
+}
+
+// populate vCoins with the available denominated outputs in nDenomMask with rounds in [nDarksendRoundsMin, nDarksendRoundsMax)
+void CWallet::GetDenominatedCoins(int nDenomMask, int nDarksendRoundsMin, int nDarksendRoundsMax, vector<COutput>& vCoins) const
+{
+    vCoins.clear();
+
+    if (denominatedCoins.IsStale())
+        RebuildDenominatedCoins();
+
+    vector<COutPoint> vCandidates;
+    denominatedCoins.GetCoins(nDenomMask, nDarksendRoundsMin, nDarksendRoundsMax, nDarksendRounds, vCandidates);
+
+    // only the candidates are checked, the same way AvailableCoins checks every output in the wallet
+    LOCK2(cs_main, cs_wallet);
+    BOOST_FOREACH(const COutPoint& outpoint, vCandidates)
+    {
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+        if (it == mapWallet.end() || outpoint.n >= (*it).second.vout.size() || (*it).second.IsSpent(outpoint.n))
+        {
+            denominatedCoins.Remove(outpoint);
+            continue;
+        }
+
+        const CWalletTx* pcoin = &(*it).second;
+
+        if (!IsFinalTx(*pcoin) || !pcoin->IsTrusted())
+            continue;
+
+        if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
+            continue;
+
+        int nDepth = pcoin->GetDepthInMainChain(false);
+        if (nDepth <= 0)
+            continue;
+
+        isminetype mine = IsMine(pcoin->vout[outpoint.n]);
+        if (mine == ISMINE_NO || IsLockedCoin(outpoint.hash, outpoint.n))
+            continue;
+
+        vCoins.push_back(COutput(pcoin, outpoint.n, nDepth, mine & ISMINE_SPENDABLE));
+    }
+}
+
 bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& vCoinsRet, std::vector<COutput>& vCoinsRet2, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax)
 {
     vCoinsRet.clear();
@@ -2081,46 +2374,23 @@ bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t
 
     vCoinsRet2.clear();
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, ONLY_DENOMINATED);
+    GetDenominatedCoins(nDenom, nDarksendRoundsMin, nDarksendRoundsMax, vCoins);
 
     std::random_shuffle(vCoins.rbegin(), vCoins.rend());
 
     //keep track of each denomination that we have
-    bool fFound1000 = false;
-    bool fFound100 = false;
-    bool fFound10 = false;
-    bool fFound1 = false;
-    bool fFoundDot1 = false;
-
     //Check to see if any of the denomination are off, in that case mark them as fulfilled
-    if(!(nDenom & (1 << 0))) fFound1000 = true;
-    if(!(nDenom & (1 << 1))) fFound100 = true;
-    if(!(nDenom & (1 << 2))) fFound10 = true;
-    if(!(nDenom & (1 << 3))) fFound1 = true;
-    if(!(nDenom & (1 << 4))) fFoundDot1 = true;
+    std::vector<bool> vFound(darkSendDenominations.size());
+    for(unsigned int i = 0; i < vFound.size(); i++)
+        vFound[i] = !(nDenom & (1 << i));
 
     BOOST_FOREACH(const COutput& out, vCoins)
     {
-        // masternode-like input should not be selected by AvailableCoins now anyway
-        //if(out.tx->vout[out.i].nValue == 1000*COIN) continue;
+        // only outputs of the requested denominations and rounds come out of the pool
         if(nValueRet + out.tx->vout[out.i].nValue <= nValueMax){
-            bool fAccepted = false;
-
-            // Function returns as follows:
-            //
-            // bit 0 - 1000 ARION +1 ( bit on if present )
-            // bit 1 - 100 ARION +1
-            // bit 2 - 10 ARION +1
-            // bit 3 - 1 ARION +1
-            // bit 4 - .1 ARION +1
-
             CTxIn vin = CTxIn(out.tx->GetHash(),out.i);
 
-            int rounds = GetInputDarksendRounds(vin);
-            if(rounds >= nDarksendRoundsMax) continue;
-            if(rounds < nDarksendRoundsMin) continue;
-
-            if(fFound1000 && fFound100 && fFound10 && fFound1 && fFoundDot1){ //if fulfilled
+            if(std::find(vFound.begin(), vFound.end(), false) == vFound.end()){ //if fulfilled
                 //we can return this for submission
                 if(nValueRet >= nValueMin){
                     //random reduce the max amount we'll submit for anonymity
@@ -2130,20 +2400,8 @@ bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t
                     if((int)vCoinsRet.size() > r) return true;
                 }
                 //Denomination criterion has been met, we can take any matching denominations
-                if((nDenom & (1 << 0)) && out.tx->vout[out.i].nValue == ((1000*COIN)    +1000000)) {fAccepted = true;}
-                else if((nDenom & (1 << 1)) && out.tx->vout[out.i].nValue == ((100*COIN)     +100000)) {fAccepted = true;}
-                else if((nDenom & (1 << 2)) && out.tx->vout[out.i].nValue == ((10*COIN)      +10000)) {fAccepted = true;}
-                else if((nDenom & (1 << 3)) && out.tx->vout[out.i].nValue == ((1*COIN)       +1000)) {fAccepted = true;}
-                else if((nDenom & (1 << 4)) && out.tx->vout[out.i].nValue == ((.1*COIN)      +100)) {fAccepted = true;}
-            } else {
-                //Criterion has not been satisfied, we will only take 1 of each until it is.
-                if((nDenom & (1 << 0)) && out.tx->vout[out.i].nValue == ((1000*COIN)    +1000000)) {fAccepted = true; fFound1000 = true;}
-                else if((nDenom & (1 << 1)) && out.tx->vout[out.i].nValue == ((100*COIN)     +100000)) {fAccepted = true; fFound100 = true;}
-                else if((nDenom & (1 << 2)) && out.tx->vout[out.i].nValue == ((10*COIN)      +10000)) {fAccepted = true; fFound10 = true;}
-                else if((nDenom & (1 << 3)) && out.tx->vout[out.i].nValue == ((1*COIN)       +1000)) {fAccepted = true; fFound1 = true;}
-                else if((nDenom & (1 << 4)) && out.tx->vout[out.i].nValue == ((.1*COIN)      +100)) {fAccepted = true; fFoundDot1 = true;}
             }
-            if(!fAccepted) continue;
+            vFound[GetDenominationIndex(out.tx->vout[out.i].nValue)] = true;
 
             vin.prevPubKey = out.tx->vout[out.i].scriptPubKey; // the inputs PubKey
             nValueRet += out.tx->vout[out.i].nValue;
@@ -2152,7 +2410,7 @@ bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t
         }
     }
 
-    return (nValueRet >= nValueMin && fFound1000 && fFound100 && fFound10 && fFound1 && fFoundDot1);
+    return (nValueRet >= nValueMin && std::find(vFound.begin(), vFound.end(), false) == vFound.end());
 }
 
 bool CWallet::SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& setCoinsRet, CAmount& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const
@@ -2163,7 +2421,10 @@ bool CWallet::SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<
     nValueRet = 0;
 
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl, nDarksendRoundsMin < 0 ? ONLY_NONDENOMINATED_NOT10000IFMN : ONLY_DENOMINATED);
+    if(nDarksendRoundsMin < 0)
+        AvailableCoins(vCoins, true, coinControl, ONLY_NONDENOMINATED_NOT10000IFMN);
+    else
+        GetDenominatedCoins((1 << darkSendDenominations.size()) - 1, nDarksendRoundsMin, nDarksendRoundsMax, vCoins);
 
     set<pair<const CWalletTx*,unsigned int> > setCoinsRet2;
 
@@ -3987,6 +4248,7 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
+        CDBBatch batch(strWalletFile, "NewKeyPool");
         CWalletDB walletdb(strWalletFile);
         BOOST_FOREACH(int64_t nIndex, setKeyPool)
             walletdb.ErasePool(nIndex);
@@ -4003,10 +4265,12 @@ bool CWallet::NewKeyPool()
         else
             nKeys = max(GetArg("-keypool", 1000), (int64_t)0);
 
+        std::vector<CPubKey> vPubKeys;
+        GenerateNewKeys(nKeys, vPubKeys);
         for (int i = 0; i < nKeys; i++)
         {
             int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
+            walletdb.WritePool(nIndex, CKeyPool(vPubKeys[i]));
             setKeyPool.insert(nIndex);
         }
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
@@ -4022,6 +4286,8 @@ bool CWallet::TopUpKeyPool(unsigned int nSize)
         if (IsLocked())
             return false;
 
+        // Write the new keys, their metadata and pool entries in one transaction
+        CDBBatch batch(strWalletFile, "TopUpKeyPool");
         CWalletDB walletdb(strWalletFile);
 
         // Top up key pool
@@ -4035,19 +4301,27 @@ bool CWallet::TopUpKeyPool(unsigned int nSize)
         else
             nTargetSize = max(GetArg("-keypool", 1000), (int64_t)0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        if (setKeyPool.size() >= (nTargetSize + 1))
+            return true;
+
+        std::vector<CPubKey> vPubKeys;
+        GenerateNewKeys(nTargetSize + 1 - setKeyPool.size(), vPubKeys);
+        for (unsigned int i = 0; i < vPubKeys.size(); i++)
         {
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+            if (!walletdb.WritePool(nEnd, CKeyPool(vPubKeys[i])))
                 throw runtime_error("TopUpKeyPool() : writing generated key failed");
             setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
-            double dProgress = 100.f * nEnd / (nTargetSize + 1);
-            std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
-            uiInterface.InitMessage(strMsg);
+            if (i % 100 == 0)
+            {
+                double dProgress = 100.f * nEnd / (nTargetSize + 1);
+                std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
+                uiInterface.InitMessage(strMsg);
+            }
         }
+        LogPrintf("keypool added %u keys, size=%u\n", vPubKeys.size(), setKeyPool.size());
     }
     return true;
 }
@@ -4314,6 +4588,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkUnspent(n);
                     pcoin->WriteToDisk();
+                    denominatedCoins.MarkStale();
                 }
             }
             else if (IsMine(pcoin->vout[n]) && !pcoin->IsSpent(n) && (txindex.vSpent.size() > n && !txindex.vSpent[n].IsNull()))
@@ -4326,6 +4601,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkSpent(n);
                     pcoin->WriteToDisk();
+                    denominatedCoins.Remove(COutPoint(pcoin->GetHash(), n));
                 }
             }
         }
@@ -4349,6 +4625,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             {
                 prev.MarkUnspent(txin.prevout.n);
                 prev.WriteToDisk();
+                denominatedCoins.MarkStale();
             }
         }
     }
@@ -4490,7 +4767,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        BlockMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && blit->second->IsInMainChain()) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
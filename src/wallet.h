@@ -84,6 +84,48 @@ public:
     )
 };
 
+/** Denominated outputs of the wallet, bucketed by denomination and Darksend rounds.
+ *
+ * Lets Darksend pick inputs for a session without walking the whole wallet. It is kept up to
+ * date as transactions are added and coins are spent; whatever it can't follow incrementally
+ * (disconnected coinstakes, repaired spent flags, erased transactions) marks it stale and it is
+ * rebuilt on next use. Candidates are only hints: the wallet still checks a picked output is
+ * confirmed, unspent and unlocked before using it.
+ */
+class CDenominatedCoinPool
+{
+private:
+    class CDenominatedCoin
+    {
+    public:
+        int nDenom;         // index in darkSendDenominations
+        int nRounds;        // uncapped Darksend rounds
+        unsigned int nPos;  // position in its bucket
+    };
+
+    mutable CCriticalSection cs;
+    bool fStale;
+    std::map<COutPoint, CDenominatedCoin> mapCoins;
+    // (denomination index, rounds) -> outputs, in no particular order
+    std::map<std::pair<int, int>, std::vector<COutPoint> > mapBuckets;
+
+public:
+    CDenominatedCoinPool() : fStale(true) {}
+
+    bool IsStale() const;
+    void MarkStale();
+    // Empty the pool and mark it current, before refilling it
+    void Clear();
+
+    void Add(const COutPoint& outpoint, int nDenom, int nRounds);
+    void Remove(const COutPoint& outpoint);
+
+    // Outputs of the denominations in nDenomMask whose rounds, capped at nRoundsCap, are in [nRoundsMin, nRoundsMax)
+    void GetCoins(int nDenomMask, int nRoundsMin, int nRoundsMax, int nRoundsCap, std::vector<COutPoint>& vCoinsRet) const;
+
+    int size() const;
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -93,6 +135,8 @@ private:
     bool SelectCoinsForStaking(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
     //bool SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl=NULL) const;
     bool SelectCoins(CAmount nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = false) const;
+    // Adds the available outputs of one wallet transaction, for AvailableCoins
+    void AddAvailableCoins(const uint256& hash, const CWalletTx* pcoin, std::vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, AvailableCoinsType coin_type, bool useIX) const;
     CWalletDB *pwalletdbEncryption;
 
     // the current wallet version: clients below this version are not able to load the wallet
@@ -111,13 +155,22 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    // denominated outputs by denomination and rounds, filled on first use
+    mutable CDenominatedCoinPool denominatedCoins;
+    void AddDenominatedCoins(const CWalletTx& wtx) const;
+    void UpdateDenominatedCoins(const CWalletTx& wtx);
+    void RebuildDenominatedCoins() const;
+    void GetDenominatedCoins(int nDenomMask, int nDarksendRoundsMin, int nDarksendRoundsMax, std::vector<COutput>& vCoins) const;
+
 public:
     /// Main wallet lock.
     /// This lock protects all the fields added by CWallet
     ///   except for:
     ///      fFileBacked (immutable after instantiation)
     ///      strWalletFile (immutable after instantiation)
-    mutable CCriticalSection cs_wallet;
+    /// Read-only listings hold it shared (LOCK_SHARED) under a
+    /// CChainDepthSnapshot of GetTxBlockHashes(), taken first.
+    mutable CSharedCriticalSection cs_wallet;
 
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
     bool SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& vCoinsRet, std::vector<COutput>& vCoinsRet2, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax);
@@ -201,10 +254,16 @@ public:
 
     void AvailableCoinsForStaking(std::vector<COutput>& vCoins, unsigned int nSpendTime) const;
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = false) const;
+    // AvailableCoins for at most nMaxTx wallet transactions from hashFrom on, in the same order; hashFrom is
+    // set to where the next call goes on, false once the wallet is done. Holds cs_wallet shared, so the
+    // caller must have a CChainDepthSnapshot of GetTxBlockHashes() in scope
+    bool AvailableCoinsBatch(std::vector<COutput>& vCoins, uint256& hashFrom, unsigned int nMaxTx, bool fOnlyConfirmed=true) const;
     void AvailableCoinsMN(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = false) const;
     bool SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
+    // blocks holding wallet transactions, for a CChainDepthSnapshot
+    std::set<uint256> GetTxBlockHashes() const;
 
     bool IsLockedCoin(uint256 hash, unsigned int n) const;
     void LockCoin(COutPoint& output);
@@ -216,6 +275,8 @@ public:
     // keystore implementation
     // Generate a new key
     CPubKey GenerateNewKey();
+    // Generate nKeys new keys, deriving and encrypting them on worker threads
+    void GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeysRet);
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
@@ -178,6 +178,12 @@ bool CWalletDB::ErasePool(int64_t nPool)
     return Erase(std::make_pair(std::string("pool"), nPool));
 }
 
+bool CWalletDB::WriteCleanShutdown(bool fClean)
+{
+    nWalletDBUpdated++;
+    return Write(std::string("cleanshutdown"), fClean);
+}
+
 bool CWalletDB::WriteMinVersion(int nVersion)
 {
     return Write(std::string("minversion"), nVersion);
@@ -344,6 +350,7 @@ public:
     unsigned int nKeyMeta;
     bool fIsEncrypted;
     bool fAnyUnordered;
+    bool fCleanShutdown;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
 
@@ -351,13 +358,49 @@ public:
         nKeys = nCKeys = nKeyMeta = 0;
         fIsEncrypted = false;
         fAnyUnordered = false;
+        fCleanShutdown = false;
         nFileVersion = 0;
     }
 };
 
+/** A raw wallet.dat record, read sequentially and decoded later */
+struct CWalletRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    // "tx" records only: the transaction was deserialized into mapWallet by a
+    // loader thread, fTxValid holds its CheckTransaction/hash result
+    bool fTxDecoded;
+    bool fTxValid;
+    CWalletTx* pwtx;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION),
+                      fTxDecoded(false), fTxValid(false), pwtx(NULL) {}
+};
+
+static void DecodeWalletTxRange(std::vector<CWalletRecord*>* pvRecords, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+    {
+        CWalletRecord& rec = *(*pvRecords)[i];
+        try {
+            rec.ssValue >> *rec.pwtx;
+            uint256 hash;
+            CDataStream ssKey(rec.ssKey);
+            string strType;
+            ssKey >> strType >> hash;
+            rec.fTxValid = rec.pwtx->CheckTransaction() && (rec.pwtx->GetHash() == hash);
+        } catch (...) {
+            rec.fTxValid = false;
+        }
+        rec.fTxDecoded = true;
+    }
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
-             CWalletScanState &wss, string& strType, string& strErr)
+             CWalletScanState &wss, string& strType, string& strErr,
+             const CWalletRecord* pRecord = NULL)
 {
     try {
         // Unserialize
@@ -375,9 +418,17 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             uint256 hash;
             ssKey >> hash;
             CWalletTx& wtx = pwallet->mapWallet[hash];
-            ssValue >> wtx;
-            if (!(wtx.CheckTransaction() && (wtx.GetHash() == hash)))
-                return false;
+            if (pRecord && pRecord->fTxDecoded)
+            {
+                if (!pRecord->fTxValid)
+                    return false;
+            }
+            else
+            {
+                ssValue >> wtx;
+                if (!(wtx.CheckTransaction() && (wtx.GetHash() == hash)))
+                    return false;
+            }
 
             // Undo serialize changes in 31600
             if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
@@ -486,7 +537,8 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             }
             catch(...){}
 
-            bool fSkipCheck = false;
+            // The EC pubkey check is only needed to catch corruption after an unclean shutdown
+            bool fSkipCheck = wss.fCleanShutdown;
 
             if (hash != 0)
             {
@@ -633,6 +685,8 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     CWalletScanState wss;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    int64_t nStart = GetTimeMillis();
+    int64_t nReadTime = 0, nDecodeTime = 0, nApplyTime = 0;
 
     try {
         LOCK(pwallet->cs_wallet);
@@ -643,6 +697,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_TOO_NEW;
             pwallet->LoadMinVersion(nMinVersion);
         }
+        Read((string)"cleanshutdown", wss.fCleanShutdown);
 
         // Get cursor
         Dbc* pcursor = GetCursor();
@@ -652,23 +707,70 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Read all raw records first, so the cursor is not held while decoding
+        std::vector<CWalletRecord> vRecords;
         while (true)
         {
             // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            vRecords.push_back(CWalletRecord());
+            CWalletRecord& rec = vRecords.back();
+            int ret = ReadAtCursor(pcursor, rec.ssKey, rec.ssValue);
             if (ret == DB_NOTFOUND)
+            {
+                vRecords.pop_back();
                 break;
+            }
             else if (ret != 0)
             {
+                pcursor->close();
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
+        }
+        pcursor->close();
+        nReadTime = GetTimeMillis() - nStart;
+
+        // Deserialize and check the transactions on loader threads. Each
+        // record decodes into its own, pre-created mapWallet entry.
+        std::vector<CWalletRecord*> vTxRecords;
+        BOOST_FOREACH(CWalletRecord& rec, vRecords)
+        {
+            try {
+                CDataStream ssKey(rec.ssKey);
+                string strType;
+                ssKey >> strType;
+                if (strType != "tx")
+                    continue;
+                uint256 hash;
+                ssKey >> hash;
+                rec.pwtx = &pwallet->mapWallet[hash];
+                vTxRecords.push_back(&rec);
+            } catch (...) {
+                // left to ReadKeyValue to report
+            }
+        }
+        unsigned int nThreads = std::min(boost::thread::hardware_concurrency(), (unsigned int)(vTxRecords.size() / 64));
+        if (nThreads <= 1)
+            DecodeWalletTxRange(&vTxRecords, 0, vTxRecords.size());
+        else
+        {
+            boost::thread_group threadGroup;
+            size_t nPerThread = (vTxRecords.size() + nThreads - 1) / nThreads;
+            for (size_t nBegin = 0; nBegin < vTxRecords.size(); nBegin += nPerThread)
+                threadGroup.create_thread(boost::bind(&DecodeWalletTxRange, &vTxRecords, nBegin, std::min(vTxRecords.size(), nBegin + nPerThread)));
+            threadGroup.join_all();
+        }
+        nDecodeTime = GetTimeMillis() - nStart - nReadTime;
+
+        // Apply the records in their on-disk order
+        BOOST_FOREACH(CWalletRecord& rec, vRecords)
+        {
+            CDataStream& ssKey = rec.ssKey;
+            CDataStream& ssValue = rec.ssValue;
 
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr, &rec))
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
@@ -686,7 +788,10 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+        nApplyTime = GetTimeMillis() - nStart - nReadTime - nDecodeTime;
+        LogPrintf("LoadWallet : %u records read in %dms, %u transactions decoded on %u threads in %dms, applied in %dms%s\n",
+                  vRecords.size(), nReadTime, vTxRecords.size(), std::max(nThreads, 1u), nDecodeTime, nApplyTime,
+                  wss.fCleanShutdown ? " (clean shutdown, key checks skipped)" : "");
     }
     catch (boost::thread_interrupted) {
         throw;
@@ -723,6 +828,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.nFileVersion < CLIENT_VERSION) // Update
         WriteVersion(CLIENT_VERSION);
 
+    int64_t nPostStart = GetTimeMillis();
     if (wss.fAnyUnordered)
         result = ReorderTransactions(pwallet);
 
@@ -732,6 +838,12 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         pwallet->wtxOrdered.insert(make_pair(entry.nOrderPos, CWallet::TxPair((CWalletTx*)0, &entry)));
     }
 
+    // Only a clean shutdown sets this again, see WriteCleanShutdown
+    if (wss.fCleanShutdown)
+        Erase(string("cleanshutdown"));
+
+    LogPrintf("LoadWallet : post-processing %dms, total %dms\n", GetTimeMillis() - nPostStart, GetTimeMillis() - nStart);
+
     return result;
 }
 
@@ -136,6 +136,9 @@ public:
 
     bool WriteMinVersion(int nVersion);
 
+    // Marks the wallet as cleanly shut down; LoadWallet clears it again
+    bool WriteCleanShutdown(bool fClean);
+
     bool ReadAccount(const std::string& strAccount, CAccount& account);
     bool WriteAccount(const std::string& strAccount, const CAccount& account);
 private: